@@ -25,6 +25,7 @@ static uint32_t s_palette[256];
 static int s_screen;
 static Visual *s_visual;
 static int s_depth;
+static int s_converted = 0; // s_ximage holds a frame
 
 extern void HandleInput(unsigned int keycode, int isKeyDown);
 extern void HandleMouse(int x, int y, int buttons);
@@ -64,7 +65,7 @@ static unsigned int translate_key(KeySym keysym) {
     }
 }
 
-static void convert_buffer_to_image() {
+static void convert_buffer_to_image(const mfb_rect_t *rect) {
     static int first_call = 1;
     if (!s_buffer || !s_image_data) {
         if (first_call) {
@@ -84,8 +85,8 @@ static void convert_buffer_to_image() {
     
     if (s_depth == 32) {
         uint32_t *dst = (uint32_t *)s_image_data;
-        for (int y = 0; y < s_height; y++) {
-            for (int x = 0; x < s_width; x++) {
+        for (int y = rect->y; y < rect->y + rect->height; y++) {
+            for (int x = rect->x; x < rect->x + rect->width; x++) {
                 uint32_t pixel = src[y * s_width + x];
                 if (s_palette[0] != 0) {
                     uint8_t index = pixel & 0xFF;
@@ -96,8 +97,8 @@ static void convert_buffer_to_image() {
         }
     } else if (s_depth == 24) {
         uint8_t *dst = (uint8_t *)s_image_data;
-        for (int y = 0; y < s_height; y++) {
-            for (int x = 0; x < s_width; x++) {
+        for (int y = rect->y; y < rect->y + rect->height; y++) {
+            for (int x = rect->x; x < rect->x + rect->width; x++) {
                 uint32_t pixel = src[y * s_width + x];
                 if (s_palette[0] != 0) {
                     uint8_t index = pixel & 0xFF;
@@ -111,8 +112,8 @@ static void convert_buffer_to_image() {
             }
         }
     } else {
-        for (int y = 0; y < s_height; y++) {
-            for (int x = 0; x < s_width; x++) {
+        for (int y = rect->y; y < rect->y + rect->height; y++) {
+            for (int x = rect->x; x < rect->x + rect->width; x++) {
                 uint32_t pixel = src[y * s_width + x];
                 if (s_palette[0] != 0) {
                     uint8_t index = pixel & 0xFF;
@@ -214,9 +215,29 @@ void mfb_set_pallete(const uint8_t color_index, const uint32_t color) {
     }
 }
 
-int mfb_update(void *buffer, int fps_limit) {
+// Shows a rect of the image as last converted
+static void put_rect(const mfb_rect_t *rect) {
+    if (s_scale == 1) {
+        XPutImage(s_display, s_window, s_gc, s_ximage, rect->x, rect->y, rect->x, rect->y, rect->width, rect->height);
+    } else {
+        for (int sy = rect->y; sy < rect->y + rect->height; sy++) {
+            for (int dy = 0; dy < s_scale; dy++) {
+                XPutImage(s_display, s_window, s_gc, s_ximage, 
+                         rect->x, sy, rect->x, sy * s_scale + dy, rect->width, 1);
+                for (int dx = 1; dx < s_scale; dx++) {
+                    XCopyArea(s_display, s_window, s_window, s_gc,
+                             rect->x, sy * s_scale + dy, rect->width, 1,
+                             dx * s_width + rect->x, sy * s_scale + dy);
+                }
+            }
+        }
+    }
+}
+
+int mfb_update_rects(void *buffer, const mfb_rect_t *rects, int count, int fps_limit) {
     static struct timeval last_time = {0, 0};
     XEvent event;
+    int exposed = 0;
     
     s_buffer = buffer;
     
@@ -225,6 +246,8 @@ int mfb_update(void *buffer, int fps_limit) {
         
         switch (event.type) {
             case Expose:
+                // only damaged rows are sent each frame, so an uncovered window needs all of them
+                exposed = 1;
                 break;
                 
             case KeyPress:
@@ -269,24 +292,19 @@ int mfb_update(void *buffer, int fps_limit) {
     if (s_close) return -1;
     
     if (buffer) {
-        convert_buffer_to_image();
-        
-        if (s_scale == 1) {
-            XPutImage(s_display, s_window, s_gc, s_ximage, 0, 0, 0, 0, s_width, s_height);
-        } else {
-            for (int sy = 0; sy < s_height; sy++) {
-                for (int dy = 0; dy < s_scale; dy++) {
-                    XPutImage(s_display, s_window, s_gc, s_ximage, 
-                             0, sy, 0, sy * s_scale + dy, s_width, 1);
-                    for (int dx = 1; dx < s_scale; dx++) {
-                        XCopyArea(s_display, s_window, s_window, s_gc,
-                                 0, sy * s_scale + dy, s_width, 1,
-                                 dx * s_width, sy * s_scale + dy);
-                    }
-                }
-            }
+        for (int i = 0; i < count; i++) {
+            const mfb_rect_t *rect = &rects[i];
+            convert_buffer_to_image(rect);
+            if (!exposed) put_rect(rect);
         }
-        
+        s_converted = 1;
+    }
+    exposed &= s_converted;
+    if (exposed) {
+        const mfb_rect_t all = { 0, 0, s_width, s_height };
+        put_rect(&all);
+    }
+    if (buffer || exposed) {
         XFlush(s_display);
     }
     
@@ -310,6 +328,11 @@ int mfb_update(void *buffer, int fps_limit) {
     return 0;
 }
 
+int mfb_update(void *buffer, int fps_limit) {
+    const mfb_rect_t all = { 0, 0, s_width, s_height };
+    return mfb_update_rects(buffer, &all, 1, fps_limit);
+}
+
 void mfb_close() {
     if (s_ximage) {
         XDestroyImage(s_ximage);
@@ -326,6 +349,7 @@ void mfb_close() {
     
     s_buffer = NULL;
     s_close = 0;
+    s_converted = 0;
 }
 
 char *mfb_keystatus() {
@@ -18,6 +18,9 @@ int mfb_open(const char* name, int width, int height, int scale);
 // Update the display. Input buffer is assumed to be a 32-bit buffer of the size given in the open call
 // Will return -1 when ESC key is pressed (later on will return keycode and -1 on other close signal) 
 int mfb_update(void* buffer, int fps_limit);
+// The same, but only the given parts of the buffer changed
+typedef struct { int x, y, width, height; } mfb_rect_t;
+int mfb_update_rects(void* buffer, const mfb_rect_t *rects, int count, int fps_limit);
 void mfb_set_pallete_array(const uint32_t *new_palette, uint8_t start, uint8_t count);
 void mfb_set_pallete(const uint8_t color_index, const uint32_t color);
 // Close the window
@@ -253,6 +253,11 @@ int mfb_update(void *buffer, int fps_limit) {
     return 0;
 }
 
+// GDI repaints the whole client area anyway
+int mfb_update_rects(void *buffer, const mfb_rect_t *rects, int count, int fps_limit) {
+    return mfb_update(buffer, fps_limit);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void mfb_close() {
@@ -9,6 +9,7 @@
 #define CPU_286_STYLE_PUSH_SP
 #if PICO_ON_DEVICE
 
+#include <hardware/sync.h>
 #include "disks-rp2350.c.inl"
 #include "network-redirector-rp2350.c.inl"
 #include "graphics.h"
@@ -59,8 +60,311 @@ static const bool __not_in_flash("cpu.pf") parity[0x100] = {
     0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1
 };
 
+#if CPU_LAZY_FLAGS
+#define LAZY_NONE 0 // x86_flags is up to date
+#define LAZY_ADD 1 // ADD, ADC
+#define LAZY_SUB 2 // SUB, SBB, CMP, NEG
+#define LAZY_LOG 3 // AND, OR, XOR, TEST
+#define LAZY_INC 4
+#define LAZY_DEC 5
+
+uint8_t lazy_op = LAZY_NONE;
+static uint8_t lazy_aux; // CF kept by INC/DEC, AF kept by logic ops
+static uint16_t lazy_sign; // sign bit of the operand size
+static uint32_t lazy_op1, lazy_op2, lazy_res; // operands and unmasked result
+
+static INLINE bool lazy_cf(void) {
+    switch (lazy_op) {
+        case LAZY_LOG:
+            return 0;
+        case LAZY_INC:
+        case LAZY_DEC:
+            return lazy_aux;
+        default:
+            return (lazy_res & (lazy_sign << 1)) != 0;
+    }
+}
+
+static INLINE bool lazy_zf(void) {
+    return (lazy_res & ((lazy_sign << 1) - 1)) == 0;
+}
+
+static INLINE bool lazy_sf(void) {
+    return (lazy_res & lazy_sign) != 0;
+}
+
+static INLINE bool lazy_pf(void) {
+    return parity[lazy_res & 0xFF];
+}
+
+static INLINE bool lazy_of(void) {
+    switch (lazy_op) {
+        case LAZY_ADD:
+        case LAZY_INC:
+            return ((lazy_res ^ lazy_op1) & (lazy_res ^ lazy_op2) & lazy_sign) != 0;
+        case LAZY_SUB:
+        case LAZY_DEC:
+            return ((lazy_res ^ lazy_op1) & (lazy_op1 ^ lazy_op2) & lazy_sign) != 0;
+        default:
+            return 0;
+    }
+}
+
+static INLINE bool lazy_af(void) {
+    return lazy_op == LAZY_LOG ? lazy_aux : ((lazy_op1 ^ lazy_op2 ^ lazy_res) & 0x10) != 0;
+}
+
+void flags_sync(void) {
+    x86_flags.bits.CF = lazy_cf();
+    x86_flags.bits.PF = lazy_pf();
+    x86_flags.bits.AF = lazy_af();
+    x86_flags.bits.ZF = lazy_zf();
+    x86_flags.bits.SF = lazy_sf();
+    x86_flags.bits.OF = lazy_of();
+    lazy_op = LAZY_NONE;
+}
+
+// Single flag reads that leave the pending operation in place
+#define get_cf() (lazy_op ? lazy_cf() : x86_flags.bits.CF)
+#define get_pf() (lazy_op ? lazy_pf() : x86_flags.bits.PF)
+#define get_af() (lazy_op ? lazy_af() : x86_flags.bits.AF)
+#define get_zf() (lazy_op ? lazy_zf() : x86_flags.bits.ZF)
+#define get_sf() (lazy_op ? lazy_sf() : x86_flags.bits.SF)
+#define get_of() (lazy_op ? lazy_of() : x86_flags.bits.OF)
+
+static INLINE void lazy_set(const uint8_t op, const uint16_t sign, const uint32_t v1, const uint32_t v2, const uint32_t res) {
+    lazy_op = op;
+    lazy_sign = sign;
+    lazy_op1 = v1;
+    lazy_op2 = v2;
+    lazy_res = res;
+}
+
+static INLINE void lazy_log(const uint16_t sign, const uint32_t res) {
+    lazy_aux = get_af();
+    lazy_op = LAZY_LOG;
+    lazy_sign = sign;
+    lazy_res = res;
+}
+
+static INLINE void lazy_incdec(const uint8_t op, const uint16_t sign, const uint32_t v1) {
+    lazy_aux = get_cf();
+    lazy_set(op, sign, v1, 1, op == LAZY_INC ? v1 + 1 : v1 - 1);
+}
+#else
+#define get_cf() cf
+#define get_pf() pf
+#define get_af() af
+#define get_zf() zf
+#define get_sf() sf
+#define get_of() of
+#endif
+
+#if DECODE_CACHE_BITS
+#define DECODE_CACHE_MASK ((1 << DECODE_CACHE_BITS) - 1)
+#define DECODE_CACHE_INDEX(linear) (((linear) ^ ((linear) >> DECODE_CACHE_BITS)) & DECODE_CACHE_MASK)
+
+// Predecoded instruction, direct-mapped by linear CS:IP
+typedef struct {
+    uint32_t linear; // linear address of the first prefix byte, ~0 if empty
+    uint32_t gen; // sum of the two granule generations when decoded
+    uint32_t gen_first, gen_last; // mem_gen granules a write reaching the instruction starts in
+    uint8_t opcode;
+    uint8_t length; // whole instruction
+    uint8_t head_len; // prefixes and opcode
+    uint8_t modrm_len; // modrm byte and displacement, 0 if no modrm
+    uint8_t reptype;
+    uint8_t seg; // segment override register + 1, 0 if none
+    uint8_t modrm;
+    uint8_t stack_ea; // modrm addresses through BP without segment override
+    uint16_t disp;
+    uint8_t imm[4];
+} decoded_insn_t;
+
+#define DI_IMM_MASK 0x07
+#define DI_MODRM 0x08
+#define DI_GRP3 0x10 // F6/F7: TEST carries an immediate of operand size
+#define DI_PREFIX 0x20
+#define DI_NOCACHE 0x40
+
+// Instruction layout as exec86 fetches it: immediate bytes and flags above
+static const uint8_t __not_in_flash("cpu.dc") decode_info[256] = {
+    0x08, 0x08, 0x08, 0x08, 0x01, 0x02, 0x00, 0x00, 0x08, 0x08, 0x08, 0x08, 0x01, 0x02, 0x00, 0x00, // 00
+    0x08, 0x08, 0x08, 0x08, 0x01, 0x02, 0x00, 0x00, 0x08, 0x08, 0x08, 0x08, 0x01, 0x02, 0x00, 0x00, // 10
+    0x08, 0x08, 0x08, 0x08, 0x01, 0x02, 0x20, 0x00, 0x08, 0x08, 0x08, 0x08, 0x01, 0x02, 0x20, 0x00, // 20
+    0x08, 0x08, 0x08, 0x08, 0x01, 0x02, 0x20, 0x00, 0x08, 0x08, 0x08, 0x08, 0x01, 0x02, 0x20, 0x00, // 30
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 40
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 50
+    0x00, 0x00, 0x08, 0x00, 0x20, 0x20, 0x00, 0x00, 0x02, 0x0A, 0x01, 0x09, 0x00, 0x00, 0x00, 0x00, // 60
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, // 70
+    0x09, 0x0A, 0x09, 0x09, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, // 80
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, // 90
+    0x02, 0x02, 0x02, 0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // A0
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, // B0
+    0x09, 0x09, 0x02, 0x00, 0x08, 0x08, 0x09, 0x0A, 0x03, 0x00, 0x02, 0x00, 0x00, 0x01, 0x00, 0x00, // C0
+    0x08, 0x08, 0x08, 0x08, 0x01, 0x01, 0x00, 0x00, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, // D0
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x02, 0x04, 0x01, 0x00, 0x00, 0x00, 0x00, // E0
+    0x20, 0x00, 0x20, 0x20, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x08, // F0
+};
+
+static decoded_insn_t decode_cache[1 << DECODE_CACHE_BITS];
+static const decoded_insn_t *insn; // instruction being executed, NULL if not from the cache
+static uint16_t insn_imm_ip; // IP of its first immediate byte
+uint64_t decode_cache_hits, decode_cache_misses, decode_cache_uncached;
+
+void decode_cache_flush(void) {
+    for (uint32_t i = 0; i <= DECODE_CACHE_MASK; i++) {
+        decode_cache[i].linear = ~0u;
+    }
+}
+
+static bool decode_insn(decoded_insn_t *d, const uint32_t linear) {
+    if (linear >= MEM_MAP_END) return false;
+    const mem_page_t *page = &mem_map[linear >> MEM_PAGE_SHIFT];
+    // a dword write 3 bytes before the instruction must hit a tracked granule of the same page
+    if (!page->rptr || (linear & MEM_PAGE_MASK) < 3) return false;
+    const uint8_t *code = page->rptr + (linear & MEM_PAGE_MASK);
+    // stay inside the page and don't wrap IP
+    uint32_t avail = MEM_PAGE_SIZE - (linear & MEM_PAGE_MASK);
+    if (avail > 0x10000 - CPU_IP) avail = 0x10000 - CPU_IP;
+    if (avail > 15) avail = 15;
+
+    uint8_t len = 0, seg = 0, rep = 0, info;
+    while (1) {
+        if (len >= avail) return false;
+        info = decode_info[code[len]];
+        if (!(info & DI_PREFIX)) break;
+        switch (code[len]) {
+            case 0x26: seg = reges + 1; break;
+            case 0x2E: seg = regcs + 1; break;
+            case 0x36: seg = regss + 1; break;
+            case 0x3E: seg = regds + 1; break;
+            case 0x64: seg = regfs + 1; break;
+            case 0x65: seg = reggs + 1; break;
+            case 0xF2: rep = 2; break;
+            case 0xF3: rep = 1; break;
+        }
+        len++;
+    }
+    if (info & DI_NOCACHE) return false;
+    d->opcode = code[len++];
+    d->head_len = len;
+    d->reptype = rep;
+    d->seg = seg;
+    d->modrm = 0;
+    d->modrm_len = 0;
+    d->stack_ea = 0;
+    d->disp = 0;
+    uint8_t imm = info & DI_IMM_MASK;
+    if (info & DI_MODRM) {
+        if (len >= avail) return false;
+        const uint8_t modrm = code[len];
+        const uint8_t mod = modrm >> 6, rm = modrm & 7;
+        uint8_t disp_len = 0;
+        if ((mod == 0 && rm == 6) || mod == 2) disp_len = 2;
+        else if (mod == 1) disp_len = 1;
+        if (len + 1 + disp_len > avail) return false;
+        if (disp_len == 2) d->disp = code[len + 1] | code[len + 2] << 8;
+        else if (disp_len == 1) d->disp = signext(code[len + 1]);
+        d->modrm = modrm;
+        d->modrm_len = 1 + disp_len;
+        d->stack_ea = !seg && mod != 3 && (rm == 2 || rm == 3 || (mod != 0 && rm == 6));
+        if ((info & DI_GRP3) && ((modrm >> 3) & 7) < 2) imm = d->opcode == 0xF6 ? 1 : 2;
+        len += d->modrm_len;
+    }
+    if (len + imm > avail) return false;
+    for (uint8_t i = 0; i < imm; i++) d->imm[i] = code[len + i];
+    len += imm;
+    // the XMS hook at 0000:03FF is dispatched by the uncached prefix loop
+    if (linear <= XMS_FN_CS * 16 + XMS_FN_IP && linear + len > XMS_FN_CS * 16 + XMS_FN_IP) return false;
+    d->length = len;
+    d->linear = linear;
+    d->gen_first = MEM_GEN_INDEX(page->frame, (linear & MEM_PAGE_MASK) - 3);
+    d->gen_last = MEM_GEN_INDEX(page->frame, (linear & MEM_PAGE_MASK) + len - 1);
+    d->gen = mem_gen[d->gen_first] + mem_gen[d->gen_last];
+    return true;
+}
+
+static INLINE const decoded_insn_t *decode_lookup(void) {
+    const uint32_t linear = segbase(CPU_CS) + CPU_IP;
+    decoded_insn_t *d = &decode_cache[DECODE_CACHE_INDEX(linear)];
+    if (likely(d->linear == linear && d->gen == mem_gen[d->gen_first] + mem_gen[d->gen_last])) {
+        decode_cache_hits++;
+        return d;
+    }
+    if (decode_insn(d, linear)) {
+        decode_cache_misses++;
+        return d;
+    }
+    d->linear = ~0u;
+    decode_cache_uncached++;
+    return NULL;
+}
+#endif
+
+static INLINE uint16_t host_load16(const uint8_t *p) {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return v;
+}
+
+static INLINE void host_store16(uint8_t *p, const uint16_t v) {
+    memcpy(p, &v, 2);
+}
+
+// Instruction fetch through the code window, see fetch_window_fill
+static INLINE uint8_t fetch86(const uint32_t address) {
+    const uint32_t offset = address - fetch_lo;
+    if (likely(offset < fetch_size)) {
+        return fetch_ptr[offset];
+    }
+    return fetch86_miss(address);
+}
+
+static INLINE uint16_t fetchw86(const uint32_t address) {
+    const uint32_t offset = address - fetch_lo;
+    if (likely(offset + 1 < fetch_size)) {
+        return host_load16(fetch_ptr + offset);
+    }
+    return fetchw86_miss(address);
+}
+
+#define getcs8() fetch86(segbase(CPU_CS) + CPU_IP)
+#define getcs16() fetchw86(segbase(CPU_CS) + CPU_IP)
+
+// Instruction stream bytes past the modrm operand
+static INLINE uint8_t getcode8() {
+#if DECODE_CACHE_BITS
+    if (insn) return insn->imm[(uint16_t) (CPU_IP - insn_imm_ip) & 3];
+#endif
+    return getcs8();
+}
+
+static INLINE uint16_t getcode16() {
+#if DECODE_CACHE_BITS
+    if (insn) {
+        const uint16_t i = CPU_IP - insn_imm_ip;
+        return insn->imm[i & 3] | insn->imm[(i + 1) & 3] << 8;
+    }
+#endif
+    return getcs16();
+}
+
 __not_in_flash() void modregrm() {
-    register uint8_t addrbyte = getmem8(CPU_CS, CPU_IP);
+#if DECODE_CACHE_BITS
+    if (insn) {
+        mode = insn->modrm >> 6;
+        reg = (insn->modrm >> 3) & 7;
+        rm = insn->modrm & 7;
+        disp16 = insn->disp;
+        StepIP(insn->modrm_len);
+        if (insn->stack_ea) {
+            useseg = CPU_SS;
+        }
+        return;
+    }
+#endif
+    register uint8_t addrbyte = getcs8();
     StepIP(1);
     mode = addrbyte >> 6;
     reg = (addrbyte >> 3) & 7;
@@ -70,7 +374,7 @@ __not_in_flash() void modregrm() {
         // 32-bit address mode
         if (mode != 3 && rm == 4) {
             // SIB byte present
-            sib = getmem8(CPU_CS, CPU_IP);
+            sib = getcs8();
             StepIP(1);
         }
         switch (mode) {
@@ -83,7 +387,7 @@ __not_in_flash() void modregrm() {
                 }
                 break;
             case 1:
-                disp32 = signext(getmem8(CPU_CS, CPU_IP));
+                disp32 = signext(getcs8());
                 StepIP(1);
                 break;
             case 2:
@@ -99,7 +403,7 @@ __not_in_flash() void modregrm() {
     switch (mode) {
         case 0:
             if (rm == 6) {
-                disp16 = getmem16(CPU_CS, CPU_IP);
+                disp16 = getcs16();
                 StepIP(2);
             } else {
                 disp16 = 0;
@@ -109,14 +413,14 @@ __not_in_flash() void modregrm() {
             }
             break;
         case 1:
-            disp16 = signext(getmem8(CPU_CS, CPU_IP));
+            disp16 = signext(getcs8());
             StepIP(1);
             if (((rm == 2) || (rm == 3) || (rm == 6)) && !segoverride) {
                 useseg = CPU_SS;
             }
             break;
         case 2:
-            disp16 = getmem16(CPU_CS, CPU_IP);
+            disp16 = getcs16();
             StepIP(2);
             if (((rm == 2) || (rm == 3) || (rm == 6)) && !segoverride) {
                 useseg = CPU_SS;
@@ -463,13 +767,16 @@ static INLINE void writerm8(uint8_t rmval, uint8_t value) {
 
 static INLINE uint16_t makeflagsword(void) {
 #if CPU_386_EXTENDED_OPS
-    return 2 | x86_flags.value;
+    return 2 | cpu_flags.value;
 #else
-    return 2 | (x86_flags.value & 0b111111010101);
+    return 2 | (cpu_flags.value & 0b111111010101);
 #endif
 }
 
 static INLINE void decodeflagsword(uint16_t x) {
+#if CPU_LAZY_FLAGS
+    lazy_op = LAZY_NONE;
+#endif
     x86_flags.value = x;
 }
 
@@ -505,6 +812,8 @@ void intcall86(uint8_t intnum) {
 
                     if ((CPU_AL & 0x80) == 0x00) {
                         memset(VIDEORAM, 0x0, sizeof(VIDEORAM));
+                        video_dirty_set();
+                        vga_chunky_rebuild();
                     }
                     vga_plane_offset = 0;
                     vga_planar_mode = 0;
@@ -655,11 +964,13 @@ void intcall86(uint8_t intnum) {
             insertdisk(128, "\\XT\\hdd.img");
             insertdisk(129, "\\XT\\hdd2.img");
 #else
-            insertdisk(0, "../fdd0.img");
-            insertdisk(1, "../fdd1.img");
-            insertdisk(128, "../hdd.img");
-            insertdisk(129, "../hdd2.img");
+            insertdisk(0, disk_images[0]);
+            insertdisk(1, disk_images[1]);
+            insertdisk(128, disk_images[2]);
+            insertdisk(129, disk_images[3]);
 #endif
+            writew86(0x67 * 4, EMM_ROM_ENTRY);
+            writew86(0x67 * 4 + 2, EMM_ROM_SEG);
             if (1) {
                 /* PCjr reserves the top of its internal 128KB of RAM for video RAM.  * Sidecars can extend it past 128KB but it
                  * requires DOS drivers or TSRs to modify the MCB chain so that it a) marks the video memory as reserved and b)
@@ -696,6 +1007,13 @@ void intcall86(uint8_t intnum) {
                     return;
             }
             break;
+        case 0x67: /* EMS, unless a guest memory manager or TSR took the vector over and did not chain to the ROM */
+            if (CPU_CS == EMM_ROM_SEG ||
+                (readw86(0x67 * 4) == EMM_ROM_ENTRY && readw86(0x67 * 4 + 2) == EMM_ROM_SEG)) {
+                emm_handler();
+                return;
+            }
+            break;
         case 0x2F: /* Multiplex Interrupt */
             switch (CPU_AX) {
                 /* XMS */
@@ -743,39 +1061,59 @@ static inline void flag_szp32(uint32_t value) {
 }
 
 static inline void flag_log8(uint8_t value) {
+#if CPU_LAZY_FLAGS
+    lazy_log(0x80, value);
+#else
     flag_szp8(value);
-    x86_flags.value &= ~FLAG_CF_OF_MASK;
+    cpu_flags.value &= ~FLAG_CF_OF_MASK;
+#endif
 }
 
 static inline void flag_log16(uint16_t value) {
+#if CPU_LAZY_FLAGS
+    lazy_log(0x8000, value);
+#else
     flag_szp16(value);
-    x86_flags.value &= ~FLAG_CF_OF_MASK;
+    cpu_flags.value &= ~FLAG_CF_OF_MASK;
+#endif
 }
 
 static inline void flag_adc8(uint8_t v1, uint8_t v2, uint8_t v3) {
     /* v1 = destination operand, v2 = source operand, v3 = carry flag */
     uint32_t dst = (uint32_t) v1 + (uint32_t) v2 + (uint32_t) v3;
+#if CPU_LAZY_FLAGS
+    lazy_set(LAZY_ADD, 0x80, v1, v2, dst);
+#else
     flag_szp8((uint8_t) dst);
     of = ((dst ^ (uint32_t)v1) & (dst ^ (uint32_t)v2) & 0x80) != 0;
     cf = (dst & 0xFF00) != 0;
     af = (((uint32_t)v1 ^ (uint32_t)v2 ^ dst) & 0x10) != 0;
+#endif
 }
 
 static inline void flag_adc16(uint16_t v1, uint16_t v2, uint16_t v3) {
     register uint32_t dst = (uint32_t) v1 + (uint32_t) v2 + (uint32_t) v3;
+#if CPU_LAZY_FLAGS
+    lazy_set(LAZY_ADD, 0x8000, v1, v2, dst);
+#else
     flag_szp16((uint16_t) dst);
     of = (((dst ^ (uint32_t)v1) & (dst ^ (uint32_t)v2)) & 0x8000) != 0;
     cf = (dst & 0xFFFF0000) != 0;
     af = (((uint32_t)v1 ^ (uint32_t)v2 ^ dst) & 0x10) != 0;
+#endif
 }
 
 static inline void flag_add8(uint8_t v1, uint8_t v2) {
     /* v1 = destination operand, v2 = source operand */
     register uint32_t dst = (uint32_t) v1 + (uint32_t) v2;
+#if CPU_LAZY_FLAGS
+    lazy_set(LAZY_ADD, 0x80, v1, v2, dst);
+#else
     flag_szp8((uint8_t) dst);
     cf = (dst & 0xFF00) != 0;
     of = ((dst ^ (uint32_t)v1) & (dst ^ (uint32_t)v2) & 0x80) != 0;
     af = (((uint32_t)v1 ^ (uint32_t)v2 ^ dst) & 0x10) != 0;
+#endif
 }
 
 static inline void flag_add32(uint32_t v1, uint32_t v2, uint32_t res32) {
@@ -789,20 +1127,28 @@ static inline void flag_add32(uint32_t v1, uint32_t v2, uint32_t res32) {
 static inline uint8_t sbb8(uint8_t v1, uint8_t v2, uint8_t v3) {
     /* v1 = destination operand, v2 = source operand, v3 = carry flag */
     register uint32_t dst = (uint32_t)v1 - (uint32_t)v2 - (uint32_t)v3;
+#if CPU_LAZY_FLAGS
+    lazy_set(LAZY_SUB, 0x80, v1, v2, dst);
+#else
     flag_szp8((uint8_t) dst);
     cf = ((dst >> 8) & 1) != 0;
     of = ((dst ^ v1) & (v1 ^ v2) & 0x80) != 0;
     af = ((v1 ^ v2 ^ dst ^ v3) & 0x10) != 0;
+#endif
     return (uint8_t)dst;
 }
 
 static inline uint16_t sbb16(uint16_t v1, uint16_t v2, uint8_t v3) {
     /* v1 = destination operand, v2 = source operand, v3 = carry flag */
     register uint32_t dst = (uint32_t)v1 - (uint32_t)v2 - (uint32_t)v3;
+#if CPU_LAZY_FLAGS
+    lazy_set(LAZY_SUB, 0x8000, v1, v2, dst);
+#else
     flag_szp16((uint16_t) dst);
     cf = ((dst >> 16) & 1) != 0;
     of = ((dst ^ (uint32_t)v1) & (v1 ^ (uint32_t)v2) & 0x8000) != 0;
     af = ((v1 ^ v2 ^ dst ^ v3) & 0x10) != 0;
+#endif
     return (uint16_t)dst;
 }
 
@@ -819,24 +1165,86 @@ static inline uint32_t sbb32(uint32_t v1, uint32_t v2, uint8_t v3) {
 static inline void flag_sub8(uint8_t v1, uint8_t v2) {
     /* v1 = destination operand, v2 = source operand */
     uint32_t dst = (uint32_t) v1 - (uint32_t) v2;
+#if CPU_LAZY_FLAGS
+    lazy_set(LAZY_SUB, 0x80, v1, v2, dst);
+#else
     flag_szp8((uint8_t) dst);
     cf = (dst & 0xFF00) != 0;
     of = ((dst ^ (uint32_t)v1) & (v1 ^ v2) & 0x80) != 0;
     af = ((v1 ^ v2 ^ dst) & 0x10) != 0;
+#endif
 }
 
 static inline void flag_sub16(uint16_t v1, uint16_t v2) {
     /* v1 = destination operand, v2 = source operand */
     register uint32_t dst = (uint32_t) v1 - (uint32_t) v2;
+#if CPU_LAZY_FLAGS
+    lazy_set(LAZY_SUB, 0x8000, v1, v2, dst);
+#else
     flag_szp16((uint16_t) dst);
     cf = (dst & 0xFFFF0000) != 0;
     of = ((dst ^ (uint32_t)v1) & ((uint32_t)v1 ^ (uint32_t)v2) & 0x8000) != 0;
     af = (((uint32_t)v1 ^ (uint32_t)v2 ^ dst) & 0x10) != 0;
+#endif
+}
+
+// INC/DEC set the flags of ADD/SUB 1 but keep CF
+static inline void flag_inc8(uint8_t v1) {
+#if CPU_LAZY_FLAGS
+    lazy_incdec(LAZY_INC, 0x80, v1);
+#else
+    tempcf = cf;
+    flag_add8(v1, 1);
+    cf = tempcf;
+#endif
+}
+
+static inline void flag_dec8(uint8_t v1) {
+#if CPU_LAZY_FLAGS
+    lazy_incdec(LAZY_DEC, 0x80, v1);
+#else
+    tempcf = cf;
+    flag_sub8(v1, 1);
+    cf = tempcf;
+#endif
 }
 
-#define op_adc8() { res8 = oper1b + oper2b + cf; flag_adc8(oper1b, oper2b, cf); }
-#define op_adc16() { res16 = oper1 + oper2 + cf; flag_adc16(oper1, oper2, cf); }
+static inline void flag_inc16(uint16_t v1) {
+#if CPU_LAZY_FLAGS
+    lazy_incdec(LAZY_INC, 0x8000, v1);
+#else
+    register uint32_t dst = (uint32_t) v1 + 1;
+    flag_szp16(dst);
+    of = (((dst ^ v1) & (dst ^ 1) & 0x8000) != 0);
+    af = (((v1 ^ 1 ^ dst) & 0x10) != 0);
+#endif
+}
+
+static inline void flag_dec16(uint16_t v1) {
+#if CPU_LAZY_FLAGS
+    lazy_incdec(LAZY_DEC, 0x8000, v1);
+#else
+    tempcf = cf;
+    flag_sub16(v1, 1);
+    cf = tempcf;
+#endif
+}
+
+#define op_adc8() { tempcf = get_cf(); res8 = oper1b + oper2b + tempcf; flag_adc8(oper1b, oper2b, tempcf); }
+#define op_adc16() { tempcf = get_cf(); res16 = oper1 + oper2 + tempcf; flag_adc16(oper1, oper2, tempcf); }
 #define op_adc32() { res32 = oper1 + oper2 + cf; flag_adc32(oper1, oper2, cf); }
+#if CPU_LAZY_FLAGS
+#define op_add8() { \
+    register uint32_t dst = (uint32_t)oper1b + (uint32_t)oper2b; \
+    res8 = dst; \
+    lazy_set(LAZY_ADD, 0x80, oper1b, oper2b, dst); \
+}
+#define op_add16() { \
+    register uint32_t dst = (uint32_t)oper1 + (uint32_t)oper2; \
+    res16 = dst; \
+    lazy_set(LAZY_ADD, 0x8000, oper1, oper2, dst); \
+}
+#else
 #define op_add8() { \
     register uint32_t dst = (uint32_t)oper1b + (uint32_t)oper2b; \
     res8 = dst; \
@@ -853,6 +1261,7 @@ static inline void flag_sub16(uint16_t v1, uint16_t v2) {
     of = (((dst ^ (uint32_t)oper1) & (dst ^ (uint32_t)oper2) & 0x8000) != 0); \
     af = (((oper1 ^ oper2 ^ dst) & 0x10) != 0); \
 }
+#endif
 #define op_add32() { res32 = oper1 + oper2; flag_add32(oper1, oper2, res32); }
 #define op_and8() { res8 = oper1b & oper2b; flag_log8(res8); }
 #define op_and16() { res16 = oper1 & oper2; flag_log16(res16); }
@@ -864,6 +1273,13 @@ static inline void flag_sub16(uint16_t v1, uint16_t v2) {
 #define op_xor16() { res16 = oper1 ^ oper2; flag_log16(res16); }
 #define op_xor32() { res32 = oper1 ^ oper2; flag_log32(res32); }
 #define op_sub8() { res8 = oper1b - oper2b; flag_sub8(oper1b, oper2b); }
+#if CPU_LAZY_FLAGS
+#define op_sub16() { \
+    register uint32_t dst = (uint32_t) oper1 - (uint32_t) oper2; \
+    lazy_set(LAZY_SUB, 0x8000, oper1, oper2, dst); \
+    res16 = (uint16_t) dst; \
+}
+#else
 #define op_sub16() { \
     register uint32_t dst = (uint32_t) oper1 - (uint32_t) oper2; \
     flag_szp16((uint16_t) dst); \
@@ -872,9 +1288,10 @@ static inline void flag_sub16(uint16_t v1, uint16_t v2) {
     af = ((oper1 ^ oper2 ^ dst) & 0x10) != 0; \
     res16 = (uint16_t) dst; \
 }
+#endif
 #define op_sub32() { res32 = oper1 - oper2; flag_sub32(oper1, oper2); }
-#define op_sbb8() { res8 = sbb8(oper1b, oper2b, cf); }
-#define op_sbb16() { res16 = sbb16(oper1, oper2, cf); }
+#define op_sbb8() { res8 = sbb8(oper1b, oper2b, get_cf()); }
+#define op_sbb16() { res16 = sbb16(oper1, oper2, get_cf()); }
 #define op_sbb32() { res32 = sbb32(oper1, oper2, cf); }
 
 static __not_in_flash() uint8_t op_grp2_8(uint8_t cnt, uint8_t oper1b) {
@@ -1178,7 +1595,7 @@ static __not_in_flash() void op_grp3_16() {
     switch (reg) {
         case 0:
         case 1: /* TEST */
-            flag_log16(oper1 & getmem16(CPU_CS, CPU_IP));
+            flag_log16(oper1 & getcode16());
             StepIP(2);
             break;
 
@@ -1203,9 +1620,9 @@ static __not_in_flash() void op_grp3_16() {
             CPU_DX = temp1 >> 16;
             flag_szp16((uint16_t) temp1);
             if (CPU_DX) {
-                x86_flags.value |= FLAG_CF_OF_MASK;
+                cpu_flags.value |= FLAG_CF_OF_MASK;
             } else {
-                x86_flags.value &= ~FLAG_CF_OF_MASK;
+                cpu_flags.value &= ~FLAG_CF_OF_MASK;
             }
 #ifdef CPU_CLEAR_ZF_ON_MUL
             zf = 0;
@@ -1219,9 +1636,9 @@ static __not_in_flash() void op_grp3_16() {
             CPU_AX = truncated; /* into register ax */
             CPU_DX = (uint16_t)(temp1 >> 16); /* into register dx */
             if (temp1 != (int32_t)truncated) {
-                x86_flags.value |= FLAG_CF_OF_MASK;
+                cpu_flags.value |= FLAG_CF_OF_MASK;
             } else {
-                x86_flags.value &= ~FLAG_CF_OF_MASK;
+                cpu_flags.value &= ~FLAG_CF_OF_MASK;
             }
 #ifdef CPU_CLEAR_ZF_ON_MUL
             zf = 0;
@@ -1241,18 +1658,14 @@ static __not_in_flash() void op_grp3_16() {
 static __not_in_flash() void op_grp5() {
     switch (reg) {
         case 0: /* INC Ev */
-            oper2 = 1;
-            tempcf = cf;
-            op_add16();
-            cf = tempcf;
+            res16 = oper1 + 1;
+            flag_inc16(oper1);
             writerm16(rm, res16);
             break;
 
         case 1: /* DEC Ev */
-            oper2 = 1;
-            tempcf = cf;
-            op_sub16();
-            cf = tempcf;
+            res16 = oper1 - 1;
+            flag_dec16(oper1);
             writerm16(rm, res16);
             break;
 
@@ -1285,12 +1698,247 @@ static __not_in_flash() void op_grp5() {
     }
 }
 
+#if CPU_REP_BULK_MAX
+// Elements of `size` bytes from seg:offset in the current direction that stay inside one
+// page without wrapping the offset, *page is set to that page
+static INLINE uint32_t rep_page_span(const uint16_t seg, const uint16_t offset, const uint8_t size,
+                                     const mem_page_t **page) {
+    const uint32_t linear = segbase(seg) + offset;
+    const uint32_t in_page = linear & MEM_PAGE_MASK;
+    *page = &mem_map[linear >> MEM_PAGE_SHIFT];
+    if (in_page + size > MEM_PAGE_SIZE) return 0;
+    if (df) {
+        return (in_page < offset ? in_page : offset) / size + 1;
+    }
+    const uint32_t left = MEM_PAGE_SIZE - in_page;
+    return (left < 0x10000u - offset ? left : 0x10000u - offset) / size;
+}
+
+// The same for a directly mapped page, *host is set to the first element
+static INLINE uint32_t rep_span(const uint16_t seg, const uint16_t offset, const uint8_t size, const bool write,
+                                uint8_t **host) {
+    const mem_page_t *page;
+    const uint32_t span = rep_page_span(seg, offset, size, &page);
+    uint8_t *base = write ? page->wptr : page->rptr;
+    if (!base) return 0;
+    *host = base + ((segbase(seg) + offset) & MEM_PAGE_MASK);
+    return span;
+}
+
+// One element through the page: host memory when it has some, else its handler the way
+// readw86/writew86 would call it
+static INLINE uint16_t rep_load(const mem_page_t *page, const uint32_t linear, const uint8_t size) {
+    const uint32_t in_page = linear & MEM_PAGE_MASK;
+    if (page->rptr) {
+        return size == 1 ? page->rptr[in_page] : host_load16(page->rptr + in_page);
+    }
+    if (size == 1) return page->handler->read8(page->base + in_page);
+    if (!(linear & 1)) return page->handler->read16(page->base + in_page);
+    return page->handler->read8(page->base + in_page) | page->handler->read8(page->base + in_page + 1) << 8;
+}
+
+static INLINE void rep_store(const mem_page_t *page, const uint32_t linear, const uint8_t size, const uint16_t value) {
+    const uint32_t in_page = linear & MEM_PAGE_MASK;
+    if (page->wptr) {
+        if (size == 1) page->wptr[in_page] = (uint8_t) value;
+        else host_store16(page->wptr + in_page, value);
+    } else if (size == 1) {
+        page->handler->write8(page->base + in_page, (uint8_t) value);
+    } else if (!(linear & 1)) {
+        page->handler->write16(page->base + in_page, value);
+    } else {
+        page->handler->write8(page->base + in_page, (uint8_t) value);
+        page->handler->write8(page->base + in_page + 1, (uint8_t) (value >> 8));
+    }
+}
+
+// REP MOVS/STOS with a side that has no host memory (video, swap or a handler backed EMS
+// window): the elements still go one by one through the page handlers, but without decoding
+// the instruction again for each
+static uint32_t rep_bulk_handler(const uint8_t opcode, uint32_t n, const uint32_t code_linear, const uint16_t code_len) {
+    const uint8_t size = (opcode & 1) + 1;
+    const int32_t step = df ? -size : size;
+    const bool movs = opcode <= 0xA5;
+    const mem_page_t *dst_page, *src_page = NULL;
+    uint32_t span = rep_page_span(CPU_ES, CPU_DI, size, &dst_page);
+    if (n > span) n = span;
+    if (movs) {
+        span = rep_page_span(useseg, CPU_SI, size, &src_page);
+        if (n > span) n = span;
+    }
+    if (!n) return 0;
+
+    uint32_t dst = segbase(CPU_ES) + CPU_DI, src = movs ? segbase(useseg) + CPU_SI : 0;
+    const uint32_t bytes = n * size;
+    const uint32_t dst_lo = dst + (df ? (int32_t) (n - 1) * step : 0);
+    if (dst_lo < code_linear + code_len && code_linear < dst_lo + bytes) return 0;
+    if (dst_page->wptr) memory_invalidate(dst_lo, bytes);
+
+    for (uint32_t i = 0; i < n; i++, dst += step, src += step) {
+        rep_store(dst_page, dst, size, movs ? rep_load(src_page, src, size) : CPU_AX);
+    }
+    if (movs) CPU_SI += step * (int32_t) n;
+    CPU_DI += step * (int32_t) n;
+    CPU_CX -= n;
+    return n;
+}
+
+// Runs up to `budget` elements of a REP string instruction at once, returns the number
+// done (0 to leave it to the single step code); *stopped is set when REPE/REPNE ended it
+static uint32_t rep_bulk(const uint8_t opcode, uint32_t budget, const uint32_t code_linear, const uint16_t code_len,
+                         bool *stopped) {
+    const uint8_t size = (opcode & 1) + 1;
+    const int32_t step = df ? -size : size;
+    uint32_t n = CPU_CX;
+    if (n > budget) n = budget;
+    if (n > CPU_REP_BULK_MAX) n = CPU_REP_BULK_MAX;
+    uint8_t *src = NULL, *dst = NULL;
+    switch (opcode) {
+        case 0xA4:
+        case 0xA5: {
+            /* MOVS */
+            uint32_t span = rep_span(useseg, CPU_SI, size, false, &src);
+            const uint32_t dst_span = rep_span(CPU_ES, CPU_DI, size, true, &dst);
+            if (!src || !dst) return rep_bulk_handler(opcode, n, code_linear, code_len);
+            if (n > span) n = span;
+            if (n > dst_span) n = dst_span;
+            break;
+        }
+        case 0xA6:
+        case 0xA7: {
+            /* CMPS */
+            uint32_t span = rep_span(useseg, CPU_SI, size, false, &src);
+            if (n > span) n = span;
+            span = rep_span(CPU_ES, CPU_DI, size, false, &dst);
+            if (n > span) n = span;
+            break;
+        }
+        case 0xAA:
+        case 0xAB: {
+            /* STOS */
+            const uint32_t span = rep_span(CPU_ES, CPU_DI, size, true, &dst);
+            if (!dst) return rep_bulk_handler(opcode, n, code_linear, code_len);
+            if (n > span) n = span;
+            break;
+        }
+        case 0xAC:
+        case 0xAD: {
+            /* LODS */
+            const uint32_t span = rep_span(useseg, CPU_SI, size, false, &src);
+            if (n > span) n = span;
+            break;
+        }
+        case 0xAE:
+        case 0xAF: {
+            /* SCAS */
+            const uint32_t span = rep_span(CPU_ES, CPU_DI, size, false, &dst);
+            if (n > span) n = span;
+            break;
+        }
+        default:
+            return 0;
+    }
+    if (!n) return 0;
+
+    const uint32_t bytes = n * size;
+    const int32_t last = (int32_t) (n - 1) * step; // offset of the last element from the first
+    if (dst && (opcode < 0xA6 || opcode == 0xAA || opcode == 0xAB)) {
+        // leave stores over the instruction itself to the single step code
+        const uint32_t dst_linear = segbase(CPU_ES) + CPU_DI + (df ? last : 0);
+        if (dst_linear < code_linear + code_len && code_linear < dst_linear + bytes) return 0;
+        memory_invalidate(dst_linear, bytes);
+    }
+
+    *stopped = false;
+    switch (opcode) {
+        case 0xA4:
+        case 0xA5: {
+            uint8_t *lo_src = df ? src + last : src, *lo_dst = df ? dst + last : dst;
+            if (lo_dst + bytes <= lo_src || lo_src + bytes <= lo_dst || (df ? lo_dst > lo_src : lo_dst < lo_src)) {
+                // no overlap, or the overlap does not feed copied data back into the source
+                memmove(lo_dst, lo_src, bytes);
+            } else if (size == 1) {
+                for (uint32_t i = 0; i < n; i++, src += step, dst += step) *dst = *src;
+            } else {
+                for (uint32_t i = 0; i < n; i++, src += step, dst += step) host_store16(dst, host_load16(src));
+            }
+            CPU_SI += step * (int32_t) n;
+            CPU_DI += step * (int32_t) n;
+            break;
+        }
+        case 0xAA:
+            memset(df ? dst + last : dst, CPU_AL, bytes);
+            CPU_DI += step * (int32_t) n;
+            break;
+        case 0xAB:
+            if (CPU_AL == CPU_AH) {
+                memset(df ? dst + last : dst, CPU_AL, bytes);
+            } else {
+                for (uint32_t i = 0; i < n; i++, dst += step) host_store16(dst, CPU_AX);
+            }
+            CPU_DI += step * (int32_t) n;
+            break;
+        case 0xAC:
+            CPU_AL = src[last];
+            CPU_SI += step * (int32_t) n;
+            break;
+        case 0xAD:
+            CPU_AX = host_load16(src + last);
+            CPU_SI += step * (int32_t) n;
+            break;
+        default: {
+            /* CMPS, SCAS: find the element that ends the repeat */
+            const bool scas = opcode >= 0xAE;
+            const bool until_equal = reptype == 2;
+            uint32_t i = 0;
+            if (size == 1) {
+                if (scas && until_equal && !df) {
+                    const uint8_t *hit = memchr(dst, CPU_AL, n);
+                    i = hit ? (uint32_t) (hit - dst) : n;
+                } else if (!scas && !until_equal && !df && !memcmp(src, dst, n)) {
+                    i = n;
+                } else {
+                    for (; i < n; i++) {
+                        const uint8_t v1 = scas ? CPU_AL : src[(int32_t) i * step];
+                        if ((v1 == dst[(int32_t) i * step]) == until_equal) break;
+                    }
+                }
+            } else {
+                for (; i < n; i++) {
+                    const uint16_t v1 = scas ? CPU_AX : host_load16(src + (int32_t) i * step);
+                    if ((v1 == host_load16(dst + (int32_t) i * step)) == until_equal) break;
+                }
+            }
+            if (i < n) {
+                *stopped = true;
+                n = i + 1;
+            }
+            const int32_t at = (int32_t) (n - 1) * step;
+            if (size == 1) {
+                flag_sub8(scas ? CPU_AL : src[at], dst[at]);
+            } else {
+                oper1 = scas ? CPU_AX : host_load16(src + at);
+                oper2 = host_load16(dst + at);
+                flag_sub16(oper1, oper2);
+            }
+            if (!scas) CPU_SI += step * (int32_t) n;
+            CPU_DI += step * (int32_t) n;
+            break;
+        }
+    }
+    CPU_CX -= n;
+    return n;
+}
+#endif
+
 void reset86() {
     CPU_CS = 0xFFFF;
     CPU_SS = 0x0000;
     CPU_SP = 0x0000;
 
     memset(VIDEORAM, 0x00, sizeof(VIDEORAM));
+    video_dirty_set();
+    vga_chunky_rebuild();
     if (butter_psram_size) {
         memset(RAM, 0, sizeof(RAM));
         memset(UMB, 0, sizeof(UMB));
@@ -1303,7 +1951,14 @@ void reset86() {
             for (uint32_t a = HMA_START; a < HMA_END; a += 4) swap_write32(a, 0);
         }
     }
-    init_umb();
+    init_xms();
+    init_ems();
+#if DECODE_CACHE_BITS
+    decode_cache_flush();
+#endif
+#if CPU_LAZY_FLAGS
+    lazy_op = LAZY_NONE;
+#endif
     ip = 0x0000;
     i8237_reset();
     vga_init();
@@ -1313,16 +1968,136 @@ void reset86() {
 extern volatile int16_t last_sb_sample;
 extern volatile bool ask_to_blast;
 
+// loop index at which exec86 has to call sched_run again
+static INLINE uint32_t sched_steps(const uint64_t now, const uint32_t loopcount) {
+    if (sched_next <= now) {
+        return loopcount;
+    }
+    const uint64_t ahead = sched_next - now;
+    return ahead < UINT32_MAX - loopcount ? loopcount + (uint32_t) ahead : UINT32_MAX;
+}
+
+// Idle guest: HLT with IF set waits for the next interrupt, and so does a tight INT 16h
+// AH=01h/11h loop on an empty keyboard buffer. A tight keyboard controller status poll only
+// runs on to the next event. The skipped steps still count as emulated time, so the host
+// front end sleeps them off while pacing.
+static uint8_t cpu_halted = 0;
+uint64_t cpu_idle_cycles = 0;
+// steps that are not an instruction of their own: every string element but the one that ends a
+// REPE/REPNE takes a second step, in bulk as well as one element at a time
+uint64_t cpu_extra_steps = 0;
+#if PICO_ON_DEVICE
+#define string_step() (loopcount++)
+#else
+#define string_step() (loopcount++, cpu_extra_steps++)
+#endif
+static uint64_t idle_last;
+static uint32_t idle_key, idle_polls;
+
+// true once the same poll with the same outcome repeated CPU_IDLE_POLLS times back to back;
+// the count starts over then, so a loop with a timeout still runs CPU_IDLE_POLLS polls per skip
+static INLINE bool idle_poll(const uint64_t now, const uint32_t key) {
+    if (key == idle_key && now - idle_last <= CPU_IDLE_POLL_GAP) {
+        idle_polls++;
+    } else {
+        idle_key = key;
+        idle_polls = 0;
+    }
+    idle_last = now;
+    if (idle_polls < CPU_IDLE_POLLS) return false;
+    idle_polls = 0;
+    return true;
+}
+
+// loop index of the next scheduler event, capped to the end of this exec86 slice. Unlike
+// sched_due it ignores an IRQ held back by IF=0, which a poll loop cannot release.
+static INLINE uint32_t idle_until(const uint64_t now, const uint32_t loopcount, const uint32_t execloops) {
+    if (sched_event_next <= now) {
+        return loopcount;
+    }
+    const uint64_t ahead = sched_event_next - now;
+    return ahead < execloops - loopcount ? loopcount + (uint32_t) ahead : execloops;
+}
+
+// skip the steps up to the next scheduler event or the end of this exec86 slice
+#define idle_skip() do { \
+        const uint32_t until = idle_until(sched_base + loopcount, loopcount, execloops); \
+        if (until > loopcount + 1) { \
+            cpu_idle_cycles += until - 1 - loopcount; \
+            loopcount = until - 1; \
+        } \
+        idle_last = sched_base + loopcount; \
+    } while (0)
+
+// port 60h/64h read back unchanged in a tight loop: input only shows up between exec86 slices
+// or from an interrupt, so the device ends the slice and the host runs on to the next event.
+// With IF=0 no interrupt can end a wait on the device, so it only ends the slice then.
+#if PICO_ON_DEVICE
+#define keyboard_poll(port) do { \
+        if (idle_poll(sched_base + loopcount, 0x10000 | ((port) << 8) | CPU_AL)) { \
+            if (ifl) __wfe(); \
+            loopcount = execloops - 1; \
+        } \
+    } while (0)
+#else
+#define keyboard_poll(port) do { \
+        if (idle_poll(sched_base + loopcount, 0x10000 | ((port) << 8) | CPU_AL) && sched_event_next != UINT64_MAX) { \
+            idle_skip(); \
+        } \
+    } while (0)
+#endif
+
+#if !PICO_ON_DEVICE
+void cpu_snapshot(void) {
+#if CPU_LAZY_FLAGS
+    if (lazy_op) {
+        flags_sync();
+    }
+#endif
+    snapshot_blob(SNAPSHOT_TAG('R', 'E', 'G', 'S'), dwordregs, sizeof(dwordregs));
+    snapshot_blob(SNAPSHOT_TAG('S', 'E', 'G', 'S'), segregs32, sizeof(segregs32));
+    snapshot_blob(SNAPSHOT_TAG('I', 'P', ' ', ' '), &ip32, sizeof(ip32));
+    snapshot_blob(SNAPSHOT_TAG('F', 'L', 'A', 'G'), &x86_flags, sizeof(x86_flags));
+    snapshot_blob(SNAPSHOT_TAG('H', 'L', 'T', ' '), &cpu_halted, sizeof(cpu_halted));
+    snapshot_blob(SNAPSHOT_TAG('V', 'M', 'O', 'D'), &videomode, sizeof(videomode));
+}
+#endif
+
 void __not_in_flash() exec86(uint32_t execloops) {
     static uint16_t firstip;
     static bool was_TF;
 
     //counterticks = (uint64_t) ( (double) timerfreq / (double) 65536.0);
     //tickssource();
-    for (uint32_t loopcount = 0; loopcount < execloops; loopcount++) {
+    // one loop step is one emulated cycle, sched_now is brought up to date before device events run
+    const uint64_t sched_base = sched_now;
+    uint32_t loopcount;
+    sched_due = cpu_halted ? 0 : sched_steps(sched_base, 0);
+    for (loopcount = 0; loopcount < execloops; loopcount++) {
+        if (unlikely(loopcount >= sched_due)) {
+            sched_now = sched_base + loopcount;
+            sched_run();
+            sched_due = sched_steps(sched_now, loopcount);
+#if !PICO_ON_DEVICE
+            if (ifl && (i8259_controller.interrupt_request_register & (~i8259_controller.interrupt_mask_register))) {
+                cpu_halted = 0;
+                intcall86(nextintr()); // get next interrupt from the i8259, if any d
+            }
+            if (unlikely(cpu_halted)) {
+                if (ifl && sched_event_next != UINT64_MAX) {
+                    idle_skip();
+                    continue;
+                }
+                cpu_halted = 0; // nothing left that could wake the CPU up
+            }
+#endif
+        }
+#if PICO_ON_DEVICE
+        // the second core raises IRQ0 without going through the scheduler
         if (unlikely(ifl && (i8259_controller.interrupt_request_register & (~i8259_controller.interrupt_mask_register)))) {
-            intcall86(nextintr()); // get next interrupt from the i8259, if any d
+            intcall86(nextintr());
         }
+#endif
 #if PICO_ON_DEVICE
         if (ask_to_blast) {
             ask_to_blast = false;
@@ -1334,7 +2109,21 @@ void __not_in_flash() exec86(uint32_t execloops) {
         useseg = CPU_DS;
         uint8_t docontinue = 0;
         firstip = CPU_IP;
-        register uint8_t opcode;
+        register uint8_t opcode = 0;
+#if DECODE_CACHE_BITS
+        insn = decode_lookup();
+        if (likely(insn != NULL)) {
+            if (insn->seg) {
+                useseg = getsegreg(insn->seg - 1);
+                segoverride = 1;
+            }
+            reptype = insn->reptype;
+            opcode = insn->opcode;
+            StepIP(insn->head_len);
+            insn_imm_ip = CPU_IP + insn->modrm_len;
+            docontinue = 1;
+        }
+#endif
 
         while (!docontinue) {
             ///         CPU_CS &= 0xFFFF;
@@ -1346,7 +2135,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 // hook for XMS
                 opcode = xms_handler(); // always returns RET TODO: far/short ret?
             } else {
-                opcode = getmem8(CPU_CS, CPU_IP);
+                opcode = getcs8();
             }
 
             StepIP(1);
@@ -1406,6 +2195,26 @@ void __not_in_flash() exec86(uint32_t execloops) {
         register uint8_t res8;
         register uint8_t oper1b;
         register uint8_t oper2b;
+#if CPU_REP_BULK_MAX
+        if (reptype && opcode >= 0xA4 && opcode <= 0xAF && CPU_CX && !tf && !was_TF) {
+            bool stopped;
+            // each element is two steps; stop short of the next device event as single steps would
+            const uint32_t until = sched_due < execloops ? sched_due : execloops;
+            const uint32_t elements = rep_bulk(opcode, until > loopcount ? (until - loopcount + 1) >> 1 : 0,
+                                               segbase(CPU_CS) + firstip, (uint16_t) (CPU_IP - firstip), &stopped);
+            if (elements) {
+                // account for the steps the single element code would have taken
+                loopcount += 2 * elements - 1 - stopped;
+#if !PICO_ON_DEVICE
+                cpu_extra_steps += elements - stopped;
+#endif
+                if (!stopped) {
+                    CPU_IP = firstip;
+                }
+                continue;
+            }
+        }
+#endif
         switch (opcode) {
             case 0x0: /* 00 ADD Eb Gb */
                 modregrm();
@@ -1449,7 +2258,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
             }
             case 0x4: /* 04 ADD CPU_AL Ib */
                 oper1b = CPU_AL;
-                oper2b = getmem8(CPU_CS, CPU_IP);
+                oper2b = getcode8();
                 StepIP(1);
                 op_add8();
                 CPU_AL = res8;
@@ -1458,7 +2267,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
             case 0x5: {
                 /* 05 ADD eAX Iv */
                 register uint32_t oper1 = CPU_AX;
-                register uint32_t oper2 = getmem16(CPU_CS, CPU_IP);
+                register uint32_t oper2 = getcode16();
                 StepIP(2);
                 op_add16();
                 CPU_AX = res16;
@@ -1517,7 +2326,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0xC: /* 0C OR CPU_AL Ib */
                 oper1b = CPU_AL;
-                oper2b = getmem8(CPU_CS, CPU_IP);
+                oper2b = getcode8();
                 StepIP(1);
                 op_or8();
                 CPU_AL = res8;
@@ -1525,7 +2334,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0xD: /* 0D OR eAX Iv */
                 oper1 = CPU_AX;
-                oper2 = getmem16(CPU_CS, CPU_IP);
+                oper2 = getcode16();
                 StepIP(2);
                 op_or16();
                 CPU_AX = res16;
@@ -1585,7 +2394,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x14: /* 14 ADC CPU_AL Ib */
                 oper1b = CPU_AL;
-                oper2b = getmem8(CPU_CS, CPU_IP);
+                oper2b = getcode8();
                 StepIP(1);
                 op_adc8();
                 CPU_AL = res8;
@@ -1593,7 +2402,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x15: /* 15 ADC eAX Iv */
                 oper1 = CPU_AX;
-                oper2 = getmem16(CPU_CS, CPU_IP);
+                oper2 = getcode16();
                 StepIP(2);
                 op_adc16();
                 CPU_AX = res16;
@@ -1643,7 +2452,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x1C: /* 1C SBB CPU_AL Ib */
                 oper1b = CPU_AL;
-                oper2b = getmem8(CPU_CS, CPU_IP);
+                oper2b = getcode8();
                 StepIP(1);
                 op_sbb8();
                 CPU_AL = res8;
@@ -1651,7 +2460,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x1D: /* 1D SBB eAX Iv */
                 oper1 = CPU_AX;
-                oper2 = getmem16(CPU_CS, CPU_IP);
+                oper2 = getcode16();
                 StepIP(2);
                 op_sbb16();
                 CPU_AX = res16;
@@ -1706,7 +2515,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x24: /* 24 AND CPU_AL Ib */
                 oper1b = CPU_AL;
-                oper2b = getmem8(CPU_CS, CPU_IP);
+                oper2b = getcode8();
                 StepIP(1);
                 op_and8();
                 CPU_AL = res8;
@@ -1714,7 +2523,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x25: /* 25 AND eAX Iv */
                 oper1 = CPU_AX;
-                oper2 = getmem16(CPU_CS, CPU_IP);
+                oper2 = getcode16();
                 StepIP(2);
                 op_and16();
                 CPU_AX = res16;
@@ -1789,7 +2598,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x2C: /* 2C SUB CPU_AL Ib */
                 oper1b = CPU_AL;
-                oper2b = getmem8(CPU_CS, CPU_IP);
+                oper2b = getcode8();
                 StepIP(1);
                 op_sub8();
                 CPU_AL = res8;
@@ -1797,7 +2606,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x2D: /* 2D SUB eAX Iv */
                 oper1 = CPU_AX;
-                oper2 = getmem16(CPU_CS, CPU_IP);
+                oper2 = getcode16();
                 StepIP(2);
                 op_sub16();
                 CPU_AX = res16;
@@ -1869,7 +2678,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x34: /* 34 XOR CPU_AL Ib */
                 oper1b = CPU_AL;
-                oper2b = getmem8(CPU_CS, CPU_IP);
+                oper2b = getcode8();
                 StepIP(1);
                 op_xor8();
                 CPU_AL = res8;
@@ -1877,7 +2686,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x35: /* 35 XOR eAX Iv */
                 oper1 = CPU_AX;
-                oper2 = getmem16(CPU_CS, CPU_IP);
+                oper2 = getcode16();
                 StepIP(2);
                 op_xor16();
                 CPU_AX = res16;
@@ -1886,9 +2695,9 @@ void __not_in_flash() exec86(uint32_t execloops) {
             case 0x37: /* 37 AAA ASCII */
                 if (((CPU_AL & 0xF) > 9) || (af == 1)) {
                     CPU_AX = CPU_AX + 0x106;
-                    x86_flags.value |= FLAG_CF_AF_MASK;
+                    cpu_flags.value |= FLAG_CF_AF_MASK;
                 } else {
-                    x86_flags.value &= ~FLAG_CF_AF_MASK;
+                    cpu_flags.value &= ~FLAG_CF_AF_MASK;
                 }
 
                 CPU_AL = CPU_AL & 0xF;
@@ -1932,7 +2741,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x3C: /* 3C CMP CPU_AL Ib */
                 oper1b = CPU_AL;
-                oper2b = getmem8(CPU_CS, CPU_IP);
+                oper2b = getcode8();
                 StepIP(1);
                 flag_sub8(oper1b, oper2b
                 );
@@ -1940,7 +2749,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x3D: /* 3D CMP eAX Iv */
                 oper1 = CPU_AX;
-                oper2 = getmem16(CPU_CS, CPU_IP);
+                oper2 = getcode16();
                 StepIP(2);
                 flag_sub16(oper1, oper2
                 );
@@ -1950,9 +2759,9 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 if (((CPU_AL & 0xF) > 9) || (af == 1)) {
                     CPU_AX = CPU_AX - 6;
                     CPU_AH = CPU_AH - 1;
-                    x86_flags.value |= FLAG_CF_AF_MASK;
+                    cpu_flags.value |= FLAG_CF_AF_MASK;
                 } else {
-                    x86_flags.value &= ~FLAG_CF_AF_MASK;
+                    cpu_flags.value &= ~FLAG_CF_AF_MASK;
                 }
 
                 CPU_AL = CPU_AL & 0xF;
@@ -1960,154 +2769,90 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0x40: {
                 /* 40 INC eAX */
-                register uint32_t oper1 = CPU_AX;
-                register uint32_t dst = oper1 + 1;
-                flag_szp16(dst);
-                of = (((dst ^ oper1) & (dst ^ 1) & 0x8000) != 0);
-                af = (((oper1 ^ 1 ^ dst) & 0x10) != 0);
-                CPU_AX = (uint16_t) dst;
+                flag_inc16(CPU_AX);
+                CPU_AX++;
                 break;
             }
             case 0x41: {
                 /* 41 INC eCX */
-                register uint32_t oper1 = CPU_CX;
-                register uint32_t dst = oper1 + 1;
-                flag_szp16(dst);
-                of = (((dst ^ oper1) & (dst ^ 1) & 0x8000) != 0);
-                af = (((oper1 ^ 1 ^ dst) & 0x10) != 0);
-                CPU_CX = (uint16_t) dst;
+                flag_inc16(CPU_CX);
+                CPU_CX++;
                 break;
             }
             case 0x42: {
                 /* 42 INC eDX */
-                register uint32_t oper1 = CPU_DX;
-                register uint32_t dst = oper1 + 1;
-                flag_szp16(dst);
-                of = (((dst ^ oper1) & (dst ^ 1) & 0x8000) != 0);
-                af = (((oper1 ^ 1 ^ dst) & 0x10) != 0);
-                CPU_DX = (uint16_t) dst;
+                flag_inc16(CPU_DX);
+                CPU_DX++;
                 break;
             }
             case 0x43: {
                 /* 43 INC eBX */
-                register uint32_t oper1 = CPU_BX;
-                register uint32_t dst = oper1 + 1;
-                flag_szp16(dst);
-                of = (((dst ^ oper1) & (dst ^ 1) & 0x8000) != 0);
-                af = (((oper1 ^ 1 ^ dst) & 0x10) != 0);
-                CPU_BX = (uint16_t) dst;
+                flag_inc16(CPU_BX);
+                CPU_BX++;
                 break;
             }
             case 0x44: {
                 /* 44 INC eSP */
-                register uint32_t oper1 = CPU_SP;
-                register uint32_t dst = oper1 + 1;
-                flag_szp16(dst);
-                of = (((dst ^ oper1) & (dst ^ 1) & 0x8000) != 0);
-                af = (((oper1 ^ 1 ^ dst) & 0x10) != 0);
-                CPU_SP = (uint16_t) dst;
+                flag_inc16(CPU_SP);
+                CPU_SP++;
                 break;
             }
             case 0x45: {
                 /* 45 INC eBP */
-                register uint32_t oper1 = CPU_BP;
-                register uint32_t dst = oper1 + 1;
-                flag_szp16(dst);
-                of = (((dst ^ oper1) & (dst ^ 1) & 0x8000) != 0);
-                af = (((oper1 ^ 1 ^ dst) & 0x10) != 0);
-                CPU_BP = (uint16_t) dst;
+                flag_inc16(CPU_BP);
+                CPU_BP++;
                 break;
             }
             case 0x46: {
                 /* 46 INC eSI */
-                register uint32_t oper1 = CPU_SI;
-                register uint32_t dst = oper1 + 1;
-                flag_szp16(dst);
-                of = (((dst ^ oper1) & (dst ^ 1) & 0x8000) != 0);
-                af = (((oper1 ^ 1 ^ dst) & 0x10) != 0);
-                CPU_SI = (uint16_t) dst;
+                flag_inc16(CPU_SI);
+                CPU_SI++;
                 break;
             }
             case 0x47: {
                 /* 47 INC eDI */
-                register uint32_t oper1 = CPU_DI;
-                register uint32_t dst = oper1 + 1;
-                flag_szp16(dst);
-                of = (((dst ^ oper1) & (dst ^ 1) & 0x8000) != 0);
-                af = (((oper1 ^ 1 ^ dst) & 0x10) != 0);
-                CPU_DI = (uint16_t) dst;
+                flag_inc16(CPU_DI);
+                CPU_DI++;
                 break;
             }
             case 0x48: /* 48 DEC eAX */
-                oldcf = cf;
-                oper1 = CPU_AX;
-                oper2 = 1;
-                op_sub16();
-                cf = oldcf;
-                CPU_AX = res16;
+                flag_dec16(CPU_AX);
+                CPU_AX--;
                 break;
 
             case 0x49: /* 49 DEC eCX */
-                oldcf = cf;
-                oper1 = CPU_CX;
-                oper2 = 1;
-                op_sub16();
-                cf = oldcf;
-                CPU_CX = res16;
+                flag_dec16(CPU_CX);
+                CPU_CX--;
                 break;
 
             case 0x4A: /* 4A DEC eDX */
-                oldcf = cf;
-                oper1 = CPU_DX;
-                oper2 = 1;
-                op_sub16();
-                cf = oldcf;
-                CPU_DX = res16;
+                flag_dec16(CPU_DX);
+                CPU_DX--;
                 break;
 
             case 0x4B: /* 4B DEC eBX */
-                oldcf = cf;
-                oper1 = CPU_BX;
-                oper2 = 1;
-                op_sub16();
-                cf = oldcf;
-                CPU_BX = res16;
+                flag_dec16(CPU_BX);
+                CPU_BX--;
                 break;
 
             case 0x4C: /* 4C DEC eSP */
-                oldcf = cf;
-                oper1 = CPU_SP;
-                oper2 = 1;
-                op_sub16();
-                cf = oldcf;
-                CPU_SP = res16;
+                flag_dec16(CPU_SP);
+                CPU_SP--;
                 break;
 
             case 0x4D: /* 4D DEC eBP */
-                oldcf = cf;
-                oper1 = CPU_BP;
-                oper2 = 1;
-                op_sub16();
-                cf = oldcf;
-                CPU_BP = res16;
+                flag_dec16(CPU_BP);
+                CPU_BP--;
                 break;
 
             case 0x4E: /* 4E DEC eSI */
-                oldcf = cf;
-                oper1 = CPU_SI;
-                oper2 = 1;
-                op_sub16();
-                cf = oldcf;
-                CPU_SI = res16;
+                flag_dec16(CPU_SI);
+                CPU_SI--;
                 break;
 
             case 0x4F: /* 4F DEC eDI */
-                oldcf = cf;
-                oper1 = CPU_DI;
-                oper2 = 1;
-                op_sub16();
-                cf = oldcf;
-                CPU_DI = res16;
+                flag_dec16(CPU_DI);
+                CPU_DI--;
                 break;
 
             case 0x50: /* 50 PUSH eAX */
@@ -2232,7 +2977,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 break;
 #endif
             case 0x68: /* 68 PUSH Iv (80186+) */
-                push(getmem16(CPU_CS, CPU_IP)
+                push(getcode16()
                 );
                 StepIP(2);
                 break;
@@ -2241,19 +2986,19 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 /* 69 IMUL Gv Ev Iv (80186+) */
                 modregrm();
                 register int32_t temp1 = (int32_t)(int16_t)readrm16(rm);
-                register int32_t temp2 = (int32_t)(int16_t)getmem16(CPU_CS, CPU_IP);
+                register int32_t temp2 = (int32_t)(int16_t)getcode16();
                 StepIP(2);
                 temp1 *= temp2;
                 putreg16(reg, (int16_t)temp1);
                 if (temp1 != (int32_t)(int16_t)temp1) {
-                    x86_flags.value |= FLAG_CF_OF_MASK;
+                    cpu_flags.value |= FLAG_CF_OF_MASK;
                 } else {
-                    x86_flags.value &= ~FLAG_CF_OF_MASK;
+                    cpu_flags.value &= ~FLAG_CF_OF_MASK;
                 }
                 break;
             }
             case 0x6A: /* 6A PUSH Ib (80186+) */
-                push((uint16_t) signext(getmem8(CPU_CS, CPU_IP)));
+                push((uint16_t) signext(getcode8()));
                 StepIP(1);
                 break;
 
@@ -2261,14 +3006,14 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 /* 6B IMUL Gv Eb Ib (80186+) */
                 modregrm();
                 register int32_t temp1 = (int32_t)(int16_t)readrm16(rm);
-                register int32_t temp2 = (int32_t)(int16_t)signext(getmem8(CPU_CS, CPU_IP));
+                register int32_t temp2 = (int32_t)(int16_t)signext(getcode8());
                 StepIP(1);
                 temp1 *= temp2;
 				putreg16(reg, (int16_t)temp1);
                 if (temp1 != (int32_t)(int16_t)temp1) {
-                    x86_flags.value |= FLAG_CF_OF_MASK;
+                    cpu_flags.value |= FLAG_CF_OF_MASK;
                 } else {
-                    x86_flags.value &= ~FLAG_CF_OF_MASK;
+                    cpu_flags.value &= ~FLAG_CF_OF_MASK;
                 }
                 break;
             }
@@ -2290,7 +3035,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     CPU_CX = CPU_CX - 1;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -2316,7 +3061,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     CPU_CX = CPU_CX - 1;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -2342,7 +3087,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     CPU_CX = CPU_CX - 1;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -2368,7 +3113,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     CPU_CX = CPU_CX - 1;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -2378,131 +3123,129 @@ void __not_in_flash() exec86(uint32_t execloops) {
 #endif
 
             case 0x70: /* 70 JO Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (of) {
+                if (get_of()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x71: /* 71 JNO Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (!of) {
+                if (!get_of()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x72: /* 72 JB Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (cf) {
+                if (get_cf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x73: /* 73 JNB Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (!cf) {
+                if (!get_cf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x74: /* 74 JZ Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (zf) {
+                if (get_zf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x75: /* 75 JNZ Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (!zf) {
+                if (!get_zf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x76: /* 76 JBE Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (cf || zf) {
+                if (get_cf() || get_zf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x77: /* 77 JA Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (!cf && !zf) {
+                if (!get_cf() && !get_zf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x78: /* 78 JS Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (sf) {
+                if (get_sf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x79: /* 79 JNS Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (!sf) {
+                if (!get_sf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x7A: /* 7A JPE Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (pf) {
+                if (get_pf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x7B: /* 7B JPO Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (!pf) {
+                if (!get_pf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x7C: /* 7C JL Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (sf != of) {
+                if (get_sf() != get_of()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x7D: /* 7D JGE Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (sf == of) {
+                if (get_sf() == get_of()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x7E: /* 7E JLE Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if ((sf != of) || zf) {
+                if ((get_sf() != get_of()) || get_zf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0x7F: /* 7F JG Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
-                if (!
-                    zf && (sf
-                           == of)) {
+                if (!get_zf() && (get_sf() == get_of())) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
@@ -2512,7 +3255,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 modregrm();
 
                 oper1b = readrm8(rm);
-                oper2b = getmem8(CPU_CS, CPU_IP);
+                oper2b = getcode8();
                 StepIP(1);
                 switch (reg) {
                     case 0:
@@ -2556,10 +3299,10 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
                 oper1 = readrm16(rm);
                 if (opcode == 0x81) {
-                    oper2 = getmem16(CPU_CS, CPU_IP);
+                    oper2 = getcode16();
                     StepIP(2);
                 } else {
-                    oper2 = signext(getmem8(CPU_CS, CPU_IP));
+                    oper2 = signext(getcode8());
                     StepIP(1);
                 }
 
@@ -2758,9 +3501,9 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 break;
 
             case 0x9A: /* 9A CALL Ap */
-                oper1 = getmem16(CPU_CS, CPU_IP);
+                oper1 = getcode16();
                 StepIP(2);
-                oper2 = getmem16(CPU_CS, CPU_IP);
+                oper2 = getcode16();
                 StepIP(2);
                 push(CPU_CS);
                 push(CPU_IP);
@@ -2793,23 +3536,23 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 break;
 
             case 0xA0: /* A0 MOV CPU_AL Ob */
-                CPU_AL = getmem8(useseg, getmem16(CPU_CS, CPU_IP));
+                CPU_AL = getmem8(useseg, getcode16());
                 StepIP(2);
                 break;
 
             case 0xA1: /* A1 MOV eAX Ov */
-                oper1 = getmem16(useseg, getmem16(CPU_CS, CPU_IP));
+                oper1 = getmem16(useseg, getcode16());
                 StepIP(2);
                 CPU_AX = oper1;
                 break;
 
             case 0xA2: /* A2 MOV Ob CPU_AL */
-                putmem8(useseg, getmem16(CPU_CS, CPU_IP), CPU_AL);
+                putmem8(useseg, getcode16(), CPU_AL);
                 StepIP(2);
                 break;
 
             case 0xA3: /* A3 MOV Ov eAX */
-                putmem16(useseg, getmem16(CPU_CS, CPU_IP), CPU_AX);
+                putmem16(useseg, getcode16(), CPU_AX);
                 StepIP(2);
                 break;
 
@@ -2834,7 +3577,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     CPU_CX = CPU_CX - 1;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -2863,7 +3606,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     CPU_CX = CPU_CX - 1;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -2900,7 +3643,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     break;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -2939,7 +3682,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     break;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -2949,7 +3692,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0xA8: /* A8 TEST CPU_AL Ib */
                 oper1b = CPU_AL;
-                oper2b = getmem8(CPU_CS, CPU_IP);
+                oper2b = getcode8();
                 StepIP(1);
                 flag_log8(oper1b
                           & oper2b);
@@ -2957,7 +3700,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
 
             case 0xA9: /* A9 TEST eAX Iv */
                 oper1 = CPU_AX;
-                oper2 = getmem16(CPU_CS, CPU_IP);
+                oper2 = getcode16();
                 StepIP(2);
                 flag_log16(oper1
                            & oper2);
@@ -2982,7 +3725,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     CPU_CX = CPU_CX - 1;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -3009,7 +3752,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     CPU_CX = CPU_CX - 1;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -3035,7 +3778,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     CPU_CX = CPU_CX - 1;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -3062,7 +3805,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     CPU_CX = CPU_CX - 1;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -3097,7 +3840,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     break;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -3133,7 +3876,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                     break;
                 }
 
-                loopcount++;
+                string_step();
                 if (!reptype) {
                     break;
                 }
@@ -3142,86 +3885,86 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 break;
 
             case 0xB0: /* B0 MOV CPU_AL Ib */
-                CPU_AL = getmem8(CPU_CS, CPU_IP);
+                CPU_AL = getcode8();
                 StepIP(1);
                 break;
 
             case 0xB1: /* B1 MOV CPU_CL Ib */
-                CPU_CL = getmem8(CPU_CS, CPU_IP);
+                CPU_CL = getcode8();
                 StepIP(1);
                 break;
 
             case 0xB2: /* B2 MOV CPU_DL Ib */
-                CPU_DL = getmem8(CPU_CS, CPU_IP);
+                CPU_DL = getcode8();
                 StepIP(1);
                 break;
 
             case 0xB3: /* B3 MOV CPU_BL Ib */
-                CPU_BL = getmem8(CPU_CS, CPU_IP);
+                CPU_BL = getcode8();
                 StepIP(1);
                 break;
 
             case 0xB4: /* B4 MOV CPU_AH Ib */
-                CPU_AH = getmem8(CPU_CS, CPU_IP);
+                CPU_AH = getcode8();
                 StepIP(1);
                 break;
 
             case 0xB5: /* B5 MOV CPU_CH Ib */
-                CPU_CH = getmem8(CPU_CS, CPU_IP);
+                CPU_CH = getcode8();
                 StepIP(1);
                 break;
 
             case 0xB6: /* B6 MOV CPU_DH Ib */
-                CPU_DH = getmem8(CPU_CS, CPU_IP);
+                CPU_DH = getcode8();
                 StepIP(1);
                 break;
 
             case 0xB7: /* B7 MOV CPU_BH Ib */
-                CPU_BH = getmem8(CPU_CS, CPU_IP);
+                CPU_BH = getcode8();
                 StepIP(1);
                 break;
 
             case 0xB8: /* B8 MOV eAX Iv */
-                oper1 = getmem16(CPU_CS, CPU_IP);
+                oper1 = getcode16();
                 StepIP(2);
                 CPU_AX = oper1;
                 break;
 
             case 0xB9: /* B9 MOV eCX Iv */
-                oper1 = getmem16(CPU_CS, CPU_IP);
+                oper1 = getcode16();
                 StepIP(2);
                 CPU_CX = oper1;
                 break;
 
             case 0xBA: /* BA MOV eDX Iv */
-                oper1 = getmem16(CPU_CS, CPU_IP);
+                oper1 = getcode16();
                 StepIP(2);
                 CPU_DX = oper1;
                 break;
 
             case 0xBB: /* BB MOV eBX Iv */
-                oper1 = getmem16(CPU_CS, CPU_IP);
+                oper1 = getcode16();
                 StepIP(2);
                 CPU_BX = oper1;
                 break;
 
             case 0xBC: /* BC MOV eSP Iv */
-                CPU_SP = getmem16(CPU_CS, CPU_IP);
+                CPU_SP = getcode16();
                 StepIP(2);
                 break;
 
             case 0xBD: /* BD MOV eBP Iv */
-                CPU_BP = getmem16(CPU_CS, CPU_IP);
+                CPU_BP = getcode16();
                 StepIP(2);
                 break;
 
             case 0xBE: /* BE MOV eSI Iv */
-                CPU_SI = getmem16(CPU_CS, CPU_IP);
+                CPU_SI = getcode16();
                 StepIP(2);
                 break;
 
             case 0xBF: /* BF MOV eDI Iv */
-                CPU_DI = getmem16(CPU_CS, CPU_IP);
+                CPU_DI = getcode16();
                 StepIP(2);
                 break;
 
@@ -3229,7 +3972,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 modregrm();
 
                 oper1b = readrm8(rm);
-                oper2b = getmem8(CPU_CS, CPU_IP);
+                oper2b = getcode8();
                 StepIP(1);
                 writerm8(rm, op_grp2_8(oper2b, oper1b));
                 break;
@@ -3238,14 +3981,14 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 modregrm();
 
                 oper1 = readrm16(rm);
-                oper2 = getmem8(CPU_CS, CPU_IP);
+                oper2 = getcode8();
                 StepIP(1);
                 writerm16(rm, op_grp2_16((uint8_t) oper2)
                 );
                 break;
 
             case 0xC2: /* C2 RET Iw */
-                oper1 = getmem16(CPU_CS, CPU_IP);
+                oper1 = getcode16();
                 CPU_IP = pop();
                 CPU_SP = CPU_SP + oper1;
                 break;
@@ -3273,7 +4016,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
             case 0xC6: /* C6 MOV Eb Ib */
                 modregrm();
 
-                writerm8(rm, getmem8(CPU_CS, CPU_IP)
+                writerm8(rm, getcode8()
                 );
                 StepIP(1);
                 break;
@@ -3281,15 +4024,15 @@ void __not_in_flash() exec86(uint32_t execloops) {
             case 0xC7: /* C7 MOV Ev Iv */
                 modregrm();
 
-                writerm16(rm, getmem16(CPU_CS, CPU_IP)
+                writerm16(rm, getcode16()
                 );
                 StepIP(2);
                 break;
 
             case 0xC8: /* C8 ENTER (80186+) */
-                stacksize = getmem16(CPU_CS, CPU_IP);
+                stacksize = getcode16();
                 StepIP(2);
-                nestlev = getmem8(CPU_CS, CPU_IP);
+                nestlev = getcode8();
                 StepIP(1);
                 push(CPU_BP);
                 frametemp = CPU_SP;
@@ -3316,7 +4059,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 break;
 
             case 0xCA: /* CA RETF Iw */
-                oper1 = getmem16(CPU_CS, CPU_IP);
+                oper1 = getcode16();
                 CPU_IP = pop();
                 CPU_CS = pop();
                 CPU_SP = CPU_SP + oper1;
@@ -3332,8 +4075,25 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 break;
 
             case 0xCD: /* CD INT Ib */
-                oper1b = getmem8(CPU_CS, CPU_IP);
+                oper1b = getcode8();
                 StepIP(1);
+                // keyboard status check on an empty BIOS buffer, with IRQ0 or IRQ1 left to end the wait
+                if (unlikely(oper1b == 0x16) && (CPU_AH & 0xEF) == 0x01 && ifl &&
+                    (i8259_controller.interrupt_mask_register & 3) != 3 &&
+                    readw86(0x41A) == readw86(0x41C) && idle_poll(sched_base + loopcount, 0x16)) {
+#if PICO_ON_DEVICE
+                    __wfe();
+#else
+                    if (sched_event_next != UINT64_MAX) {
+                        // retry the INT once an interrupt has been serviced, and let that retry
+                        // through so that a loop waiting for a key with a timeout gets to run
+                        ip = firstip;
+                        cpu_halted = 1;
+                        idle_skip();
+                        break;
+                    }
+#endif
+                }
                 intcall86(oper1b);
                 break;
 
@@ -3388,7 +4148,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 break;
 
             case 0xD4: /* D4 AAM I0 */
-                oper1 = getmem8(CPU_CS, CPU_IP);
+                oper1 = getcode8();
                 StepIP(1);
                 if (!oper1) {
                     intcall86(0);
@@ -3401,7 +4161,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 break;
 
             case 0xD5: /* D5 AAD I0 */
-                oper1 = getmem8(CPU_CS, CPU_IP);
+                oper1 = getcode8();
                 StepIP(1);
                 CPU_AL = (CPU_AH * oper1 + CPU_AL) & 255;
                 CPU_AH = 0;
@@ -3432,25 +4192,25 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 break;
 
             case 0xE0: /* E0 LOOPNZ Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
                 CPU_CX = CPU_CX - 1;
-                if ((CPU_CX) && !zf) {
+                if ((CPU_CX) && !get_zf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0xE1: /* E1 LOOPZ Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
                 CPU_CX = CPU_CX - 1;
-                if (CPU_CX && (zf == 1)) {
+                if (CPU_CX && get_zf()) {
                     CPU_IP = CPU_IP + temp16;
                 }
                 break;
 
             case 0xE2: /* E2 LOOP Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
                 CPU_CX = CPU_CX - 1;
                 if (CPU_CX) {
@@ -3459,7 +4219,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 break;
 
             case 0xE3: /* E3 JCXZ Jb */
-                temp16 = signext(getmem8(CPU_CS, CPU_IP));
+                temp16 = signext(getcode8());
                 StepIP(1);
                 if (!CPU_CX) {
                     CPU_IP = CPU_IP + temp16;
@@ -3467,65 +4227,75 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 break;
 
             case 0xE4: /* E4 IN CPU_AL Ib */
-                oper1b = getmem8(CPU_CS, CPU_IP);
+                oper1b = getcode8();
                 StepIP(1);
+                sched_now = sched_base + loopcount; // port status may depend on emulated time
                 CPU_AL = (uint8_t) portin(oper1b);
+                if (unlikely((oper1b | 4) == 0x64)) {
+                    keyboard_poll(oper1b);
+                }
                 break;
 
             case 0xE5: /* E5 IN eAX Ib */
-                oper1b = getmem8(CPU_CS, CPU_IP);
+                oper1b = getcode8();
                 StepIP(1);
+                sched_now = sched_base + loopcount;
                 CPU_AX = portin16(oper1b);
                 break;
 
             case 0xE6: /* E6 OUT Ib CPU_AL */
-                oper1b = getmem8(CPU_CS, CPU_IP);
+                oper1b = getcode8();
                 StepIP(1);
                 portout(oper1b, CPU_AL
                 );
                 break;
 
             case 0xE7: /* E7 OUT Ib eAX */
-                oper1b = getmem8(CPU_CS, CPU_IP);
+                oper1b = getcode8();
                 StepIP(1);
                 portout16(oper1b, CPU_AX
                 );
                 break;
 
             case 0xE8: /* E8 CALL Jv */
-                oper1 = getmem16(CPU_CS, CPU_IP);
+                oper1 = getcode16();
                 StepIP(2);
                 push(CPU_IP);
                 CPU_IP = CPU_IP + oper1;
                 break;
 
             case 0xE9: /* E9 JMP Jv */
-                oper1 = getmem16(CPU_CS, CPU_IP);
+                oper1 = getcode16();
                 StepIP(2);
                 CPU_IP = CPU_IP + oper1;
                 break;
 
             case 0xEA: /* EA JMP Ap */
-                oper1 = getmem16(CPU_CS, CPU_IP);
+                oper1 = getcode16();
                 StepIP(2);
-                oper2 = getmem16(CPU_CS, CPU_IP);
+                oper2 = getcode16();
                 CPU_IP = oper1;
                 CPU_CS = oper2;
                 break;
 
             case 0xEB: /* EB JMP Jb */
-                oper1 = signext(getmem8(CPU_CS, CPU_IP));
+                oper1 = signext(getcode8());
                 StepIP(1);
                 CPU_IP = CPU_IP + oper1;
                 break;
 
             case 0xEC: /* EC IN CPU_AL regdx */
                 oper1 = CPU_DX;
+                sched_now = sched_base + loopcount;
                 CPU_AL = (uint8_t) portin(oper1);
+                if (unlikely((oper1 | 4) == 0x64)) {
+                    keyboard_poll(oper1);
+                }
                 break;
 
             case 0xED: /* ED IN eAX regdx */
                 oper1 = CPU_DX;
+                sched_now = sched_base + loopcount;
                 CPU_AX = portin16(oper1);
                 break;
 
@@ -3544,8 +4314,19 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 break;
 
             case 0xF4: /* F4 HLT */
-                /// TODO:
-                //hltstate = 1;
+                if (ifl) {
+#if PICO_ON_DEVICE
+                    // core 1 sends an event after raising IRQ0, local interrupts wake us as well
+                    if (!(i8259_controller.interrupt_request_register & ~i8259_controller.interrupt_mask_register)) {
+                        __wfe();
+                    }
+#else
+                    if (sched_event_next != UINT64_MAX) {
+                        cpu_halted = 1;
+                        idle_skip();
+                    }
+#endif
+                }
                 break;
 
             case 0xF5: /* F5 CMC */
@@ -3563,7 +4344,7 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 switch (reg) {
                     case 0:
                     case 1: /* TEST */
-                        flag_log8(oper1b & getmem8(CPU_CS, CPU_IP));
+                        flag_log8(oper1b & getcode8());
                         StepIP(1);
                         break;
 
@@ -3587,9 +4368,9 @@ void __not_in_flash() exec86(uint32_t execloops) {
                         CPU_AX = temp1 & 0xFFFF;
                         flag_szp8((uint8_t) temp1);
                         if (CPU_AH) {
-                            x86_flags.value |= FLAG_CF_OF_MASK;
+                            cpu_flags.value |= FLAG_CF_OF_MASK;
                         } else {
-                            x86_flags.value &= ~FLAG_CF_OF_MASK;
+                            cpu_flags.value &= ~FLAG_CF_OF_MASK;
                         }
 #ifdef CPU_CLEAR_ZF_ON_MUL
                         zf = 0;
@@ -3605,9 +4386,9 @@ void __not_in_flash() exec86(uint32_t execloops) {
 						int16_t result = (int16_t)temp1;
 						int8_t truncated = (int8_t)result;
 						if (result != (int16_t)truncated) {
-							x86_flags.value |= FLAG_CF_OF_MASK; // CF=OF=1
+							cpu_flags.value |= FLAG_CF_OF_MASK; // CF=OF=1
 						} else {
-							x86_flags.value &= ~FLAG_CF_OF_MASK; // CF=OF=0
+							cpu_flags.value &= ~FLAG_CF_OF_MASK; // CF=OF=0
 						}
 						CPU_AL = truncated;
 						CPU_AH = (uint8_t)(result >> 8);
@@ -3671,15 +4452,12 @@ void __not_in_flash() exec86(uint32_t execloops) {
                 oper1b = readrm8(rm);
                 oper2b = 1;
                 if (!reg) {
-                    tempcf = cf;
-                    op_add8();
-                    cf = tempcf;
+                    res8 = oper1b + 1;
+                    flag_inc8(oper1b);
                     writerm8(rm, res8);
                 } else {
-                    tempcf = cf;
-                    res8 = oper1b - oper2b;
-                    flag_sub8(oper1b, oper2b);
-                    cf = tempcf;
+                    res8 = oper1b - 1;
+                    flag_dec8(oper1b);
                     writerm8(rm, res8);
                 }
                 break;
@@ -3707,4 +4485,11 @@ void __not_in_flash() exec86(uint32_t execloops) {
             was_TF = true;
         }
     }
+    sched_now = sched_base + loopcount;
+#if CPU_LAZY_FLAGS
+    // code outside the CPU loop reads x86_flags directly
+    if (lazy_op) {
+        flags_sync();
+    }
+#endif
 }
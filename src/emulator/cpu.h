@@ -3,7 +3,8 @@
 #include <inttypes.h>
 
 extern int a20_enabled;
-void init_umb();
+void init_xms();
+void init_ems();
 
 #define regax 0
 #define regcx 1
@@ -63,15 +64,46 @@ void init_umb();
 #define putsegreg(regid, writeval)  segregs[(regid) << 1] = writeval
 #define segbase(x)  ((uint32_t) (x) << 4)
 
-#define cf  x86_flags.bits.CF
-#define pf  x86_flags.bits.PF
-#define af  x86_flags.bits.AF
-#define zf  x86_flags.bits.ZF
-#define sf  x86_flags.bits.SF
+// CF/PF/AF/ZF/SF/OF of the common ALU ops are kept as the last operation and
+// only computed into x86_flags when something reads or writes them
+#ifndef CPU_LAZY_FLAGS
+#define CPU_LAZY_FLAGS 1
+#endif
+#if CPU_LAZY_FLAGS
+extern uint8_t lazy_op;
+void flags_sync(void);
+#define cpu_flags (*(lazy_op ? flags_sync() : (void) 0, &x86_flags))
+#else
+#define cpu_flags x86_flags
+#endif
+
+// REP MOVS/STOS/LODS/CMPS/SCAS elements run per exec86 step, 0 runs one element per step
+#ifndef CPU_REP_BULK_MAX
+#if PICO_ON_DEVICE
+#define CPU_REP_BULK_MAX 128
+#else
+#define CPU_REP_BULK_MAX 4096
+#endif
+#endif
+
+// a guest polling INT 16h or the keyboard controller this many times in a row, with at most
+// CPU_IDLE_POLL_GAP steps between polls, is treated as idle
+#ifndef CPU_IDLE_POLLS
+#define CPU_IDLE_POLLS 32
+#endif
+#ifndef CPU_IDLE_POLL_GAP
+#define CPU_IDLE_POLL_GAP 512
+#endif
+
+#define cf  cpu_flags.bits.CF
+#define pf  cpu_flags.bits.PF
+#define af  cpu_flags.bits.AF
+#define zf  cpu_flags.bits.ZF
+#define sf  cpu_flags.bits.SF
 #define tf  x86_flags.bits.TF
 #define ifl x86_flags.bits.IF
 #define df  x86_flags.bits.DF
-#define of  x86_flags.bits.OF
+#define of  cpu_flags.bits.OF
 
 #define CPU_FL_CF    cf
 #define CPU_FL_PF    pf
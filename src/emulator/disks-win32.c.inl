@@ -30,8 +30,12 @@ struct struct_drive {
     uint16_t heads;
     uint8_t inserted;
     uint8_t readonly;
+    char pathname[256]; // kept for snapshots, which re-attach images by name
 } disk[4];
 
+const char *disk_images[4] = { "../fdd0.img", "../fdd1.img", "../hdd.img", "../hdd2.img" };
+struct disk_io_s disk_io[4] = { 0 };
+
 
 static inline void ejectdisk(uint8_t drivenum) {
     if (drivenum & 0x80) drivenum -= 126;
@@ -101,6 +105,7 @@ uint8_t insertdisk(uint8_t drivenum, const char *pathname) {
 
     disk[drivenum].diskfile = file;
     disk[drivenum].filesize = size;
+    strncpy(disk[drivenum].pathname, pathname, sizeof(disk[drivenum].pathname) - 1);
     disk[drivenum].inserted = 1;  // Using 1 instead of true for consistency with uint8_t
     disk[drivenum].readonly = 0;  // Default to read-write
     disk[drivenum].cyls = cyls;
@@ -168,6 +173,7 @@ static void readdisk(uint8_t drivenum,
 
     // Set file position
     fseek(disk[drivenum].diskfile, fileoffset, SEEK_SET);
+    disk_io[drivenum].reads++;
 
     // Process sectors
     for (cursect = 0; cursect < sectcount; cursect++) {
@@ -201,6 +207,7 @@ static void readdisk(uint8_t drivenum,
         // Update file offset for next sector
         fileoffset += 512;
     }
+    disk_io[drivenum].sectors_read += cursect;
 
     // If no sectors could be read, handle the error
     if (cursect == 0) {
@@ -257,6 +264,7 @@ static void writedisk(uint8_t drivenum,
 
     // Set file position
     fseek(disk[drivenum].diskfile, fileoffset, SEEK_SET);
+    disk_io[drivenum].writes++;
 
 
     // Write each sector
@@ -270,6 +278,7 @@ static void writedisk(uint8_t drivenum,
         // Write the buffer to the file
         fwrite(sectorbuffer, 512, 1, disk[drivenum].diskfile);
     }
+    disk_io[drivenum].sectors_written += cursect;
 
     // Handle the case where no sectors were written
     if (sectcount && cursect == 0) {
@@ -379,3 +388,38 @@ static INLINE void diskhandler() {
 }
 
 
+
+// Images are re-attached by name, their contents are not part of the snapshot
+void disks_snapshot(void) {
+    struct {
+        char pathname[256];
+        uint64_t filesize;
+        uint8_t inserted;
+        uint8_t readonly;
+    } drives[4];
+    memset(drives, 0, sizeof(drives));
+    for (uint8_t i = 0; i < 4; i++) {
+        memcpy(drives[i].pathname, disk[i].pathname, sizeof(drives[i].pathname));
+        drives[i].filesize = disk[i].filesize;
+        drives[i].inserted = disk[i].inserted;
+        drives[i].readonly = disk[i].readonly;
+    }
+    snapshot_blob(SNAPSHOT_TAG('D', 'I', 'S', 'K'), drives, sizeof(drives));
+    if (!snapshot_loading) {
+        return;
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        const uint8_t drivenum = i < 2 ? i : i + 126;
+        if (!drives[i].inserted) {
+            ejectdisk(drivenum);
+            continue;
+        }
+        if (!disk[i].inserted || strcmp(disk[i].pathname, drives[i].pathname) != 0) {
+            insertdisk(drivenum, drives[i].pathname);
+        }
+        if (disk[i].filesize != drives[i].filesize) {
+            printf("DISK: %s changed size since the snapshot was taken\n", drives[i].pathname);
+        }
+        disk[i].readonly = drives[i].readonly;
+    }
+}
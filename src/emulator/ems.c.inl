@@ -1,70 +1,656 @@
 // The Lo-tech EMS board driver is hardcoded to 2MB.
 #pragma once
+#include "swap.h"
 #if PICO_ON_DEVICE
 #include "psram_spi.h"
-#include "swap.h"
 #endif
 #define EMS_PSRAM_OFFSET (2048 << 10)
+#define EMS_PAGES (EMS_MEMORY_SIZE / 0x4000)
+#define EMS_HANDLES 64
+#define EMS_NO_PAGE 0xFF
+#define EMM_ACCESS_KEY 0x454D4D30u
+_Static_assert(EMS_PAGES < EMS_NO_PAGE, "EMS pages must fit the 8-bit page registers");
 
 static uint8_t ems_pages[4] = {0};
 uint8_t __attribute__((aligned (4), section(".psram"))) EMS[EMS_MEMORY_SIZE] = {0};
 
+// LIM EMS 4.0 driver (INT 67h) state. The pages of a handle, and the free pages, are chained
+// through next[] in logical page order.
+static struct {
+    uint8_t first[EMS_HANDLES];
+    uint8_t count[EMS_HANDLES];
+    uint8_t next[EMS_PAGES];
+    uint8_t free_first, free_count;
+    uint8_t unmapped;       // windows unmapped by the driver, open bus until mapped again
+    uint8_t os_disabled;    // function 5Dh
+    uint64_t used, saved;   // handle bitmaps: allocated, page map saved by function 47h
+    uint16_t saved_map[EMS_HANDLES][4];
+    char names[EMS_HANDLES][8];
+    uint32_t access_key;    // function 5Dh, 0 until handed out as EMM_ACCESS_KEY
+    uint32_t alt_map;       // guest save area of alternate map register set 0, function 5Bh
+} emm;
+
+// Device header and INT 67h entry in the ROM page at FC000: drivers look for "EMMXXXX0" at
+// offset 0Ah of the vector's segment, some far call the vector instead of using INT 67h
+static const uint8_t ems_rom[] = {
+    0xFF, 0xFF, 0xFF, 0xFF,                 // next driver
+    0x00, 0xC0,                             // character device with IOCTL
+    0x00, 0x00, 0x00, 0x00,                 // strategy, interrupt
+    'E', 'M', 'M', 'X', 'X', 'X', 'X', '0',
+    0xCD, 0x67, 0xCF,                       // EMM_ROM_ENTRY: INT 67h, IRET
+    0xCD, 0x67,                             // EMM_ROM_RETURN: function 56h returns through here
+};
+
 inline void out_ems(const uint16_t port, const uint8_t data) {
     ems_pages[port & 3] = data;
+    emm.unmapped &= ~(1 << (port & 3));
+    memory_map_ems(port & 3);
+}
+
+// EMS memory offset of the page a window shows; the board decodes as many selector bits as it has pages
+static INLINE uint32_t ems_window_offset(const uint8_t window) {
+    return (ems_pages[window & 3] & (EMS_MEMORY_SIZE / 0x4000 - 1)) * 0x4000;
+}
+
+void init_ems() {
+    memset(&emm, 0, sizeof(emm));
+    memset(emm.first, EMS_NO_PAGE, sizeof(emm.first));
+    for (uint8_t page = 0; page < EMS_PAGES; page++) {
+        emm.next[page] = page + 1 < EMS_PAGES ? page + 1 : EMS_NO_PAGE;
+    }
+    emm.free_count = EMS_PAGES;
+    emm.used = 1; // handle 0 belongs to the operating system
+    for (uint8_t window = 0; window < 4; window++) {
+        memory_map_ems(window);
+    }
+}
+
+#define emm_ptr(segment, offset) (((uint32_t) (segment) << 4) + (uint16_t) (offset))
+
+static INLINE bool emm_valid(const uint16_t handle) {
+    return handle < EMS_HANDLES && emm.used >> handle & 1;
+}
+
+static uint8_t emm_page(const uint8_t handle, uint16_t logical) {
+    uint8_t page = emm.first[handle];
+    while (logical--) page = emm.next[page];
+    return page;
+}
+
+// moves count pages from the free list to the end of handle
+static void emm_grow(const uint8_t handle, uint8_t count) {
+    uint8_t *link = &emm.first[handle];
+    while (*link != EMS_NO_PAGE) link = &emm.next[*link];
+    emm.count[handle] += count;
+    emm.free_count -= count;
+    while (count--) {
+        *link = emm.free_first;
+        emm.free_first = emm.next[*link];
+        link = &emm.next[*link];
+    }
+    *link = EMS_NO_PAGE;
+}
+
+// returns the pages of handle past the first keep to the free list
+static void emm_shrink(const uint8_t handle, const uint8_t keep) {
+    uint8_t *link = &emm.first[handle];
+    for (uint8_t i = 0; i < keep; i++) link = &emm.next[*link];
+    while (*link != EMS_NO_PAGE) {
+        const uint8_t page = *link;
+        *link = emm.next[page];
+        emm.next[page] = emm.free_first;
+        emm.free_first = page;
+        emm.free_count++;
+        emm.count[handle]--;
+    }
+}
+
+static uint8_t emm_allocate(const uint16_t count, const bool allow_zero) {
+    if (!count && !allow_zero) return 0x89;
+    if (count > EMS_PAGES) return 0x87;
+    if (count > emm.free_count) return 0x88;
+    for (uint8_t handle = 1; handle < EMS_HANDLES; handle++) {
+        if (!(emm.used >> handle & 1)) {
+            emm.used |= 1ull << handle;
+            memset(emm.names[handle], 0, 8);
+            emm_grow(handle, count);
+            CPU_DX = handle;
+            return 0;
+        }
+    }
+    return 0x85;
+}
+
+// value is the page for the board register, or FFFFh to unmap the window
+static void emm_window(const uint8_t window, const uint16_t value) {
+    if (value == 0xFFFF) {
+        emm.unmapped |= 1 << window;
+    } else {
+        emm.unmapped &= ~(1 << window);
+        ems_pages[window] = value;
+    }
+    memory_map_ems(window);
 }
 
-static INLINE uint32_t physical_address(const uint32_t address) {
-    const uint32_t page_addr = address & 0x3FFF;
-    const uint8_t selector = ems_pages[(address >> 14) & 3];
-    return selector * 0x4000 + page_addr;
+static INLINE uint16_t emm_window_value(const uint8_t window) {
+    return emm.unmapped >> window & 1 ? 0xFFFF : ems_pages[window];
 }
 
-static INLINE uint8_t ems_read(const uint32_t address) {
-    const uint32_t phys_addr = physical_address(address);
-    return butter_psram_size ? EMS[phys_addr] :
-     (PSRAM_AVAILABLE ? read8psram(phys_addr + EMS_PSRAM_OFFSET) : swap_read(phys_addr + EMS_PSRAM_OFFSET));
+static uint8_t emm_map(const uint16_t handle, const uint16_t logical, const uint16_t physical) {
+    if (!emm_valid(handle)) return 0x83;
+    if (physical >= 4) return 0x8B;
+    if (logical != 0xFFFF && logical >= emm.count[handle]) return 0x8A;
+    emm_window(physical, logical == 0xFFFF ? 0xFFFF : emm_page(handle, logical));
+    return 0;
 }
 
-// TODO: Overlap?
-static INLINE uint16_t ems_readw(const uint32_t address) {
-    const uint32_t phys_addr = physical_address(address);
-    return butter_psram_size ? (*(uint16_t *) &EMS[phys_addr]) :
-     (PSRAM_AVAILABLE ? read16psram(phys_addr + EMS_PSRAM_OFFSET) : swap_read16(phys_addr + EMS_PSRAM_OFFSET));
+// physical page of a page frame segment, 4 when there is none
+static uint16_t emm_physical(const uint16_t segment) {
+    if (segment < EMS_START >> 4 || segment >= EMS_END >> 4 || segment & 0x3FF) return 4;
+    return (segment - (EMS_START >> 4)) >> 10;
 }
 
-static INLINE uint32_t ems_readdw(const uint32_t address) {
-    const uint32_t phys_addr = physical_address(address);
-    return butter_psram_size ? (*(uint32_t *) &EMS[phys_addr]) :
-     (PSRAM_AVAILABLE ? read32psram(phys_addr + EMS_PSRAM_OFFSET) : swap_read32(phys_addr + EMS_PSRAM_OFFSET));
+// maps count {logical page, physical page or segment} pairs at address
+static uint8_t emm_map_list(const uint16_t handle, uint32_t address, uint16_t count, const bool segments) {
+    for (; count--; address += 4) {
+        const uint16_t physical = readw86(address + 2);
+        const uint8_t status = emm_map(handle, readw86(address), segments ? emm_physical(physical) : physical);
+        if (status) return status;
+    }
+    return 0;
 }
 
-static INLINE void ems_write(const uint32_t address, const uint8_t data) {
-    const uint32_t phys_addr = physical_address(address);
-    if (butter_psram_size)
-        EMS[phys_addr] = data;
-    else if (PSRAM_AVAILABLE)
-        write8psram(phys_addr + EMS_PSRAM_OFFSET, data);
-    else
-        swap_write(phys_addr + EMS_PSRAM_OFFSET, data);
+// page map save area, function 4Eh: the four windows as page numbers, FFFFh when unmapped
+#define EMM_MAP_SIZE 8
+
+static void emm_map_save(const uint32_t address) {
+    for (uint8_t window = 0; window < 4; window++) {
+        writew86(address + window * 2, emm_window_value(window));
+    }
+}
+
+static uint8_t emm_map_restore(const uint32_t address) {
+    uint16_t map[4];
+    for (uint8_t window = 0; window < 4; window++) {
+        map[window] = readw86(address + window * 2);
+        if (map[window] > 0xFF && map[window] != 0xFFFF) return 0xA3;
+    }
+    for (uint8_t window = 0; window < 4; window++) {
+        emm_window(window, map[window]);
+    }
+    return 0;
 }
 
+static void emm_push(const uint16_t value) {
+    CPU_SP -= 2;
+    writew86(emm_ptr(CPU_SS, CPU_SP), value);
+}
+
+static uint16_t emm_pop(void) {
+    const uint16_t value = readw86(emm_ptr(CPU_SS, CPU_SP));
+    CPU_SP += 2;
+    return value;
+}
 
-static INLINE void ems_writew(const uint32_t address, const uint16_t data) {
-    const uint32_t phys_addr = physical_address(address);
-    if (butter_psram_size)
-        *(uint16_t *) &EMS[phys_addr] = data;
-    else if (PSRAM_AVAILABLE)
-        write16psram(phys_addr + EMS_PSRAM_OFFSET, data);
-    else
-        swap_write16(phys_addr + EMS_PSRAM_OFFSET, data);
+// One side of a function 57h move: conventional memory from a linear address, or the pages of a
+// handle from logical page * 16K + offset, located one EMS page at a time
+static uint32_t emm_locate(const mem_side_t *side, const uint32_t pos, const bool write, mem_block_t *block) {
+    const uint32_t address = (uint32_t) emm_page(side->handle, pos >> 14) * 0x4000 + (pos & 0x3FFF);
+    if (mem_backend == MEM_BACKEND_OB) {
+        block->kind = MEM_BLOCK_HOST;
+        block->host = EMS + address;
+        return 0x4000;
+    }
+    block->address = EMS_PSRAM_OFFSET + address;
+    block->kind = mem_backend == MEM_BACKEND_MP ? MEM_BLOCK_PSRAM : MEM_BLOCK_SWAP;
+    return block->kind == MEM_BLOCK_SWAP ? SWAP_PAGE_SIZE : 0x4000;
 }
 
-static INLINE void ems_writedw(const uint32_t address, const uint32_t data) {
-    const uint32_t phys_addr = physical_address(address);
-    if (butter_psram_size)
-        *(uint32_t *) &EMS[phys_addr] = data;
-    else if (PSRAM_AVAILABLE)
-        write32psram(phys_addr + EMS_PSRAM_OFFSET, data);
-    else
-        swap_write32(phys_addr + EMS_PSRAM_OFFSET, data);
+// drops code predecoded from the bytes just written where a window shows them
+static void emm_written(const mem_side_t *side, const uint32_t pos, const uint32_t size) {
+    const uint32_t address = (uint32_t) emm_page(side->handle, pos >> 14) * 0x4000;
+    for (uint8_t window = 0; window < 4; window++) {
+        if (!(emm.unmapped >> window & 1) && ems_window_offset(window) == address) {
+            memory_invalidate(EMS_START + window * 0x4000 + (pos & 0x3FFF), size);
+        }
+    }
+}
+
+static uint8_t emm_side(const uint32_t address, mem_side_t *side, const uint32_t length) {
+    const uint8_t type = read86(address);
+    const uint16_t handle = readw86(address + 1), offset = readw86(address + 3), segment = readw86(address + 5);
+    if (type > 1) return 0x98;
+    if (!type) {
+        memory_side(side, emm_ptr(segment, offset));
+        return side->start + length > 0x100000 ? 0xA2 : 0;
+    }
+    if (!emm_valid(handle)) return 0x83;
+    if (offset >= 0x4000) return 0x95;
+    if (segment >= emm.count[handle]) return 0x8A;
+    side->handle = handle;
+    side->start = (uint32_t) segment * 0x4000 + offset;
+    side->locate = emm_locate;
+    side->written = emm_written;
+    return side->start + length > (uint32_t) emm.count[handle] * 0x4000 ? 0x93 : 0;
+}
+
+#define emm_expanded(side) ((side)->locate == emm_locate)
+
+// conventional side over a window that shows a page of the expanded one
+static bool emm_aliased(const mem_side_t *conventional, const mem_side_t *expanded, const uint32_t length) {
+    for (uint8_t window = 0; window < 4; window++) {
+        const uint32_t start = EMS_START + window * 0x4000;
+        if (emm.unmapped >> window & 1 || conventional->start >= start + 0x4000 || conventional->start + length <= start) continue;
+        uint8_t page = emm_page(expanded->handle, expanded->start >> 14);
+        for (uint32_t logical = expanded->start >> 14; logical <= (expanded->start + length - 1) >> 14; logical++) {
+            if (ems_window_offset(window) == page * 0x4000u) return true;
+            page = emm.next[page];
+        }
+    }
+    return false;
+}
+
+// Function 57h: DS:SI points to the length, then source and destination as type, handle,
+// offset, segment or logical page
+static uint8_t emm_move(const bool exchange) {
+    const uint32_t address = emm_ptr(CPU_DS, CPU_SI);
+    const uint32_t length = readw86(address) | (uint32_t) readw86(address + 2) << 16;
+    mem_side_t source, destination;
+    if (length > 0x100000) return 0x96;
+    uint8_t status = emm_side(address + 4, &source, length);
+    if (!status) status = emm_side(address + 11, &destination, length);
+    if (status || !length) return status;
+
+    bool backward = false;
+    if (emm_expanded(&source) == emm_expanded(&destination)) {
+        if ((!emm_expanded(&source) || source.handle == destination.handle) &&
+            source.start < destination.start + length && destination.start < source.start + length) {
+            if (exchange) return 0x97;
+            status = 0x92;
+            backward = destination.start > source.start;
+        }
+    } else if (emm_expanded(&source) ? emm_aliased(&destination, &source, length) : emm_aliased(&source, &destination, length)) {
+        return 0x94;
+    }
+    memory_move(&source, &destination, length, exchange, backward);
+    return status;
+}
+
+static void emm_name(const uint32_t address, char *name) {
+    for (uint8_t i = 0; i < 8; i++) name[i] = (char) read86(address + i);
+}
+
+static int emm_find(const char *name) {
+    for (uint8_t handle = 0; handle < EMS_HANDLES; handle++) {
+        if (emm_valid(handle) && !memcmp(emm.names[handle], name, 8)) return handle;
+    }
+    return -1;
+}
+
+void __not_in_flash() emm_handler() {
+    if (CPU_CS == EMM_ROM_SEG && ip == EMM_ROM_RETURN + 2) {
+        // the function called by 56h returned: map the old pages and go back to its caller
+        const uint16_t return_ip = emm_pop(), return_cs = emm_pop(), mode = emm_pop(), handle = emm_pop();
+        const uint16_t map_offset = emm_pop(), map_segment = emm_pop();
+        CPU_AH = emm_map_list(handle, emm_ptr(map_segment, map_offset), mode & 0xFF, mode >> 8);
+        ip = return_ip;
+        CPU_CS = return_cs;
+        return;
+    }
+
+    uint8_t status = 0;
+    switch (CPU_AH) {
+        case 0x40: // Get status
+            break;
+        case 0x41: // Get page frame address
+            CPU_BX = EMS_START >> 4;
+            break;
+        case 0x42: // Get unallocated page count
+            CPU_BX = emm.free_count;
+            CPU_DX = EMS_PAGES;
+            break;
+        case 0x43: // Allocate pages
+            status = emm_allocate(CPU_BX, false);
+            break;
+        case 0x44: // Map/unmap handle page
+            status = emm_map(CPU_DX, CPU_BX, CPU_AL);
+            break;
+        case 0x45: // Deallocate pages
+            if (!emm_valid(CPU_DX)) {
+                status = 0x83;
+            } else if (emm.saved >> CPU_DX & 1) {
+                status = 0x86;
+            } else {
+                emm_shrink(CPU_DX, 0);
+                memset(emm.names[CPU_DX], 0, 8);
+                if (CPU_DX) emm.used &= ~(1ull << CPU_DX);
+            }
+            break;
+        case 0x46: // Get version
+            CPU_AL = 0x40;
+            break;
+        case 0x47: // Save page map
+            if (!emm_valid(CPU_DX)) {
+                status = 0x83;
+            } else if (emm.saved >> CPU_DX & 1) {
+                status = 0x8D;
+            } else {
+                for (uint8_t window = 0; window < 4; window++) emm.saved_map[CPU_DX][window] = emm_window_value(window);
+                emm.saved |= 1ull << CPU_DX;
+            }
+            break;
+        case 0x48: // Restore page map
+            if (!emm_valid(CPU_DX)) {
+                status = 0x83;
+            } else if (!(emm.saved >> CPU_DX & 1)) {
+                status = 0x8E;
+            } else {
+                for (uint8_t window = 0; window < 4; window++) emm_window(window, emm.saved_map[CPU_DX][window]);
+                emm.saved &= ~(1ull << CPU_DX);
+            }
+            break;
+        case 0x4B: // Get handle count
+            CPU_BX = __builtin_popcountll(emm.used);
+            break;
+        case 0x4C: // Get handle pages
+            if (emm_valid(CPU_DX)) {
+                CPU_BX = emm.count[CPU_DX];
+            } else {
+                status = 0x83;
+            }
+            break;
+        case 0x4D: { // Get all handle pages
+            uint32_t address = emm_ptr(CPU_ES, CPU_DI);
+            CPU_BX = 0;
+            for (uint8_t handle = 0; handle < EMS_HANDLES; handle++) {
+                if (emm_valid(handle)) {
+                    writew86(address, handle);
+                    writew86(address + 2, emm.count[handle]);
+                    address += 4;
+                    CPU_BX++;
+                }
+            }
+            break;
+        }
+        case 0x4E: // Get/set page map
+            switch (CPU_AL) {
+                case 0:
+                    emm_map_save(emm_ptr(CPU_ES, CPU_DI));
+                    break;
+                case 1:
+                    status = emm_map_restore(emm_ptr(CPU_DS, CPU_SI));
+                    break;
+                case 2:
+                    emm_map_save(emm_ptr(CPU_ES, CPU_DI));
+                    status = emm_map_restore(emm_ptr(CPU_DS, CPU_SI));
+                    break;
+                case 3:
+                    CPU_AL = EMM_MAP_SIZE;
+                    break;
+                default:
+                    status = 0x8F;
+            }
+            break;
+        case 0x4F: // Get/set partial page map
+            switch (CPU_AL) {
+                case 0: {
+                    const uint32_t list = emm_ptr(CPU_DS, CPU_SI), map = emm_ptr(CPU_ES, CPU_DI);
+                    const uint16_t count = readw86(list);
+                    if (count > 4) {
+                        status = 0xA3;
+                        break;
+                    }
+                    writew86(map, count);
+                    for (uint16_t i = 0; i < count && !status; i++) {
+                        const uint16_t segment = readw86(list + 2 + i * 2), window = emm_physical(segment);
+                        if (window >= 4) {
+                            status = 0x8B;
+                        } else {
+                            writew86(map + 2 + i * 4, segment);
+                            writew86(map + 4 + i * 4, emm_window_value(window));
+                        }
+                    }
+                    break;
+                }
+                case 1: {
+                    const uint32_t map = emm_ptr(CPU_DS, CPU_SI);
+                    const uint16_t count = readw86(map);
+                    if (count > 4) {
+                        status = 0xA3;
+                        break;
+                    }
+                    for (uint16_t i = 0; i < count && !status; i++) {
+                        const uint16_t window = emm_physical(readw86(map + 2 + i * 4)), value = readw86(map + 4 + i * 4);
+                        if (window >= 4) {
+                            status = 0x8B;
+                        } else if (value > 0xFF && value != 0xFFFF) {
+                            status = 0xA3;
+                        } else {
+                            emm_window(window, value);
+                        }
+                    }
+                    break;
+                }
+                case 2:
+                    if (CPU_BX > 4) {
+                        status = 0x8B;
+                    } else {
+                        CPU_AL = 2 + CPU_BX * 4;
+                    }
+                    break;
+                default:
+                    status = 0x8F;
+            }
+            break;
+        case 0x50: // Map/unmap multiple handle pages
+            if (CPU_AL > 1) {
+                status = 0x8F;
+            } else {
+                status = emm_map_list(CPU_DX, emm_ptr(CPU_DS, CPU_SI), CPU_CX, CPU_AL);
+            }
+            break;
+        case 0x51: // Reallocate pages
+            if (!emm_valid(CPU_DX)) {
+                status = 0x83;
+            } else if (CPU_BX > EMS_PAGES) {
+                status = 0x87;
+            } else if (CPU_BX > emm.count[CPU_DX] + emm.free_count) {
+                status = 0x88;
+            } else if (CPU_BX > emm.count[CPU_DX]) {
+                emm_grow(CPU_DX, CPU_BX - emm.count[CPU_DX]);
+            } else {
+                emm_shrink(CPU_DX, CPU_BX);
+            }
+            if (emm_valid(CPU_DX)) CPU_BX = emm.count[CPU_DX];
+            break;
+        case 0x52: // Get/set handle attribute, only volatile handles
+            if (CPU_AL > 2) {
+                status = 0x8F;
+            } else if (CPU_AL != 2 && !emm_valid(CPU_DX)) {
+                status = 0x83;
+            } else if (CPU_AL == 1) {
+                status = CPU_BL ? 0x91 : 0;
+            } else {
+                CPU_AL = 0;
+            }
+            break;
+        case 0x53: // Get/set handle name
+            if (CPU_AL > 1) {
+                status = 0x8F;
+            } else if (!emm_valid(CPU_DX)) {
+                status = 0x83;
+            } else if (CPU_AL == 0) {
+                for (uint8_t i = 0; i < 8; i++) write86(emm_ptr(CPU_ES, CPU_DI) + i, emm.names[CPU_DX][i]);
+            } else {
+                char name[8];
+                emm_name(emm_ptr(CPU_DS, CPU_SI), name);
+                const int owner = emm_find(name);
+                if (owner >= 0 && owner != CPU_DX && memcmp(name, "\0\0\0\0\0\0\0\0", 8)) {
+                    status = 0xA1;
+                } else {
+                    memcpy(emm.names[CPU_DX], name, 8);
+                }
+            }
+            break;
+        case 0x54: // Get handle directory
+            switch (CPU_AL) {
+                case 0: {
+                    uint32_t address = emm_ptr(CPU_ES, CPU_DI);
+                    uint8_t count = 0;
+                    for (uint8_t handle = 0; handle < EMS_HANDLES; handle++) {
+                        if (!emm_valid(handle)) continue;
+                        writew86(address, handle);
+                        for (uint8_t i = 0; i < 8; i++) write86(address + 2 + i, emm.names[handle][i]);
+                        address += 10;
+                        count++;
+                    }
+                    CPU_AL = count;
+                    break;
+                }
+                case 1: {
+                    char name[8];
+                    emm_name(emm_ptr(CPU_DS, CPU_SI), name);
+                    const int handle = emm_find(name);
+                    if (!memcmp(name, "\0\0\0\0\0\0\0\0", 8)) {
+                        status = 0xA1;
+                    } else if (handle < 0) {
+                        status = 0xA0;
+                    } else {
+                        CPU_DX = handle;
+                    }
+                    break;
+                }
+                case 2:
+                    CPU_BX = EMS_HANDLES;
+                    break;
+                default:
+                    status = 0x8F;
+            }
+            break;
+        case 0x55: // Alter page map and jump
+        case 0x56: { // Alter page map and call
+            const uint32_t address = emm_ptr(CPU_DS, CPU_SI);
+            if (CPU_AH == 0x56 && CPU_AL == 2) {
+                CPU_BX = 16; // what the call pushes, see EMM_ROM_RETURN
+                break;
+            }
+            if (CPU_AL > 1) {
+                status = 0x8F;
+                break;
+            }
+            status = emm_map_list(CPU_DX, emm_ptr(readw86(address + 7), readw86(address + 5)), read86(address + 4), CPU_AL);
+            if (status) break;
+            if (CPU_AH == 0x56) {
+                emm_push(readw86(address + 12));
+                emm_push(readw86(address + 10));
+                emm_push(CPU_DX);
+                emm_push(CPU_AL << 8 | read86(address + 9));
+                emm_push(CPU_CS);
+                emm_push(ip);
+                emm_push(EMM_ROM_SEG);
+                emm_push(EMM_ROM_RETURN);
+            }
+            ip = readw86(address);
+            CPU_CS = readw86(address + 2);
+            break;
+        }
+        case 0x57: // Move/exchange memory region
+            status = CPU_AL > 1 ? 0x8F : emm_move(CPU_AL);
+            break;
+        case 0x58: // Get mappable physical address array
+            if (CPU_AL > 1) {
+                status = 0x8F;
+                break;
+            }
+            if (CPU_AL == 0) {
+                for (uint8_t window = 0; window < 4; window++) {
+                    writew86(emm_ptr(CPU_ES, CPU_DI) + window * 4, (EMS_START >> 4) + window * 0x400);
+                    writew86(emm_ptr(CPU_ES, CPU_DI) + window * 4 + 2, window);
+                }
+            }
+            CPU_CX = 4;
+            break;
+        case 0x59: // Get hardware configuration
+            if (emm.os_disabled) {
+                status = 0xA4;
+            } else if (CPU_AL == 0) {
+                const uint16_t config[5] = { 0x4000 >> 4, 0, EMM_MAP_SIZE, 0, 0 };
+                for (uint8_t i = 0; i < 5; i++) writew86(emm_ptr(CPU_ES, CPU_DI) + i * 2, config[i]);
+            } else if (CPU_AL == 1) {
+                // raw pages are the standard 16K ones
+                CPU_BX = emm.free_count;
+                CPU_DX = EMS_PAGES;
+            } else {
+                status = 0x8F;
+            }
+            break;
+        case 0x5A: // Allocate standard/raw pages
+            status = CPU_AL > 1 ? 0x8F : emm_allocate(CPU_BX, true);
+            break;
+        case 0x5B: // Alternate map register sets: set 0 only, kept in a guest save area
+            if (emm.os_disabled) {
+                status = 0xA4;
+                break;
+            }
+            switch (CPU_AL) {
+                case 0:
+                    if (emm.alt_map) emm_map_save(emm_ptr(emm.alt_map >> 16, emm.alt_map));
+                    CPU_ES = emm.alt_map >> 16;
+                    CPU_DI = emm.alt_map;
+                    CPU_BL = 0;
+                    break;
+                case 1:
+                    if (CPU_BL) {
+                        status = 0x9C;
+                        break;
+                    }
+                    emm.alt_map = (uint32_t) CPU_ES << 16 | CPU_DI;
+                    if (emm.alt_map) status = emm_map_restore(emm_ptr(CPU_ES, CPU_DI));
+                    break;
+                case 2:
+                    CPU_DX = EMM_MAP_SIZE;
+                    break;
+                case 3:
+                case 5:
+                    CPU_BL = 0; // none to hand out
+                    break;
+                case 4:
+                case 6:
+                case 7:
+                case 8:
+                    status = CPU_BL ? 0x9C : 0;
+                    break;
+                default:
+                    status = 0x8F;
+            }
+            break;
+        case 0x5C: // Prepare for warm boot
+            break;
+        case 0x5D: // Enable/disable OS/E functions
+            if (CPU_AL > 2) {
+                status = 0x8F;
+            } else if (!emm.access_key) {
+                // the first caller gets the key that later calls have to present
+                if (CPU_AL == 2) {
+                    status = 0xA4;
+                    break;
+                }
+                emm.access_key = EMM_ACCESS_KEY;
+                CPU_BX = emm.access_key >> 16;
+                CPU_CX = emm.access_key;
+                emm.os_disabled = CPU_AL;
+            } else if (CPU_BX != (uint16_t) (emm.access_key >> 16) || CPU_CX != (uint16_t) emm.access_key) {
+                status = 0xA4;
+            } else if (CPU_AL == 2) {
+                emm.access_key = 0;
+                emm.os_disabled = 0;
+            } else {
+                emm.os_disabled = CPU_AL;
+            }
+            break;
+        default:
+            status = 0x84;
+            break;
+    }
+    CPU_AH = status;
 }
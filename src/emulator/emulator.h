@@ -5,6 +5,7 @@
 #else
 #endif
 #include <stdint.h>
+#include <stdbool.h>
 #include "cpu.h"
 
 #ifdef __cplusplus
@@ -81,7 +82,11 @@ extern uint8_t HMA[HMA_END - HMA_START];
 // for non-butter-psram modes
 #define SRAM_BLOCK_SIZE 0x29800 // 168 KB  to free more momory for video buffer
 extern uint8_t SRAM[SRAM_BLOCK_SIZE];
+#if PICO_ON_DEVICE
 #define FIRST_RAM_PAGE (butter_psram_size ? RAM : SRAM)
+#else
+#define FIRST_RAM_PAGE (mem_backend == MEM_BACKEND_SW ? SRAM : RAM)
+#endif
 
 extern uint32_t dwordregs[8];
 #define byteregs ((uint8_t*)dwordregs)
@@ -119,6 +124,42 @@ typedef union {
 extern x86_flags_t x86_flags;
 extern uint32_t segregs32[6];
 
+// Event scheduler, one exec86 step counts as one emulated cycle
+#ifndef SCHED_CPU_HZ
+#define SCHED_CPU_HZ 16000000
+#endif
+#define SCHED_FRAC_BITS 16
+#define SCHED_FRAC_MASK ((1ull << SCHED_FRAC_BITS) - 1)
+// event period in scheduler units for a rate in Hz, or for a 1193182 Hz PIT count
+#define SCHED_HZ(hz) (((uint64_t) SCHED_CPU_HZ << SCHED_FRAC_BITS) / (hz))
+#define SCHED_PIT(count) (((uint64_t) SCHED_CPU_HZ << SCHED_FRAC_BITS) * (count) / 1193182)
+
+enum {
+    SCHED_PIT0,
+    SCHED_DSS,
+    SCHED_SB,
+    SCHED_AUDIO,
+    SCHED_BLINK,
+    SCHED_FRAME,
+    SCHED_EVENTS
+};
+
+extern uint64_t sched_now;  // emulated cycles since power on
+extern uint64_t sched_next; // exec86 calls sched_run() once sched_now reaches it
+extern uint32_t sched_due;  // the same deadline as a step count within the running exec86
+extern uint64_t sched_event_next; // earliest armed event, UINT64_MAX with nothing armed
+
+void sched_every(uint8_t event, uint64_t period, void (*handler)(void)); // period 0 disarms
+void sched_run(void);
+// something may have made an interrupt deliverable, have exec86 look at the i8259. The device
+// polls the i8259 every step instead: core 1 raises IRQ0 there, and the scheduler state must
+// only ever be written by core 0.
+#if PICO_ON_DEVICE
+#define sched_poke() ((void) 0)
+#else
+#define sched_poke() (sched_next = 0, sched_due = 0)
+#endif
+
 // i8259
 extern struct i8259_s {
     uint8_t interrupt_mask_register; //mask register
@@ -133,7 +174,11 @@ extern struct i8259_s {
     uint8_t controller_enabled;
 } i8259_controller;
 
-#define doirq(irqnum) (i8259_controller.interrupt_request_register |= (1 << (irqnum)) & (~i8259_controller.interrupt_mask_register))
+#if !PICO_ON_DEVICE
+extern uint32_t i8259_delivered[8]; // interrupts taken by the CPU per IRQ line
+#endif
+
+#define doirq(irqnum) (i8259_controller.interrupt_request_register |= (1 << (irqnum)) & (~i8259_controller.interrupt_mask_register), sched_poke())
 
 static inline uint8_t nextintr() {
     uint8_t tmpirr = i8259_controller.interrupt_request_register & (~i8259_controller.interrupt_mask_register); //XOR request register with inverted mask register
@@ -141,6 +186,9 @@ static inline uint8_t nextintr() {
         if ((tmpirr >> i) & 1) {
             i8259_controller.interrupt_request_register &= ~(1 << i);
             i8259_controller.in_service_register |= (1 << i);
+#if !PICO_ON_DEVICE
+            i8259_delivered[i]++;
+#endif
             return (i8259_controller.initialization_command_words[2] + i);
         }
     return 0;
@@ -203,27 +251,103 @@ extern read86dw_t readdw86;
 extern write86_t write86;
 extern write86w_t writew86;
 extern write86dw_t writedw86;
-// on-board (butter) psram
-void write86_ob(const uint32_t address, const uint8_t value);
-void writew86_ob(uint32_t address, uint16_t value);
-void writedw86_ob(uint32_t address, uint32_t value);
-uint8_t read86_ob(uint32_t address);
-uint16_t readw86_ob(uint32_t address);
-uint32_t readdw86_ob(uint32_t address);
-// murmulator-psram
-void write86_mp(const uint32_t address, const uint8_t value);
-void writew86_mp(uint32_t address, uint16_t value);
-void writedw86_mp(uint32_t address, uint32_t value);
-uint8_t read86_mp(uint32_t address);
-uint16_t readw86_mp(uint32_t address);
-uint32_t readdw86_mp(uint32_t address);
-// swap
-void write86_sw(const uint32_t address, const uint8_t value);
-void writew86_sw(uint32_t address, uint16_t value);
-void writedw86_sw(uint32_t address, uint32_t value);
-uint8_t read86_sw(uint32_t address);
-uint16_t readw86_sw(uint32_t address);
-uint32_t readdw86_sw(uint32_t address);
+// Memory map: 4 KB pages, each backed by host memory or routed to an MMIO handler
+#define MEM_PAGE_SHIFT 12
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define MEM_MAP_END (HMA_START + 0x10000)
+#define MEM_MAP_PAGES (MEM_MAP_END >> MEM_PAGE_SHIFT)
+
+typedef struct {
+    read86_t read8;
+    read86w_t read16;
+    read86dw_t read32;
+    write86_t write8;
+    write86w_t write16;
+    write86dw_t write32;
+} mem_handler_t;
+
+typedef struct {
+    uint8_t *rptr; // host memory for reads, NULL to use handler
+    uint8_t *wptr; // host memory for writes, NULL to use handler
+    const mem_handler_t *handler;
+    uint32_t base; // handler address of the first byte of the page
+    uint16_t frame; // page number of the memory backing this page
+} mem_page_t;
+
+extern mem_page_t mem_map[MEM_MAP_PAGES];
+
+// Predecoded instruction cache of 2^DECODE_CACHE_BITS entries, 0 disables it
+#ifndef DECODE_CACHE_BITS
+#if PICO_ON_DEVICE
+#define DECODE_CACHE_BITS 0
+#else
+#define DECODE_CACHE_BITS 14
+#endif
+#endif
+#if DECODE_CACHE_BITS
+// Write generations of 64-byte granules, bumped on every write to (or remap of) the
+// backing frame and used to invalidate predecoded code
+#define MEM_GEN_SHIFT 6
+#define MEM_GEN_INDEX(frame, offset) ((uint32_t) (frame) << (MEM_PAGE_SHIFT - MEM_GEN_SHIFT) | (offset) >> MEM_GEN_SHIFT)
+extern uint32_t mem_gen[MEM_MAP_END >> MEM_GEN_SHIFT];
+#endif
+
+#define MEM_BACKEND_OB 0 // on-board (butter) psram
+#define MEM_BACKEND_MP 1 // murmulator-psram
+#define MEM_BACKEND_SW 2 // swap
+extern uint8_t mem_backend;
+
+// selects the backend, installs the page table accessors and builds the map
+void memory_init(uint8_t backend);
+void memory_map_rebuild(void);
+// must be called after a20_enabled changes
+void memory_map_a20(void);
+// must be called after an EMS page register changes
+void memory_map_ems(uint8_t window);
+// must be called after guest memory was written bypassing write86
+void memory_invalidate(uint32_t address, uint32_t size);
+
+// Block moves between guest memory and the XMS / EMS stores (XMS function 0Bh, EMS function 57h).
+// A side maps positions to where the bytes live; locate returns the size of the aligned power of
+// two piece holding pos, inside which that mapping is linear.
+#define MEM_BLOCK_HOST 0  // host memory at host
+#define MEM_BLOCK_PSRAM 1 // psram at address
+#define MEM_BLOCK_SWAP 2  // swap at address
+#define MEM_BLOCK_BUS 3   // guest linear address, through read86 / write86
+
+typedef struct {
+    uint8_t kind;
+    uint8_t *host;
+    uint32_t address;
+} mem_block_t;
+
+typedef struct mem_side_s {
+    uint32_t start;
+    uint16_t handle;
+    uint32_t (*locate)(const struct mem_side_s *side, uint32_t pos, bool write, mem_block_t *block);
+    void (*written)(const struct mem_side_s *side, uint32_t pos, uint32_t size); // optional
+} mem_side_t;
+
+// guest memory from a linear address
+void memory_side(mem_side_t *side, uint32_t linear);
+// copies (or swaps) length bytes between the sides, from the end down when backward
+void memory_move(mem_side_t *source, mem_side_t *destination, uint32_t length, bool exchange, bool backward);
+
+// Code fetch window: host memory behind [fetch_lo, fetch_lo + fetch_size), the page code was last
+// fetched from. Guest writes land in the same host memory; remaps and swap evictions empty it.
+extern const uint8_t *fetch_ptr;
+extern uint32_t fetch_lo, fetch_size;
+uint8_t fetch86_miss(uint32_t address);
+uint16_t fetchw86_miss(uint32_t address);
+void fetch_window_flush(void);
+
+void write86_pt(uint32_t address, uint8_t value);
+void writew86_pt(uint32_t address, uint16_t value);
+void writedw86_pt(uint32_t address, uint32_t value);
+uint8_t read86_pt(uint32_t address);
+uint16_t readw86_pt(uint32_t address);
+uint32_t readdw86_pt(uint32_t address);
 
 // Ports
 void vga_portout(uint16_t portnum, uint16_t value);
@@ -234,15 +358,61 @@ extern uint16_t portin(uint16_t portnum);
 extern uint16_t portin16(uint16_t portnum);
 
 extern uint8_t port60, port61, port64;
+
+#if !PICO_ON_DEVICE
+// a guest write to port_watch (-1 for none) sets port_watch_hit, for the headless runner
+extern int32_t port_watch;
+extern uint8_t port_watch_hit;
+extern uint16_t port_watch_value;
+
+// images INT 19h attaches to fd0, fd1, hd0 and hd1, and the BIOS disk traffic per drive
+extern const char *disk_images[4];
+extern struct disk_io_s {
+    uint32_t reads, writes;
+    uint64_t sectors_read, sectors_written;
+} disk_io[4];
+#endif
 extern volatile uint8_t port3DA;
 extern uint32_t vram_offset;
 extern uint32_t tga_offset;
 
 // CPU
+#if DECODE_CACHE_BITS
+extern uint64_t decode_cache_hits, decode_cache_misses, decode_cache_uncached;
+void decode_cache_flush(void);
+#endif
+
 extern void exec86(uint32_t execloops);
 
+extern uint64_t cpu_idle_cycles; // steps skipped while the guest was halted or idle polling
+extern uint64_t cpu_extra_steps; // second steps of string elements, host builds only
+
 extern void reset86();
 
+// Machine-state snapshots (host builds). Every module lists its state in a *_snapshot() hook
+// through snapshot_blob(), which writes the bytes when saving and reads them back when
+// restoring; hooks fix up derived state when snapshot_loading is set.
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_TAG(a, b, c, d) ((uint32_t) (a) | (uint32_t) (b) << 8 | (uint32_t) (c) << 16 | (uint32_t) (d) << 24)
+extern uint8_t snapshot_loading;
+void snapshot_blob(uint32_t tag, void *data, uint32_t size);
+int snapshot_save(const char *path);
+int snapshot_load(const char *path);
+
+void cpu_snapshot(void);
+void fpu_snapshot(void);
+void memory_snapshot(void);
+void xms_snapshot(void);
+void i8259_snapshot(void);
+void i8253_snapshot(void);
+void ports_snapshot(void);
+void vga_snapshot(void);
+void cga_snapshot(void);
+void tga_snapshot(void);
+void mouse_snapshot(void);
+void sched_snapshot(void);
+void disks_snapshot(void);
+
 // i8253
     extern struct i8253_s {
         uint16_t channel_reload_value[3];     // chandata -> channel reload values (what gets loaded into counters)
@@ -254,6 +424,8 @@ extern void reset86();
         uint16_t channel_current_count[3];    // counter -> current counter value for each channel
     } i8253_controller;
 
+void init8253();
+
 void out8253(uint16_t portnum, uint8_t value);
 
 uint8_t in8253(uint16_t portnum);
@@ -287,6 +459,22 @@ extern void sn76489_reset();
 
 extern uint8_t xms_handler();
 
+// free space of the XMS and UMB allocators (KB), largest is the biggest block one request can get
+extern struct xms_stats_s {
+    uint32_t free, largest;
+    uint32_t umb_free, umb_largest;
+    uint32_t allocations, failures;
+    uint32_t grown_in_place, moved; // function 0Fh growing a block past its end / elsewhere
+} xms_stats;
+
+// INT 67h is served by emm_handler; the vector points at an EMMXXXX0 device header in the ROM page
+// at FC000 so that programs find the driver, with an INT 67h stub for those that far call it
+#define EMM_ROM_SEG 0xFC01
+#define EMM_ROM_ENTRY 0x0012
+#define EMM_ROM_RETURN 0x0015
+
+extern void emm_handler();
+
 //void i8237_writeport(uint16_t portnum, uint8_t value);
 //void i8237_writepage(uint16_t portnum, uint8_t value);
 
@@ -360,6 +548,52 @@ static INLINE int16_t speaker_sample() {
 }
 
 extern void get_sound_sample(int16_t other_sample, int16_t *samples);
+
+// Host renderers only redraw what changed: a bit per 1 << VIDEO_DIRTY_SHIFT words of VIDEORAM,
+// set by the writes and cleared by the renderer once a frame is drawn
+#ifndef VIDEO_DIRTY
+#define VIDEO_DIRTY (!PICO_ON_DEVICE)
+#endif
+#define VIDEO_DIRTY_SHIFT 5
+#if VIDEO_DIRTY
+extern uint32_t video_dirty[VIDEORAM_SIZE >> VIDEO_DIRTY_SHIFT >> 5];
+static INLINE void video_dirty_mark(const uint32_t index) {
+    const uint32_t block = (index & (VIDEORAM_SIZE - 1)) >> VIDEO_DIRTY_SHIFT;
+    video_dirty[block >> 5] |= 1u << (block & 31);
+}
+// any of count words from index (wrapping around VIDEORAM) written
+bool video_dirty_test(uint32_t index, uint32_t count);
+void video_dirty_set(void);
+void video_dirty_clear(void);
+#else
+#define video_dirty_mark(index) ((void) 0)
+#define video_dirty_set() ((void) 0)
+#endif
+
+// Host renderers read the 16 colour planar modes from a chunky copy of VIDEORAM: one palette
+// index byte per pixel, eight per word, leftmost first. Writes keep it current, so only the
+// words they touch get converted. 512 KB, more than a Pico has.
+#ifndef VGA_CHUNKY
+#define VGA_CHUNKY (!PICO_ON_DEVICE)
+#endif
+#if VGA_CHUNKY
+extern uint64_t vga_chunky[VIDEORAM_SIZE];
+// plane bit 7 - i to byte i
+static INLINE uint64_t vga_chunky_spread(const uint32_t plane) {
+    return (((plane & 0xFF) * 0x0101010101010101ull & 0x0102040810204080ull) + 0x7F7F7F7F7F7F7F7Full) >> 7 &
+           0x0101010101010101ull;
+}
+static INLINE void vga_chunky_update(const uint32_t index) {
+    const uint32_t planes = VIDEORAM[index & (VIDEORAM_SIZE - 1)];
+    vga_chunky[index & (VIDEORAM_SIZE - 1)] = vga_chunky_spread(planes) | vga_chunky_spread(planes >> 8) << 1 |
+                                              vga_chunky_spread(planes >> 16) << 2 | vga_chunky_spread(planes >> 24) << 3;
+}
+// after VIDEORAM changed behind the write handlers
+void vga_chunky_rebuild(void);
+#else
+#define vga_chunky_update(index) ((void) 0)
+#define vga_chunky_rebuild() ((void) 0)
+#endif
 #ifdef __cplusplus
 }
 #endif
@@ -16,8 +16,22 @@ struct i8253_s i8253_controller = { 0 };
 int speakerenabled = 0;
 int timer_period = 54925;
 
+// set by init8253: IRQ0 comes from the event scheduler instead of a host timer
+static int pit_scheduled = 0;
+
+static void pit_irq0(void) {
+    doirq(0);
+}
+
+static void pit_schedule(void) {
+    const uint32_t count = i8253_controller.channel_effective_count[0];
+    sched_every(SCHED_PIT0, SCHED_PIT(count ? count : 65536), pit_irq0);
+}
+
 void init8253() {
     memset(&i8253_controller, 0, sizeof(i8253_controller));
+    pit_scheduled = 1;
+    pit_schedule();
 }
 
 void out8253(uint16_t portnum, uint8_t value) {
@@ -77,6 +91,9 @@ void out8253(uint16_t portnum, uint8_t value) {
 #else
             timer_period = i8253_controller.channel_frequency[portnum];
 #endif
+            if (pit_scheduled) {
+                pit_schedule();
+            }
         }
     } else { // portnum == 3: mode/command
         const uint8_t channel = value >> 6;
@@ -121,4 +138,15 @@ uint8_t in8253(uint16_t portnum) {
     }
     
     return 0;
-}
\ No newline at end of file
+}
+
+#if !PICO_ON_DEVICE
+void i8253_snapshot(void) {
+    snapshot_blob(SNAPSHOT_TAG('P', 'I', 'T', ' '), &i8253_controller, sizeof(i8253_controller));
+    snapshot_blob(SNAPSHOT_TAG('P', 'I', 'T', 'P'), &timer_period, sizeof(timer_period));
+    snapshot_blob(SNAPSHOT_TAG('S', 'P', 'K', 'R'), &speakerenabled, sizeof(speakerenabled));
+    if (snapshot_loading && pit_scheduled) {
+        pit_schedule();
+    }
+}
+#endif
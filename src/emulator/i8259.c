@@ -9,6 +9,10 @@ struct i8259_s i8259_controller = {
         .interrupt_vector_offset = 8
 };
 
+#if !PICO_ON_DEVICE
+uint32_t i8259_delivered[8] = { 0 };
+#endif
+
 uint8_t in8259(uint16_t port_number) {
 #ifdef DEBUG_PIC
     debug_log(DEBUG_DETAIL, "[I8259] Read port 0x%X\n", port_number);
@@ -100,4 +104,14 @@ void out8259(uint16_t port_number, uint8_t register_value) {
             }
             break;
     }
-}
\ No newline at end of file
+    sched_poke();
+}
+
+#if !PICO_ON_DEVICE
+void i8259_snapshot(void) {
+    snapshot_blob(SNAPSHOT_TAG('P', 'I', 'C', ' '), &i8259_controller, sizeof(i8259_controller));
+    if (snapshot_loading) {
+        sched_poke();
+    }
+}
+#endif
@@ -1,11 +1,11 @@
 #pragma GCC optimize("Ofast")
 
+#include <string.h>
 #include "includes/bios.h"
 #include "emulator.h"
 #include "ems.c.inl"
 #if PICO_ON_DEVICE
 #include "psram_spi.h"
-#include "swap.h"
 #endif
 uint32_t __attribute__((aligned (4)))  VIDEORAM[VIDEORAM_SIZE] = {0};
 #if PICO_ON_DEVICE
@@ -27,587 +27,667 @@ write86_t write86;
 write86w_t writew86;
 write86dw_t writedw86;
 
-// Writes a byte to the virtual memory
-void write86_ob(const uint32_t address, const uint8_t value) {
-    if (address < RAM_SIZE) {
-        RAM[address] = value;
-    } else if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-        // printf("video write %x traddr %x =  %x\n", address, (address - VIDEORAM_START) & VIDEORAM_MASK, value);
-        vga_mem_write(address, value);
-        // VIDEORAM[(address - VIDEORAM_START) & VIDEORAM_MASK] = value;
-    } else if (address >= EMS_START && address < EMS_END) {
-        ems_write(address - EMS_START, value);
-    } else if (address >= UMB_START && address < UMB_END) {
-        UMB[address - UMB_START] = value;
-    } else if (address >= HMA_START && address < HMA_END) {
-        if (a20_enabled) {
-            HMA[address - HMA_START] = value;
-        } else {
-            RAM[address - HMA_START] = value;
-        }
-    } else if (!a20_enabled && address >= HMA_END) {
-        write86(address - HMA_START, value);
-    }
+mem_page_t mem_map[MEM_MAP_PAGES];
+const uint8_t *fetch_ptr;
+uint32_t fetch_lo, fetch_size;
+#if DECODE_CACHE_BITS
+uint32_t mem_gen[MEM_MAP_END >> MEM_GEN_SHIFT];
+#endif
+uint8_t mem_backend = MEM_BACKEND_OB;
+
+_Static_assert((RAM_SIZE & MEM_PAGE_MASK) == 0, "RAM_SIZE must be page aligned");
+
+static INLINE uint16_t load16(const uint8_t *p) {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return v;
 }
 
-// Writes a word to the virtual memory
-void writew86_ob(const uint32_t address, const uint16_t value) {
-    if (address & 1) {
-        write86(address, (uint8_t) (value & 0xFF));
-        write86(address + 1, (uint8_t) ((value >> 8) & 0xFF));
-    } else {
-        if (address < RAM_SIZE) {
-            *(uint16_t *) &RAM[address] = value;
-        } else if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-            vga_mem_write16(address, value);
-        } else if (address >= EMS_START && address < EMS_END) {
-            ems_writew(address - EMS_START, value);
-        } else if (address >= UMB_START && address < UMB_END) {
-            *(uint16_t *) &UMB[address - UMB_START] = value;
-        } else if (address >= HMA_START && address < HMA_END) {
-            if (a20_enabled) {
-                *(uint16_t *) &HMA[address - HMA_START] = value;
-            } else {
-                *(uint16_t *) &RAM[address - HMA_START] = value;
-            }
-        } else if (!a20_enabled && address >= HMA_END) {
-            writew86(address - HMA_START, value);
-        }
-    }
+static INLINE uint32_t load32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
 }
 
-void writedw86_ob(const uint32_t address, const uint32_t value) {
-    if (address & 1) {
-        write86(address, (uint8_t) (value & 0xFF));
-        write86(address + 1, (uint8_t) ((value >> 8) & 0xFF));
-        write86(address + 2, (uint8_t) ((value >> 16) & 0xFF));
-        write86(address + 3, (uint8_t) ((value >> 24) & 0xFF));
-    } else {
-        if (address < RAM_SIZE) {
-            *(uint32_t *) &RAM[address] = value;
-        } else if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-            write86(address, (uint8_t) (value & 0xFF));
-            write86(address + 1, (uint8_t) ((value >> 8) & 0xFF));
-            write86(address + 2, (uint8_t) ((value >> 16) & 0xFF));
-            write86(address + 3, (uint8_t) ((value >> 24) & 0xFF));
-        } else if (address >= EMS_START && address < EMS_END) {
-            ems_writedw(address - EMS_START, value);
-        } else if (address >= UMB_START && address < UMB_END) {
-            *(uint32_t *) &UMB[address - UMB_START] = value;
-        } else if (address >= HMA_START && address < HMA_END) {
-            if (a20_enabled) {
-                *(uint32_t *) &HMA[address - HMA_START] = value;
-            } else {
-                *(uint32_t *) &RAM[address - HMA_START] = value;
-            }
-        } else if (!a20_enabled && address >= HMA_END) {
-            writedw86(address - HMA_START, value);
-        }
-    }
+static INLINE void store16(uint8_t *p, const uint16_t v) {
+    memcpy(p, &v, 2);
 }
 
-// Reads a byte from the virtual memory
-uint8_t read86_ob(const uint32_t address) {
-    if (address < RAM_SIZE) {
-        return RAM[address];
-    }
-    if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-        return vga_mem_read(address);
-    }
-     // if (address >= VBIOS_START && address < VBIOS_END) {
-         // return VGABIOS[address - VBIOS_START];
-     // }
-    if (address >= EMS_START && address < EMS_END) {
-        return ems_read(address - EMS_START);
-    }
-    if (address >= UMB_START && address < UMB_END) {
-        return UMB[address - UMB_START];
-    }
-    if (address == 0xFC000) {
-        return 0x21;
-    }
-    if (address >= BIOS_START && address < HMA_START) {
-        return BIOS[address - BIOS_START];
-    }
-    if (address >= HMA_START && address < HMA_END) {
-        if (a20_enabled) {
-            return HMA[address - HMA_START];
-        }
-        return RAM[address - HMA_START];
-    }
-    if (!a20_enabled && address >= HMA_END) {
-        return read86(address - HMA_START);
-    }
+static INLINE void store32(uint8_t *p, const uint32_t v) {
+    memcpy(p, &v, 4);
+}
+
+// Unmapped space: reads float high, writes are dropped
+static uint8_t open_bus_read(const uint32_t address) {
     return 0xFF;
 }
 
-// Reads a word from the virtual memory
-uint16_t readw86_ob(const uint32_t address) {
-    if (address & 1) {
-        return (uint16_t) read86(address) | ((uint16_t) read86(address + 1) << 8);
-    }
-    if (address < RAM_SIZE) {
-        return *(uint16_t *) &RAM[address];
-    }
-    if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-        return  vga_mem_read16(address);
-    }
-    // if (address >= VBIOS_START && address < VBIOS_END) {
-        // return *(uint16_t *) &VGABIOS[address - VBIOS_START];
-    // }
-    if (address >= EMS_START && address < EMS_END) {
-        return ems_readw(address - EMS_START);
-    }
-    if (address >= UMB_START && address < UMB_END) {
-        return *(uint16_t *) &UMB[address - UMB_START];
-    }
-    if (address >= BIOS_START && address < HMA_START) {
-        return *(uint16_t *) &BIOS[address - BIOS_START];
-    }
-    if (address >= HMA_START && address < HMA_END) {
-        if (a20_enabled) {
-            return *(uint16_t *) &HMA[address - HMA_START];
-        }
-        return *(uint16_t *) &RAM[address - HMA_START];
-    }
-    if (!a20_enabled && address >= HMA_END) {
-        return readw86(address - HMA_START);
-    }
+static uint16_t open_bus_readw(const uint32_t address) {
     return 0xFFFF;
 }
 
-uint32_t readdw86_ob(const uint32_t address) {
-    if (address & 3) {
-        return (uint32_t) read86(address)
-               | ((uint32_t) read86(address + 1) << 8)
-               | ((uint32_t) read86(address + 2) << 16)
-               | ((uint32_t) read86(address + 3) << 24);
-    }
-    if (address < RAM_SIZE) {
-        return *(uint32_t *) &RAM[address];
-    }
-    if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-        return (uint32_t) read86(address)
-               | ((uint32_t) read86(address + 1) << 8)
-               | ((uint32_t) read86(address + 2) << 16)
-               | ((uint32_t) read86(address + 3) << 24);
-    }
-    if (address >= EMS_START && address < EMS_END) {
-        return ems_readdw(address - EMS_START);
-    }
-    if (address >= UMB_START && address < UMB_END) {
-        return *(uint32_t *) &UMB[address - UMB_START];
-    }
-    if (address >= BIOS_START && address < HMA_START) {
-        return *(uint32_t *) &BIOS[address - BIOS_START];
-    }
-    if (address >= HMA_START && address < HMA_END) {
-        if (a20_enabled) {
-            return *(uint32_t *) &HMA[address - HMA_START];
-        }
-        return *(uint32_t *) &RAM[address - HMA_START];
-    }
-    if (!a20_enabled && address >= HMA_END) {
-        return readdw86(address - HMA_START);
-    }
+static uint32_t open_bus_readdw(const uint32_t address) {
     return 0xFFFFFFFF;
 }
 
+static void open_bus_write(const uint32_t address, const uint8_t value) {
+}
+
+static void open_bus_writew(const uint32_t address, const uint16_t value) {
+}
+
+static void open_bus_writedw(const uint32_t address, const uint32_t value) {
+}
+
+static const mem_handler_t open_bus_handler = {
+    open_bus_read, open_bus_readw, open_bus_readdw,
+    open_bus_write, open_bus_writew, open_bus_writedw,
+};
+
+// Single byte at FC000 and the EMM stub at EMM_ROM_SEG, the rest of the page is open bus
+static uint8_t rom_id_read(const uint32_t address) {
+    const uint32_t offset = address - EMM_ROM_SEG * 16;
+    if (offset < sizeof(ems_rom)) return ems_rom[offset];
+    return address == 0xFC000 ? 0x21 : 0xFF;
+}
+
+static uint16_t rom_id_readw(const uint32_t address) {
+    return rom_id_read(address) | rom_id_read(address + 1) << 8;
+}
+
+static uint32_t rom_id_readdw(const uint32_t address) {
+    return rom_id_readw(address) | (uint32_t) rom_id_readw(address + 2) << 16;
+}
+
+static const mem_handler_t rom_id_handler = {
+    rom_id_read, rom_id_readw, rom_id_readdw,
+    open_bus_write, open_bus_writew, open_bus_writedw,
+};
+
+static uint32_t vga_mem_read32(const uint32_t address) {
+    return (uint32_t) vga_mem_read(address)
+           | ((uint32_t) vga_mem_read(address + 1) << 8)
+           | ((uint32_t) vga_mem_read(address + 2) << 16)
+           | ((uint32_t) vga_mem_read(address + 3) << 24);
+}
+
+static void vga_mem_write32(const uint32_t address, const uint32_t value) {
+    vga_mem_write(address, (uint8_t) (value & 0xFF));
+    vga_mem_write(address + 1, (uint8_t) ((value >> 8) & 0xFF));
+    vga_mem_write(address + 2, (uint8_t) ((value >> 16) & 0xFF));
+    vga_mem_write(address + 3, (uint8_t) ((value >> 24) & 0xFF));
+}
+
+static const mem_handler_t vga_handler = {
+    vga_mem_read, vga_mem_read16, vga_mem_read32,
+    vga_mem_write, vga_mem_write16, vga_mem_write32,
+};
+
+static const mem_handler_t swap_handler = {
+    swap_read, swap_read16, swap_read32,
+    swap_write, swap_write16, swap_write32,
+};
+
 #if PICO_ON_DEVICE
 // using UMB as low-RAM, and psram start space as UMB instead
 #define LO_MEM (SRAM_BLOCK_SIZE)
-#define RAM (DO_NOT_USE_IN_THIS_BLOCK)
-#define HMA (DO_NOT_USE_IN_THIS_BLOCK)
-#define UMB (DO_NOT_USE_IN_THIS_BLOCK)
 
-// Writes a byte to the virtual memory
-void write86_mp(const uint32_t address, const uint8_t value) {
-    if (address < LO_MEM) {
-        SRAM[address] = value;
-    } else if (address < VIDEORAM_START) {
-        write8psram(address, value);
-    } else if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-        // printf("video write %x traddr %x =  %x\n", address, (address - VIDEORAM_START) & VIDEORAM_MASK, value);
-        vga_mem_write(address, value);
-        // VIDEORAM[(address - VIDEORAM_START) & VIDEORAM_MASK] = value;
-    } else if (address >= EMS_START && address < EMS_END) {
-        ems_write(address - EMS_START, value);
-    } else if (address >= UMB_START && address < UMB_END) {
-        write8psram(address - UMB_START, value);
-    } else if (address >= HMA_START && address < HMA_END) {
-        if (a20_enabled) {
-            write8psram(address, value);
-        } else {
-            SRAM[address - HMA_START] = value;
-        }
-    } else if (!a20_enabled && address >= HMA_END) {
-        write86(address - HMA_START, value);
-    }
+// psram accessors are macros on the device, so wrap them for the handler table
+static uint8_t mp_read(const uint32_t address) {
+    return read8psram(address);
 }
 
-// Writes a word to the virtual memory
-void writew86_mp(const uint32_t address, const uint16_t value) {
-    if (address & 1) {
-        write86(address, (uint8_t) (value & 0xFF));
-        write86(address + 1, (uint8_t) ((value >> 8) & 0xFF));
-    } else {
-        if (address < LO_MEM) {
-            *(uint16_t *) &SRAM[address] = value;
-        } else if (address < VIDEORAM_START) {
-            write16psram(address, value);
-        } else if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-            write86(address, (uint8_t) (value & 0xFF));
-            write86(address + 1, (uint8_t) ((value >> 8) & 0xFF));
-        } else if (address >= EMS_START && address < EMS_END) {
-            ems_writew(address - EMS_START, value);
-        } else if (address >= UMB_START && address < UMB_END) {
-            write16psram(address - UMB_START, value);
-        } else if (address >= HMA_START && address < HMA_END) {
-            if (a20_enabled) {
-                write16psram(address, value);
-            } else {
-                *(uint16_t *) &SRAM[address - HMA_START] = value;
-            }
-        } else if (!a20_enabled && address >= HMA_END) {
-            writew86(address - HMA_START, value);
-        }
-    }
+static uint16_t mp_readw(const uint32_t address) {
+    return read16psram(address);
 }
 
-void writedw86_mp(const uint32_t address, const uint32_t value) {
-    if (address & 1) {
-        write86(address, (uint8_t) (value & 0xFF));
-        write86(address + 1, (uint8_t) ((value >> 8) & 0xFF));
-        write86(address + 2, (uint8_t) ((value >> 16) & 0xFF));
-        write86(address + 3, (uint8_t) ((value >> 24) & 0xFF));
-    } else {
-        if (address < LO_MEM) {
-            *(uint32_t *) &SRAM[address] = value;
-        } else if (address < VIDEORAM_START) {
-            write32psram(address, value);
-        } else if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-            write86(address, (uint8_t) (value & 0xFF));
-            write86(address + 1, (uint8_t) ((value >> 8) & 0xFF));
-            write86(address + 2, (uint8_t) ((value >> 16) & 0xFF));
-            write86(address + 3, (uint8_t) ((value >> 24) & 0xFF));
-        } else if (address >= EMS_START && address < EMS_END) {
-            ems_writedw(address - EMS_START, value);
-        } else if (address >= UMB_START && address < UMB_END) {
-            write32psram(address - UMB_START, value);
-        } else if (address >= HMA_START && address < HMA_END) {
-            if (a20_enabled) {
-                write32psram(address, value);
-            } else {
-                *(uint32_t *) &SRAM[address - HMA_START] = value;
-            }
-        } else if (!a20_enabled && address >= HMA_END) {
-            writedw86(address - HMA_START, value);
-        }
-    }
+static uint32_t mp_readdw(const uint32_t address) {
+    return read32psram(address);
 }
 
-// Reads a byte from the virtual memory
-uint8_t read86_mp(const uint32_t address) {
-    if (address < LO_MEM) {
-        return SRAM[address];
-    }
-    if (address < VIDEORAM_START) {
-        return read8psram(address);
-    }
-    if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-        return vga_mem_read(address);
-    }
-     // if (address >= VBIOS_START && address < VBIOS_END) {
-         // return VGABIOS[address - VBIOS_START];
-     // }
-    if (address >= EMS_START && address < EMS_END) {
-        return ems_read(address - EMS_START);
-    }
-    if (address >= UMB_START && address < UMB_END) {
-        return read8psram(address - UMB_START);
-    }
-    if (address == 0xFC000) {
-        return 0x21;
-    }
-    if (address >= BIOS_START && address < HMA_START) {
-        return BIOS[address - BIOS_START];
-    }
-    if (address >= HMA_START && address < HMA_END) {
-        if (a20_enabled) {
-            return read8psram(address);
-        }
-        return SRAM[address - HMA_START];
+static void mp_write(const uint32_t address, const uint8_t value) {
+    write8psram(address, value);
+}
+
+static void mp_writew(const uint32_t address, const uint16_t value) {
+    write16psram(address, value);
+}
+
+static void mp_writedw(const uint32_t address, const uint32_t value) {
+    write32psram(address, value);
+}
+
+static const mem_handler_t psram_handler = {
+    mp_read, mp_readw, mp_readdw,
+    mp_write, mp_writew, mp_writedw,
+};
+
+// The page holding LO_MEM is split between SRAM and murmulator-psram
+static uint8_t lo_mem_read(const uint32_t address) {
+    return address < LO_MEM ? SRAM[address] : read8psram(address);
+}
+
+static uint16_t lo_mem_readw(const uint32_t address) {
+    return address < LO_MEM ? *(uint16_t *) &SRAM[address] : read16psram(address);
+}
+
+static uint32_t lo_mem_readdw(const uint32_t address) {
+    return address < LO_MEM ? *(uint32_t *) &SRAM[address] : read32psram(address);
+}
+
+static void lo_mem_write(const uint32_t address, const uint8_t value) {
+    if (address < LO_MEM) SRAM[address] = value; else write8psram(address, value);
+}
+
+static void lo_mem_writew(const uint32_t address, const uint16_t value) {
+    if (address < LO_MEM) *(uint16_t *) &SRAM[address] = value; else write16psram(address, value);
+}
+
+static void lo_mem_writedw(const uint32_t address, const uint32_t value) {
+    if (address < LO_MEM) *(uint32_t *) &SRAM[address] = value; else write32psram(address, value);
+}
+
+static const mem_handler_t lo_mem_handler = {
+    lo_mem_read, lo_mem_readw, lo_mem_readdw,
+    lo_mem_write, lo_mem_writew, lo_mem_writedw,
+};
+#endif
+
+// Last HMA page with A20 on: the 16 bytes past HMA_END are unmapped
+static uint8_t hma_tail_read(const uint32_t address) {
+    if (address >= HMA_END) return 0xFF;
+#if PICO_ON_DEVICE
+    if (mem_backend == MEM_BACKEND_MP) return read8psram(address);
+#endif
+    if (mem_backend == MEM_BACKEND_SW) return swap_read(address);
+    return HMA[address - HMA_START];
+}
+
+static uint16_t hma_tail_readw(const uint32_t address) {
+    if (address >= HMA_END) return 0xFFFF;
+#if PICO_ON_DEVICE
+    if (mem_backend == MEM_BACKEND_MP) return read16psram(address);
+#endif
+    if (mem_backend == MEM_BACKEND_SW) return swap_read16(address);
+    return *(uint16_t *) &HMA[address - HMA_START];
+}
+
+static uint32_t hma_tail_readdw(const uint32_t address) {
+    if (address >= HMA_END) return 0xFFFFFFFF;
+#if PICO_ON_DEVICE
+    if (mem_backend == MEM_BACKEND_MP) return read32psram(address);
+#endif
+    if (mem_backend == MEM_BACKEND_SW) return swap_read32(address);
+    return *(uint32_t *) &HMA[address - HMA_START];
+}
+
+static void hma_tail_write(const uint32_t address, const uint8_t value) {
+    if (address >= HMA_END) return;
+#if PICO_ON_DEVICE
+    if (mem_backend == MEM_BACKEND_MP) {
+        write8psram(address, value);
+        return;
     }
-    if (!a20_enabled && address >= HMA_END) {
-        return read86_mp(address - HMA_START);
+#endif
+    if (mem_backend == MEM_BACKEND_SW) {
+        swap_write(address, value);
+        return;
     }
-    return 0xFF;
+    HMA[address - HMA_START] = value;
 }
 
-// Reads a word from the virtual memory
-uint16_t readw86_mp(const uint32_t address) {
-    if (address & 1) {
-        return (uint16_t) read86_mp(address) | ((uint16_t) read86_mp(address + 1) << 8);
-    }
-    if (address < LO_MEM) {
-        return *(uint16_t *) &SRAM[address];
+static void hma_tail_writew(const uint32_t address, const uint16_t value) {
+    if (address >= HMA_END) return;
+#if PICO_ON_DEVICE
+    if (mem_backend == MEM_BACKEND_MP) {
+        write16psram(address, value);
+        return;
     }
-    if (address < VIDEORAM_START) {
-        return read16psram(address);
+#endif
+    if (mem_backend == MEM_BACKEND_SW) {
+        swap_write16(address, value);
+        return;
     }
-    if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-        return (uint16_t) read86_mp(address) | ((uint16_t) read86_mp(address + 1) << 8);
+    *(uint16_t *) &HMA[address - HMA_START] = value;
+}
+
+static void hma_tail_writedw(const uint32_t address, const uint32_t value) {
+    if (address >= HMA_END) return;
+#if PICO_ON_DEVICE
+    if (mem_backend == MEM_BACKEND_MP) {
+        write32psram(address, value);
+        return;
     }
-    // if (address >= VBIOS_START && address < VBIOS_END) {
-        // return *(uint16_t *) &VGABIOS[address - VBIOS_START];
-    // }
-    if (address >= EMS_START && address < EMS_END) {
-        return ems_readw(address - EMS_START);
+#endif
+    if (mem_backend == MEM_BACKEND_SW) {
+        swap_write32(address, value);
+        return;
     }
-    if (address >= UMB_START && address < UMB_END) {
-        return read16psram(address - UMB_START);
+    *(uint32_t *) &HMA[address - HMA_START] = value;
+}
+
+static const mem_handler_t hma_tail_handler = {
+    hma_tail_read, hma_tail_readw, hma_tail_readdw,
+    hma_tail_write, hma_tail_writew, hma_tail_writedw,
+};
+
+static void invalidate_frame(const uint16_t frame) {
+#if DECODE_CACHE_BITS
+    for (uint32_t i = MEM_GEN_INDEX(frame, 0); i <= MEM_GEN_INDEX(frame, MEM_PAGE_MASK); i++) {
+        mem_gen[i]++;
     }
-    if (address >= BIOS_START && address < HMA_START) {
-        return *(uint16_t *) &BIOS[address - BIOS_START];
+#endif
+}
+
+void fetch_window_flush(void) {
+    fetch_size = 0;
+}
+
+// Maps [start, end) either to host memory (rptr/wptr point to the byte at start) or to a handler
+static void map_pages(const uint32_t start, const uint32_t end, uint8_t *rptr, uint8_t *wptr,
+                      const mem_handler_t *handler, const uint32_t base) {
+    fetch_window_flush();
+    for (uint32_t address = start; address < end; address += MEM_PAGE_SIZE) {
+        mem_page_t *page = &mem_map[address >> MEM_PAGE_SHIFT];
+        const uint32_t offset = address - start;
+        invalidate_frame(page->frame);
+        page->frame = address >> MEM_PAGE_SHIFT;
+        page->rptr = rptr ? rptr + offset : NULL;
+        page->wptr = wptr ? wptr + offset : NULL;
+        page->handler = handler;
+        page->base = base + offset;
     }
-    if (address >= HMA_START && address < HMA_END) {
-        if (a20_enabled) {
-            return read16psram(address);
+}
+
+// EMS windows go straight to the backing store: host memory for the page table fast path, or the
+// psram / swap handler at the page's offset past EMS_PSRAM_OFFSET
+void memory_map_ems(const uint8_t window) {
+    const uint32_t start = EMS_START + (window & 3) * 0x4000;
+    const uint32_t offset = ems_window_offset(window);
+    if (emm.unmapped >> (window & 3) & 1) {
+        map_pages(start, start + 0x4000, NULL, NULL, &open_bus_handler, start);
+        return;
+    }
+    switch (mem_backend) {
+#if PICO_ON_DEVICE
+        case MEM_BACKEND_MP:
+            map_pages(start, start + 0x4000, NULL, NULL, &psram_handler, offset + EMS_PSRAM_OFFSET);
+            break;
+#endif
+        case MEM_BACKEND_SW:
+            map_pages(start, start + 0x4000, NULL, NULL, &swap_handler, offset + EMS_PSRAM_OFFSET);
+            break;
+        default:
+            map_pages(start, start + 0x4000, EMS + offset, EMS + offset, &open_bus_handler, offset);
+            break;
+    }
+#if DECODE_CACHE_BITS
+    // Two windows showing the same page share frames, so that a write through either one drops
+    // code predecoded from the other
+    for (uint8_t other = 0; other < 4; other++) {
+        if (other != (window & 3) && !(emm.unmapped >> other & 1) && ems_window_offset(other) == offset) {
+            for (uint32_t i = 0; i < 0x4000 >> MEM_PAGE_SHIFT; i++) {
+                mem_map[(start >> MEM_PAGE_SHIFT) + i].frame = mem_map[((EMS_START + other * 0x4000) >> MEM_PAGE_SHIFT) + i].frame;
+            }
+            break;
         }
-        return *(uint16_t *) &SRAM[address - HMA_START];
     }
-    if (!a20_enabled && address >= HMA_END) {
-        return readw86_mp(address - HMA_START);
-    }
-    return 0xFFFF;
+#endif
 }
 
-uint32_t readdw86_mp(const uint32_t address) {
-    if (address & 3) {
-        return (uint32_t) read86_mp(address)
-               | ((uint32_t) read86_mp(address + 1) << 8)
-               | ((uint32_t) read86_mp(address + 2) << 16)
-               | ((uint32_t) read86_mp(address + 3) << 24);
+void memory_invalidate(const uint32_t address, const uint32_t size) {
+#if DECODE_CACHE_BITS
+    if (!size) return;
+    for (uint32_t a = address & ~((1u << MEM_GEN_SHIFT) - 1); a < address + size && a < MEM_MAP_END; a += 1u << MEM_GEN_SHIFT) {
+        mem_gen[MEM_GEN_INDEX(mem_map[a >> MEM_PAGE_SHIFT].frame, a & MEM_PAGE_MASK)]++;
     }
-    if (address < LO_MEM) {
-        return *(uint32_t *) &SRAM[address];
-    }
-    if (address < VIDEORAM_START) {
-        return read32psram(address);
+#endif
+}
+
+static uint32_t guest_locate(const mem_side_t *side, const uint32_t pos, const bool write, mem_block_t *block) {
+    const mem_page_t *page = &mem_map[pos >> MEM_PAGE_SHIFT];
+    uint8_t *host = write ? page->wptr : page->rptr;
+    if (host) {
+        block->kind = MEM_BLOCK_HOST;
+        block->host = host + (pos & MEM_PAGE_MASK);
+        return MEM_PAGE_SIZE;
+    }
+    block->address = page->base + (pos & MEM_PAGE_MASK);
+    if (page->handler == &swap_handler) {
+        block->kind = MEM_BLOCK_SWAP;
+        return SWAP_PAGE_SIZE;
     }
-    if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-        return (uint32_t) read86_mp(address)
-               | ((uint32_t) read86_mp(address + 1) << 8)
-               | ((uint32_t) read86_mp(address + 2) << 16)
-               | ((uint32_t) read86_mp(address + 3) << 24);
+#if PICO_ON_DEVICE
+    if (page->handler == &psram_handler) {
+        block->kind = MEM_BLOCK_PSRAM;
+        return MEM_PAGE_SIZE;
     }
-    if (address >= EMS_START && address < EMS_END) {
-        return ems_readdw(address - EMS_START);
+#endif
+    block->kind = MEM_BLOCK_BUS;
+    block->address = pos;
+    return MEM_PAGE_SIZE;
+}
+
+static void guest_written(const mem_side_t *side, const uint32_t pos, const uint32_t size) {
+    memory_invalidate(pos, size);
+}
+
+void memory_side(mem_side_t *side, const uint32_t linear) {
+    side->start = linear;
+    side->locate = guest_locate;
+    side->written = guest_written;
+}
+
+// psram transfers are split into bursts the SPI program can count
+#define MEM_PSRAM_BURST 16
+#define MEM_MOVE_BOUNCE 512
+
+static void block_read(const mem_block_t *block, uint8_t *data, const uint32_t size) {
+    switch (block->kind) {
+        case MEM_BLOCK_HOST:
+            memcpy(data, block->host, size);
+            break;
+#if PICO_ON_DEVICE
+        case MEM_BLOCK_PSRAM:
+            for (uint32_t i = 0; i < size; i += MEM_PSRAM_BURST) {
+                psram_read(&psram_spi, block->address + i, data + i, size - i < MEM_PSRAM_BURST ? size - i : MEM_PSRAM_BURST);
+            }
+            break;
+#endif
+        case MEM_BLOCK_SWAP:
+            memcpy(data, swap_page_ptr(block->address) + (block->address & (SWAP_PAGE_SIZE - 1)), size);
+            break;
+        default:
+            for (uint32_t i = 0; i < size; i++) data[i] = read86(block->address + i);
+            break;
     }
-    if (address >= UMB_START && address < UMB_END) {
-        return read32psram(address - UMB_START);
+}
+
+static void block_write(const mem_block_t *block, const uint8_t *data, const uint32_t size) {
+    switch (block->kind) {
+        case MEM_BLOCK_HOST:
+            memcpy(block->host, data, size);
+            break;
+#if PICO_ON_DEVICE
+        case MEM_BLOCK_PSRAM:
+            for (uint32_t i = 0; i < size; i += MEM_PSRAM_BURST) {
+                psram_write(&psram_spi, block->address + i, data + i, size - i < MEM_PSRAM_BURST ? size - i : MEM_PSRAM_BURST);
+            }
+            break;
+#endif
+        case MEM_BLOCK_SWAP:
+            memcpy(swap_page_write_ptr(block->address) + (block->address & (SWAP_PAGE_SIZE - 1)), data, size);
+            break;
+        default:
+            for (uint32_t i = 0; i < size; i++) write86(block->address + i, data[i]);
+            break;
     }
-    if (address >= BIOS_START && address < HMA_START) {
-        return *(uint32_t *) &BIOS[address - BIOS_START];
+}
+
+// Runs stay inside one piece of each side. Host memory on both sides is moved directly, anything
+// else goes through a bounce buffer, which also keeps a swap page-in for one side from evicting
+// the page of the other.
+void memory_move(mem_side_t *a, mem_side_t *b, uint32_t length, const bool exchange, const bool backward) {
+    static uint8_t bounce[2][MEM_MOVE_BOUNCE];
+    while (length) {
+        mem_block_t a_block = { 0 }, b_block = { 0 };
+        const uint32_t a_pos = backward ? a->start + length - 1 : a->start;
+        const uint32_t b_pos = backward ? b->start + length - 1 : b->start;
+        const uint32_t a_piece = a->locate(a, a_pos, exchange, &a_block);
+        const uint32_t b_piece = b->locate(b, b_pos, true, &b_block);
+        uint32_t n = length;
+        if (backward) {
+            if (n > (a_pos & (a_piece - 1)) + 1) n = (a_pos & (a_piece - 1)) + 1;
+            if (n > (b_pos & (b_piece - 1)) + 1) n = (b_pos & (b_piece - 1)) + 1;
+        } else {
+            if (n > a_piece - (a_pos & (a_piece - 1))) n = a_piece - (a_pos & (a_piece - 1));
+            if (n > b_piece - (b_pos & (b_piece - 1))) n = b_piece - (b_pos & (b_piece - 1));
+        }
+        const bool direct = !exchange && a_block.kind == MEM_BLOCK_HOST && b_block.kind == MEM_BLOCK_HOST;
+        if (!direct && n > MEM_MOVE_BOUNCE) n = MEM_MOVE_BOUNCE;
+        if (backward) {
+            // the blocks were located at the last byte of the run
+            a_block.host -= n - 1;
+            a_block.address -= n - 1;
+            b_block.host -= n - 1;
+            b_block.address -= n - 1;
+        }
+        if (direct) {
+            memmove(b_block.host, a_block.host, n);
+        } else {
+            block_read(&a_block, bounce[0], n);
+            if (exchange) block_read(&b_block, bounce[1], n);
+            block_write(&b_block, bounce[0], n);
+            if (exchange) block_write(&a_block, bounce[1], n);
+        }
+        const uint32_t at = backward ? length - n : 0;
+        if (b->written) b->written(b, b->start + at, n);
+        if (exchange && a->written) a->written(a, a->start + at, n);
+        if (!backward) {
+            a->start += n;
+            b->start += n;
+        }
+        length -= n;
     }
-    if (address >= HMA_START && address < HMA_END) {
-        if (a20_enabled) {
-            return read32psram(address);
+}
+
+void memory_map_a20(void) {
+    if (!a20_enabled) {
+        // 8086 wrap-around: FFFF:0010 and up alias the first 64 KB
+        for (uint32_t i = HMA_START >> MEM_PAGE_SHIFT; i < MEM_MAP_PAGES; i++) {
+            invalidate_frame(mem_map[i].frame);
         }
-        return *(uint32_t *) &SRAM[address - HMA_START];
+        fetch_window_flush();
+        memcpy(&mem_map[HMA_START >> MEM_PAGE_SHIFT], &mem_map[0], (0x10000 >> MEM_PAGE_SHIFT) * sizeof(mem_page_t));
+        return;
     }
-    if (!a20_enabled && address >= HMA_END) {
-        return readdw86_mp(address - HMA_START);
+    const uint32_t tail = MEM_MAP_END - MEM_PAGE_SIZE;
+    switch (mem_backend) {
+#if PICO_ON_DEVICE
+        case MEM_BACKEND_MP:
+            map_pages(HMA_START, tail, NULL, NULL, &psram_handler, HMA_START);
+            break;
+#endif
+        case MEM_BACKEND_SW:
+            map_pages(HMA_START, tail, NULL, NULL, &swap_handler, HMA_START);
+            break;
+        default:
+            map_pages(HMA_START, tail, HMA, HMA, &open_bus_handler, HMA_START);
+            break;
+    }
+    map_pages(tail, MEM_MAP_END, NULL, NULL, &hma_tail_handler, tail);
+}
+
+void memory_map_rebuild(void) {
+    map_pages(0, MEM_MAP_END, NULL, NULL, &open_bus_handler, 0);
+    switch (mem_backend) {
+#if PICO_ON_DEVICE
+        case MEM_BACKEND_MP: {
+            const uint32_t lo_page = LO_MEM & ~MEM_PAGE_MASK;
+            map_pages(0, lo_page, SRAM, SRAM, &open_bus_handler, 0);
+            map_pages(lo_page, lo_page + MEM_PAGE_SIZE, NULL, NULL, &lo_mem_handler, lo_page);
+            map_pages(lo_page + MEM_PAGE_SIZE, VIDEORAM_START, NULL, NULL, &psram_handler, lo_page + MEM_PAGE_SIZE);
+            map_pages(UMB_START, UMB_END, NULL, NULL, &psram_handler, 0);
+            break;
+        }
+#endif
+        case MEM_BACKEND_SW:
+            map_pages(0, VIDEORAM_START, NULL, NULL, &swap_handler, 0);
+            map_pages(UMB_START, UMB_END, NULL, NULL, &swap_handler, UMB_START);
+            break;
+        default:
+            map_pages(0, RAM_SIZE, RAM, RAM, &open_bus_handler, 0);
+            map_pages(UMB_START, UMB_END, UMB, UMB, &open_bus_handler, UMB_START);
+            break;
+    }
+    map_pages(VIDEORAM_START, VIDEORAM_END, NULL, NULL, &vga_handler, VIDEORAM_START);
+    for (uint8_t window = 0; window < 4; window++) {
+        memory_map_ems(window);
+    }
+    map_pages(0xFC000, 0xFC000 + MEM_PAGE_SIZE, NULL, NULL, &rom_id_handler, 0xFC000);
+    map_pages(BIOS_START, HMA_START, (uint8_t *) BIOS, NULL, &open_bus_handler, BIOS_START);
+    memory_map_a20();
+}
+
+void memory_init(const uint8_t backend) {
+    mem_backend = backend;
+    write86 = write86_pt;
+    writew86 = writew86_pt;
+    writedw86 = writedw86_pt;
+    read86 = read86_pt;
+    readw86 = readw86_pt;
+    readdw86 = readdw86_pt;
+    memory_map_rebuild();
+}
+
+#if !PICO_ON_DEVICE
+// the page table itself is rebuilt by snapshot_load once every module is restored
+void memory_snapshot(void) {
+    snapshot_blob(SNAPSHOT_TAG('R', 'A', 'M', ' '), RAM, sizeof(RAM));
+    snapshot_blob(SNAPSHOT_TAG('U', 'M', 'B', ' '), UMB, sizeof(UMB));
+    snapshot_blob(SNAPSHOT_TAG('H', 'M', 'A', ' '), HMA, sizeof(HMA));
+    snapshot_blob(SNAPSHOT_TAG('V', 'R', 'A', 'M'), VIDEORAM, sizeof(VIDEORAM));
+    snapshot_blob(SNAPSHOT_TAG('E', 'M', 'S', ' '), EMS, sizeof(EMS));
+    snapshot_blob(SNAPSHOT_TAG('E', 'M', 'S', 'P'), ems_pages, sizeof(ems_pages));
+    snapshot_blob(SNAPSHOT_TAG('E', 'M', 'M', ' '), &emm, sizeof(emm));
+}
+#endif
+
+// Points the code fetch window at the page holding address, if it has host memory behind it
+static void fetch_window_fill(const uint32_t address) {
+    fetch_size = 0;
+    if (address >= MEM_MAP_END) return;
+    const mem_page_t *page = &mem_map[address >> MEM_PAGE_SHIFT];
+    if (page->rptr) {
+        fetch_lo = address & ~MEM_PAGE_MASK;
+        fetch_ptr = page->rptr;
+        fetch_size = MEM_PAGE_SIZE;
+    }
+    else if (page->handler == &swap_handler) {
+        // resident swap page, valid until the next page-in
+        const uint32_t swap_address = page->base + (address & MEM_PAGE_MASK);
+        fetch_ptr = swap_page_ptr(swap_address);
+        fetch_lo = address - (swap_address & (SWAP_PAGE_SIZE - 1));
+        fetch_size = SWAP_PAGE_SIZE;
     }
-    return 0xFFFFFFFF;
 }
 
+uint8_t fetch86_miss(const uint32_t address) {
+    fetch_window_fill(address);
+    if (address - fetch_lo < fetch_size) {
+        return fetch_ptr[address - fetch_lo];
+    }
+    return read86(address);
+}
 
+uint16_t fetchw86_miss(const uint32_t address) {
+    fetch_window_fill(address);
+    if (address - fetch_lo + 1 < fetch_size) {
+        return load16(fetch_ptr + (address - fetch_lo));
+    }
+    return readw86(address);
+}
 
 // Writes a byte to the virtual memory
-void write86_sw(const uint32_t address, const uint8_t value) {
-    if (address < VIDEORAM_START) {
-        swap_write(address, value);
-    } else if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-        // printf("video write %x traddr %x =  %x\n", address, (address - VIDEORAM_START) & VIDEORAM_MASK, value);
-        vga_mem_write(address, value);
-        // VIDEORAM[(address - VIDEORAM_START) & VIDEORAM_MASK] = value;
-    } else if (address >= EMS_START && address < EMS_END) {
-        ems_write(address - EMS_START, value);
-    } else if (address >= UMB_START && address < UMB_END) {
-        swap_write(address, value);
-    } else if (address >= HMA_START && address < HMA_END) {
-        if (a20_enabled) {
-            swap_write(address, value);
-        } else {
-            swap_write(address - HMA_START, value);
-        }
-    } else if (!a20_enabled && address >= HMA_END) {
-        write86(address - HMA_START, value);
+void write86_pt(const uint32_t address, const uint8_t value) {
+    if (unlikely(address >= MEM_MAP_END)) {
+        if (!a20_enabled) write86_pt(address - HMA_START, value);
+        return;
+    }
+    const mem_page_t *page = &mem_map[address >> MEM_PAGE_SHIFT];
+    if (likely(page->wptr != NULL)) {
+        page->wptr[address & MEM_PAGE_MASK] = value;
+#if DECODE_CACHE_BITS
+        mem_gen[MEM_GEN_INDEX(page->frame, address & MEM_PAGE_MASK)]++;
+#endif
+    } else {
+        page->handler->write8(page->base + (address & MEM_PAGE_MASK), value);
     }
 }
 
 // Writes a word to the virtual memory
-void writew86_sw(const uint32_t address, const uint16_t value) {
-    if (address & 1) {
-        write86(address, (uint8_t) (value & 0xFF));
-        write86(address + 1, (uint8_t) ((value >> 8) & 0xFF));
-    } else {
-        if (address < VIDEORAM_START) {
-            swap_write16(address, value);
-        } else if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-            write86(address, (uint8_t) (value & 0xFF));
-            write86(address + 1, (uint8_t) ((value >> 8) & 0xFF));
-        } else if (address >= EMS_START && address < EMS_END) {
-            ems_writew(address - EMS_START, value);
-        } else if (address >= UMB_START && address < UMB_END) {
-            swap_write16(address, value);
-        } else if (address >= HMA_START && address < HMA_END) {
-            if (a20_enabled) {
-                swap_write16(address, value);
-            } else {
-                swap_write16(address - HMA_START, value);
-            }
-        } else if (!a20_enabled && address >= HMA_END) {
-            writew86(address - HMA_START, value);
+void writew86_pt(const uint32_t address, const uint16_t value) {
+    const uint32_t offset = address & MEM_PAGE_MASK;
+    if (likely(address < MEM_MAP_END)) {
+        const mem_page_t *page = &mem_map[address >> MEM_PAGE_SHIFT];
+        if (likely(page->wptr != NULL && offset <= MEM_PAGE_SIZE - 2)) {
+            store16(page->wptr + offset, value);
+#if DECODE_CACHE_BITS
+            mem_gen[MEM_GEN_INDEX(page->frame, offset)]++;
+#endif
+            return;
+        }
+        if (!page->wptr && !(address & 1)) {
+            page->handler->write16(page->base + offset, value);
+            return;
         }
     }
+    write86_pt(address, (uint8_t) (value & 0xFF));
+    write86_pt(address + 1, (uint8_t) ((value >> 8) & 0xFF));
 }
 
-void writedw86_sw(const uint32_t address, const uint32_t value) {
-    if (address & 1) {
-        write86(address, (uint8_t) (value & 0xFF));
-        write86(address + 1, (uint8_t) ((value >> 8) & 0xFF));
-        write86(address + 2, (uint8_t) ((value >> 16) & 0xFF));
-        write86(address + 3, (uint8_t) ((value >> 24) & 0xFF));
-    } else {
-        if (address < VIDEORAM_START) {
-            swap_write32(address, value);
-        } else if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-            write86(address, (uint8_t) (value & 0xFF));
-            write86(address + 1, (uint8_t) ((value >> 8) & 0xFF));
-            write86(address + 2, (uint8_t) ((value >> 16) & 0xFF));
-            write86(address + 3, (uint8_t) ((value >> 24) & 0xFF));
-        } else if (address >= EMS_START && address < EMS_END) {
-            ems_writedw(address - EMS_START, value);
-        } else if (address >= UMB_START && address < UMB_END) {
-            swap_write32(address, value);
-        } else if (address >= HMA_START && address < HMA_END) {
-            if (a20_enabled) {
-                swap_write32(address, value);
-            } else {
-                swap_write32(address - HMA_START, value);
-            }
-        } else if (!a20_enabled && address >= HMA_END) {
-            writedw86(address - HMA_START, value);
+void writedw86_pt(const uint32_t address, const uint32_t value) {
+    const uint32_t offset = address & MEM_PAGE_MASK;
+    if (likely(address < MEM_MAP_END)) {
+        const mem_page_t *page = &mem_map[address >> MEM_PAGE_SHIFT];
+        if (likely(page->wptr != NULL && offset <= MEM_PAGE_SIZE - 4)) {
+            store32(page->wptr + offset, value);
+#if DECODE_CACHE_BITS
+            mem_gen[MEM_GEN_INDEX(page->frame, offset)]++;
+#endif
+            return;
+        }
+        if (!page->wptr && !(address & 1)) {
+            page->handler->write32(page->base + offset, value);
+            return;
         }
     }
+    write86_pt(address, (uint8_t) (value & 0xFF));
+    write86_pt(address + 1, (uint8_t) ((value >> 8) & 0xFF));
+    write86_pt(address + 2, (uint8_t) ((value >> 16) & 0xFF));
+    write86_pt(address + 3, (uint8_t) ((value >> 24) & 0xFF));
 }
 
 // Reads a byte from the virtual memory
-uint8_t read86_sw(const uint32_t address) {
-    if (address < VIDEORAM_START) {
-        return swap_read(address);
-    }
-    if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-        return vga_mem_read(address);
-    }
-     // if (address >= VBIOS_START && address < VBIOS_END) {
-         // return VGABIOS[address - VBIOS_START];
-     // }
-    if (address >= EMS_START && address < EMS_END) {
-        return ems_read(address - EMS_START);
-    }
-    if (address >= UMB_START && address < UMB_END) {
-        return swap_read(address);
-    }
-    if (address == 0xFC000) {
-        return 0x21;
+uint8_t read86_pt(const uint32_t address) {
+    if (unlikely(address >= MEM_MAP_END)) {
+        return a20_enabled ? 0xFF : read86_pt(address - HMA_START);
     }
-    if (address >= BIOS_START && address < HMA_START) {
-        return BIOS[address - BIOS_START];
+    const mem_page_t *page = &mem_map[address >> MEM_PAGE_SHIFT];
+    if (likely(page->rptr != NULL)) {
+        return page->rptr[address & MEM_PAGE_MASK];
     }
-    if (address >= HMA_START && address < HMA_END) {
-        if (a20_enabled) {
-            return swap_read(address);
-        }
-        return swap_read(address - HMA_START);
-    }
-    if (!a20_enabled && address >= HMA_END) {
-        return read86_sw(address - HMA_START);
-    }
-    return 0xFF;
+    return page->handler->read8(page->base + (address & MEM_PAGE_MASK));
 }
 
 // Reads a word from the virtual memory
-uint16_t readw86_sw(const uint32_t address) {
-    if (address & 1) {
-        return (uint16_t) read86_sw(address) | ((uint16_t) read86_sw(address + 1) << 8);
-    }
-    if (address < VIDEORAM_START) {
-        return swap_read16(address);
-    }
-    if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-        return (uint16_t) read86_sw(address) | ((uint16_t) read86_sw(address + 1) << 8);
-    }
-    // if (address >= VBIOS_START && address < VBIOS_END) {
-        // return *(uint16_t *) &VGABIOS[address - VBIOS_START];
-    // }
-    if (address >= EMS_START && address < EMS_END) {
-        return ems_readw(address - EMS_START);
-    }
-    if (address >= UMB_START && address < UMB_END) {
-        return swap_read16(address);
-    }
-    if (address >= BIOS_START && address < HMA_START) {
-        return *(uint16_t *) &BIOS[address - BIOS_START];
-    }
-    if (address >= HMA_START && address < HMA_END) {
-        if (a20_enabled) {
-            return swap_read16(address);
+uint16_t readw86_pt(const uint32_t address) {
+    const uint32_t offset = address & MEM_PAGE_MASK;
+    if (likely(address < MEM_MAP_END)) {
+        const mem_page_t *page = &mem_map[address >> MEM_PAGE_SHIFT];
+        if (likely(page->rptr != NULL && offset <= MEM_PAGE_SIZE - 2)) {
+            return load16(page->rptr + offset);
+        }
+        if (!page->rptr && !(address & 1)) {
+            return page->handler->read16(page->base + offset);
         }
-        return swap_read16(address - HMA_START);
-    }
-    if (!a20_enabled && address >= HMA_END) {
-        return readw86_sw(address - HMA_START);
     }
-    return 0xFFFF;
+    return (uint16_t) read86_pt(address) | ((uint16_t) read86_pt(address + 1) << 8);
 }
 
-uint32_t readdw86_sw(const uint32_t address) {
-    if (address & 3) {
-        return (uint32_t) read86_sw(address)
-               | ((uint32_t) read86_sw(address + 1) << 8)
-               | ((uint32_t) read86_sw(address + 2) << 16)
-               | ((uint32_t) read86_sw(address + 3) << 24);
-    }
-    if (address < VIDEORAM_START) {
-        return swap_read32(address);
-    }
-    if (address >= VIDEORAM_START && address < VIDEORAM_END) {
-        return (uint32_t) read86_sw(address)
-               | ((uint32_t) read86_sw(address + 1) << 8)
-               | ((uint32_t) read86_sw(address + 2) << 16)
-               | ((uint32_t) read86_sw(address + 3) << 24);
-    }
-    if (address >= EMS_START && address < EMS_END) {
-        return ems_readdw(address - EMS_START);
-    }
-    if (address >= UMB_START && address < UMB_END) {
-        return swap_read32(address);
-    }
-    if (address >= BIOS_START && address < HMA_START) {
-        return *(uint32_t *) &BIOS[address - BIOS_START];
-    }
-    if (address >= HMA_START && address < HMA_END) {
-        if (a20_enabled) {
-            return swap_read32(address);
+uint32_t readdw86_pt(const uint32_t address) {
+    const uint32_t offset = address & MEM_PAGE_MASK;
+    if (likely(address < MEM_MAP_END)) {
+        const mem_page_t *page = &mem_map[address >> MEM_PAGE_SHIFT];
+        if (likely(page->rptr != NULL && offset <= MEM_PAGE_SIZE - 4)) {
+            return load32(page->rptr + offset);
+        }
+        if (!page->rptr && !(address & 3)) {
+            return page->handler->read32(page->base + offset);
         }
-        return swap_read32(address - HMA_START);
-    }
-    if (!a20_enabled && address >= HMA_END) {
-        return readdw86_sw(address - HMA_START);
     }
-    return 0xFFFFFFFF;
+    return (uint32_t) read86_pt(address)
+           | ((uint32_t) read86_pt(address + 1) << 8)
+           | ((uint32_t) read86_pt(address + 2) << 16)
+           | ((uint32_t) read86_pt(address + 3) << 24);
 }
-#endif
\ No newline at end of file
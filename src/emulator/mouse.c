@@ -102,4 +102,10 @@ void sermouseevent(const uint8_t button_state, const int8_t x_movement, const in
     
     // Send Y movement (6-bit value)
     bufsermousedata(y_movement & 63);
-}
\ No newline at end of file
+}
+
+#if !PICO_ON_DEVICE
+void mouse_snapshot(void) {
+    snapshot_blob(SNAPSHOT_TAG('M', 'O', 'U', 'S'), &serial_mouse, sizeof(serial_mouse));
+}
+#endif
@@ -277,6 +277,7 @@ static inline bool redirector_handler() {
 
                 const uint32_t dta_addr = (*(uint16_t *) &RAM[sda_addr + 14] << 4) + *(uint16_t *) &RAM[sda_addr + 12];
                 size_t bytes_read = fread(&RAM[dta_addr], 1, bytes_to_read, open_files[file_handle]);
+                memory_invalidate(dta_addr, bytes_read);
                 debug_log("bytes read %i at offset %ld -> %x\n", (int) bytes_read, sftptr->file_position, dta_addr);
 
                 // Update file position in SFT
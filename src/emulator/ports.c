@@ -97,7 +97,19 @@ static INLINE uint8_t rtc_read(uint16_t addr) {
     return ret;
 }
 
+#if !PICO_ON_DEVICE
+int32_t port_watch = -1;
+uint8_t port_watch_hit = 0;
+uint16_t port_watch_value = 0;
+#endif
+
 void portout(uint16_t portnum, uint16_t value) {
+#if !PICO_ON_DEVICE
+    if (unlikely(portnum == port_watch)) {
+        port_watch_hit = 1;
+        port_watch_value = value;
+    }
+#endif
     switch (portnum) {
         case 0x00:
         case 0x01:
@@ -159,6 +171,7 @@ void portout(uint16_t portnum, uint16_t value) {
 // A20 Gate
         case 0x92:
             a20_enabled = value & 1;
+            memory_map_a20();
             printf("A20 W: %d\n", a20_enabled);
             return;
 // Tandy 3-Voice Sound
@@ -556,4 +569,51 @@ void get_sound_sample(const int16_t other_sample, int16_t *samples) {
     cms_samples(samples);
 #endif
 
-}
\ No newline at end of file
+}
+#if !PICO_ON_DEVICE
+// keyboard, CRTC, AdLib/OPL, Sound Blaster, DSS and DMA state kept in this translation unit
+void ports_snapshot(void) {
+    uint8_t regs[] = { crt_controller_idx, port60, port61, port64, cursor_start, cursor_end, adlibstatus,
+                       byte_pointer_flipflop, memory_to_memory_enabled, fifo_head, fifo_tail, fifo_count, dss_data };
+    snapshot_blob(SNAPSHOT_TAG('P', 'O', 'R', 'T'), regs, sizeof(regs));
+    snapshot_blob(SNAPSHOT_TAG('C', 'R', 'T', 'C'), crt_controller, sizeof(crt_controller));
+    snapshot_blob(SNAPSHOT_TAG('V', 'O', 'F', 'S'), &vram_offset, sizeof(vram_offset));
+    snapshot_blob(SNAPSHOT_TAG('A', 'D', 'L', 'B'), adlibregmem, sizeof(adlibregmem));
+    snapshot_blob(SNAPSHOT_TAG('A', 'D', 'L', 'R'), &adlib_register, sizeof(adlib_register));
+    snapshot_blob(SNAPSHOT_TAG('D', 'M', 'A', ' '), dma_channels, sizeof(dma_channels));
+    snapshot_blob(SNAPSHOT_TAG('S', 'B', ' ', ' '), &sound_blaster, sizeof(sound_blaster));
+    snapshot_blob(SNAPSHOT_TAG('S', 'B', 'T', 'C'), &timeconst, sizeof(timeconst));
+    snapshot_blob(SNAPSHOT_TAG('S', 'B', 'S', 'R'), &sb_samplerate, sizeof(sb_samplerate));
+    snapshot_blob(SNAPSHOT_TAG('D', 'S', 'S', ' '), fifo_buffer, sizeof(fifo_buffer));
+    snapshot_blob(SNAPSHOT_TAG('C', 'O', 'V', 'X'), &covox_sample, sizeof(covox_sample));
+
+    // the OPL synth is rebuilt from its register file
+    uint8_t opl_regs[0x100] = { 0 };
+    if (emu8950_opl) {
+        memcpy(opl_regs, emu8950_opl->reg, sizeof(opl_regs));
+    }
+    snapshot_blob(SNAPSHOT_TAG('O', 'P', 'L', ' '), opl_regs, sizeof(opl_regs));
+
+    if (snapshot_loading) {
+        crt_controller_idx = regs[0];
+        port60 = regs[1];
+        port61 = regs[2];
+        port64 = regs[3];
+        cursor_start = regs[4];
+        cursor_end = regs[5];
+        adlibstatus = regs[6];
+        byte_pointer_flipflop = regs[7];
+        memory_to_memory_enabled = regs[8];
+        fifo_head = regs[9];
+        fifo_tail = regs[10];
+        fifo_count = regs[11];
+        dss_data = regs[12];
+        if (emu8950_opl) {
+            OPL_reset(emu8950_opl);
+            for (uint32_t reg = 0; reg < sizeof(opl_regs); reg++) {
+                OPL_writeReg(emu8950_opl, reg, opl_regs[reg]);
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,88 @@
+#include "emulator.h"
+
+// Event scheduler keyed on emulated CPU time. Deadlines are kept in 1/65536 cycle
+// units so that periods like 1193182 / count or SCHED_CPU_HZ / 44100 do not drift.
+
+static struct sched_event_s {
+    uint64_t deadline;
+    uint64_t period;
+    void (*handler)(void);
+} sched_events[SCHED_EVENTS];
+
+uint64_t sched_now = 0;
+uint64_t sched_next = UINT64_MAX;
+uint32_t sched_due = 0;
+uint64_t sched_event_next = UINT64_MAX;
+
+static void sched_update(void) {
+    uint64_t next = UINT64_MAX;
+    for (int i = 0; i < SCHED_EVENTS; i++) {
+        if (sched_events[i].handler && sched_events[i].deadline < next) {
+            next = sched_events[i].deadline;
+        }
+    }
+    sched_event_next = next == UINT64_MAX ? UINT64_MAX : (next + SCHED_FRAC_MASK) >> SCHED_FRAC_BITS;
+}
+
+static INLINE void sched_rearm(void) {
+    // keep hitting the slow path in exec86 while an unmasked IRQ waits for IF
+    sched_next = i8259_controller.interrupt_request_register & ~i8259_controller.interrupt_mask_register
+                     ? sched_now + 1
+                     : sched_event_next;
+}
+
+void sched_every(const uint8_t event, const uint64_t period, void (*handler)(void)) {
+    struct sched_event_s *e = &sched_events[event];
+    if (!period || !handler) {
+        e->handler = NULL;
+    } else if (e->period != period || e->handler != handler) {
+        e->period = period;
+        e->handler = handler;
+        e->deadline = (sched_now << SCHED_FRAC_BITS) + period;
+    }
+    sched_update();
+    sched_rearm();
+}
+
+void __not_in_flash() sched_run(void) {
+    if (sched_now >= sched_event_next) {
+        const uint64_t now = sched_now << SCHED_FRAC_BITS;
+        for (int i = 0; i < SCHED_EVENTS; i++) {
+            struct sched_event_s *e = &sched_events[i];
+            if (e->handler && e->deadline <= now) {
+                e->deadline += e->period;
+                // fell far behind (e.g. the period just got much shorter): skip instead of bursting
+                if (e->deadline <= now) {
+                    e->deadline = now + e->period;
+                }
+                e->handler();
+            }
+        }
+        sched_update();
+    }
+    sched_rearm();
+}
+
+#if !PICO_ON_DEVICE
+// Handlers belong to the running front end; only the time left until each armed event is
+// carried over, so sched_now keeps counting up across a restore.
+void sched_snapshot(void) {
+    uint64_t left[SCHED_EVENTS] = { 0 };
+    const uint64_t now = sched_now << SCHED_FRAC_BITS;
+    for (int i = 0; i < SCHED_EVENTS; i++) {
+        if (sched_events[i].handler) {
+            left[i] = sched_events[i].deadline > now ? sched_events[i].deadline - now : 0;
+        }
+    }
+    snapshot_blob(SNAPSHOT_TAG('S', 'C', 'H', 'D'), left, sizeof(left));
+    if (snapshot_loading) {
+        for (int i = 0; i < SCHED_EVENTS; i++) {
+            if (sched_events[i].handler && left[i]) {
+                sched_events[i].deadline = now + left[i];
+            }
+        }
+        sched_update();
+        sched_rearm();
+    }
+}
+#endif
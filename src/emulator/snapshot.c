@@ -0,0 +1,258 @@
+#if !PICO_ON_DEVICE
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "emulator.h"
+
+// Snapshot file: "P286SNAP", version, then one record per snapshot_blob() call in the order
+// the module hooks make them. Large blobs are stored sparsely as a bitmap of non-zero 4 KB
+// pages followed by those pages only.
+
+#define SNAPSHOT_MAGIC "P286SNAP"
+#define SNAPSHOT_PAGE 4096
+#define SNAPSHOT_SPARSE_MIN (4 * SNAPSHOT_PAGE)
+
+enum { SNAP_RAW, SNAP_SPARSE };
+
+typedef struct {
+    uint32_t tag;
+    uint32_t size;     // size of the blob in memory
+    uint32_t encoding;
+    uint32_t stored;   // bytes that follow in the file
+} snapshot_record_t;
+
+enum { SNAPSHOT_SAVE, SNAPSHOT_VERIFY, SNAPSHOT_RESTORE };
+
+uint8_t snapshot_loading = 0;
+static uint8_t snapshot_mode;
+static int snapshot_error;
+static FILE *snapshot_file;
+static const uint8_t *snapshot_in, *snapshot_end;
+
+static INLINE int page_is_zero(const uint8_t *page, const uint32_t size) {
+    const uint32_t *words = (const uint32_t *) page;
+    for (uint32_t i = 0; i < size / 4; i++) {
+        if (words[i]) return 0;
+    }
+    for (uint32_t i = size & ~3u; i < size; i++) {
+        if (page[i]) return 0;
+    }
+    return 1;
+}
+
+static void blob_save(const uint32_t tag, const uint8_t *data, const uint32_t size) {
+    snapshot_record_t record = { tag, size, SNAP_RAW, size };
+    if (size < SNAPSHOT_SPARSE_MIN) {
+        fwrite(&record, sizeof(record), 1, snapshot_file);
+        fwrite(data, 1, size, snapshot_file);
+        return;
+    }
+    const uint32_t pages = (size + SNAPSHOT_PAGE - 1) / SNAPSHOT_PAGE;
+    const uint32_t bitmap_size = (pages + 7) / 8;
+    uint8_t *bitmap = calloc(bitmap_size, 1);
+    uint32_t stored = bitmap_size;
+    for (uint32_t i = 0; i < pages; i++) {
+        const uint32_t length = i == pages - 1 ? size - i * SNAPSHOT_PAGE : SNAPSHOT_PAGE;
+        if (!page_is_zero(data + i * SNAPSHOT_PAGE, length)) {
+            bitmap[i >> 3] |= 1 << (i & 7);
+            stored += length;
+        }
+    }
+    record.encoding = SNAP_SPARSE;
+    record.stored = stored;
+    fwrite(&record, sizeof(record), 1, snapshot_file);
+    fwrite(bitmap, 1, bitmap_size, snapshot_file);
+    for (uint32_t i = 0; i < pages; i++) {
+        if (bitmap[i >> 3] & (1 << (i & 7))) {
+            const uint32_t length = i == pages - 1 ? size - i * SNAPSHOT_PAGE : SNAPSHOT_PAGE;
+            fwrite(data + i * SNAPSHOT_PAGE, 1, length, snapshot_file);
+        }
+    }
+    free(bitmap);
+}
+
+static void blob_restore(const uint32_t tag, uint8_t *data, const uint32_t size) {
+    snapshot_record_t record;
+    if (snapshot_end - snapshot_in < (ptrdiff_t) sizeof(record)) {
+        snapshot_error = 1;
+        return;
+    }
+    memcpy(&record, snapshot_in, sizeof(record));
+    snapshot_in += sizeof(record);
+    if (record.tag != tag || record.size != size || snapshot_end - snapshot_in < (ptrdiff_t) record.stored) {
+        printf("SNAPSHOT: section %.4s does not match this build\n", (const char *) &tag);
+        snapshot_error = 1;
+        return;
+    }
+    const uint8_t *in = snapshot_in;
+    snapshot_in += record.stored;
+    const uint32_t pages = (size + SNAPSHOT_PAGE - 1) / SNAPSHOT_PAGE;
+    const uint32_t bitmap_size = (pages + 7) / 8;
+    const uint8_t *bitmap = in;
+    if (snapshot_mode == SNAPSHOT_VERIFY) {
+        // the restore pass trusts the record, so everything it reads is checked here
+        uint64_t expected = size;
+        if (record.encoding == SNAP_SPARSE) {
+            expected = record.stored < bitmap_size ? UINT64_MAX : bitmap_size;
+            for (uint32_t i = 0; i < pages && expected != UINT64_MAX; i++) {
+                if (bitmap[i >> 3] & (1 << (i & 7))) {
+                    expected += i == pages - 1 ? size - i * SNAPSHOT_PAGE : SNAPSHOT_PAGE;
+                }
+            }
+        } else if (record.encoding != SNAP_RAW) {
+            expected = UINT64_MAX;
+        }
+        if (record.stored != expected) {
+            printf("SNAPSHOT: section %.4s is damaged\n", (const char *) &tag);
+            snapshot_error = 1;
+        }
+        return;
+    }
+    if (record.encoding == SNAP_RAW) {
+        memcpy(data, in, size);
+        return;
+    }
+    in += bitmap_size;
+    for (uint32_t i = 0; i < pages; i++) {
+        const uint32_t length = i == pages - 1 ? size - i * SNAPSHOT_PAGE : SNAPSHOT_PAGE;
+        if (bitmap[i >> 3] & (1 << (i & 7))) {
+            memcpy(data + i * SNAPSHOT_PAGE, in, length);
+            in += length;
+        } else {
+            memset(data + i * SNAPSHOT_PAGE, 0, length);
+        }
+    }
+}
+
+void snapshot_blob(const uint32_t tag, void *data, const uint32_t size) {
+    if (snapshot_error) {
+        return;
+    }
+    if (snapshot_mode == SNAPSHOT_SAVE) {
+        blob_save(tag, data, size);
+    } else {
+        blob_restore(tag, data, size);
+    }
+}
+
+static void snapshot_all(void) {
+    cpu_snapshot();
+    fpu_snapshot();
+    memory_snapshot();
+    xms_snapshot();
+    i8259_snapshot();
+    i8253_snapshot();
+    ports_snapshot();
+    vga_snapshot();
+    cga_snapshot();
+    tga_snapshot();
+    mouse_snapshot();
+    sched_snapshot();
+    disks_snapshot();
+}
+
+int snapshot_save(const char *path) {
+    if (mem_backend == MEM_BACKEND_SW) {
+        printf("SNAPSHOT: guest memory is paged, not supported\n");
+        return 0;
+    }
+    snapshot_file = fopen(path, "wb");
+    if (!snapshot_file) {
+        printf("SNAPSHOT: cannot create %s\n", path);
+        return 0;
+    }
+    const uint32_t version = SNAPSHOT_VERSION;
+    fwrite(SNAPSHOT_MAGIC, 1, 8, snapshot_file);
+    fwrite(&version, sizeof(version), 1, snapshot_file);
+    snapshot_mode = SNAPSHOT_SAVE;
+    snapshot_error = 0;
+    snapshot_all();
+    const int ok = !ferror(snapshot_file);
+    fclose(snapshot_file);
+    snapshot_file = NULL;
+    return ok;
+}
+
+static int snapshot_restore_from(const uint8_t *image, const size_t size) {
+    uint32_t version;
+    if (mem_backend == MEM_BACKEND_SW) {
+        printf("SNAPSHOT: guest memory is paged, not supported\n");
+        return 0;
+    }
+    if (size < 12 || memcmp(image, SNAPSHOT_MAGIC, 8) != 0) {
+        printf("SNAPSHOT: not a snapshot file\n");
+        return 0;
+    }
+    memcpy(&version, image + 8, sizeof(version));
+    if (version != SNAPSHOT_VERSION) {
+        printf("SNAPSHOT: version %u, expected %u\n", version, SNAPSHOT_VERSION);
+        return 0;
+    }
+    // a dry run first, so that a mismatching file leaves the machine untouched
+    snapshot_mode = SNAPSHOT_VERIFY;
+    snapshot_in = image + 12;
+    snapshot_end = image + size;
+    snapshot_error = 0;
+    snapshot_all();
+    if (!snapshot_error) {
+        snapshot_mode = SNAPSHOT_RESTORE;
+        snapshot_in = image + 12;
+        snapshot_loading = 1;
+        snapshot_all();
+        snapshot_loading = 0;
+    }
+    if (snapshot_error) {
+        return 0;
+    }
+    memory_map_rebuild();
+#if DECODE_CACHE_BITS
+    decode_cache_flush();
+#endif
+    video_dirty_set();
+    vga_chunky_rebuild();
+    return 1;
+}
+
+int snapshot_load(const char *path) {
+    int ok = 0;
+#ifndef _WIN32
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("SNAPSHOT: cannot open %s\n", path);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    const uint8_t *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return 0;
+    }
+    ok = snapshot_restore_from(image, st.st_size);
+    munmap((void *) image, st.st_size);
+#else
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        printf("SNAPSHOT: cannot open %s\n", path);
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    rewind(file);
+    uint8_t *image = malloc(size);
+    if (image && fread(image, 1, size, file) == (size_t) size) {
+        ok = snapshot_restore_from(image, size);
+    }
+    free(image);
+    fclose(file);
+#endif
+    return ok;
+}
+#endif
@@ -1,33 +1,153 @@
-#if PICO_ON_DEVICE
-
 #include "emulator.h"
 #include "swap.h"
+#if PICO_ON_DEVICE
 #include "f_util.h"
 #include "ff.h"
 #include <pico.h>
 #include <hardware/gpio.h>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#endif
 
 #define TOTAL_VIRTUAL_MEMORY_KBS (8 << 10)
+#define SWAP_VIRTUAL_PAGES ((TOTAL_VIRTUAL_MEMORY_KBS << 10) / SWAP_PAGE_SIZE)
 
-#define SWAP_PAGE_SIZE (2048)
 #define RAM_IN_PAGE_ADDR_MASK (0x000007FF)
 #define SHIFT_AS_DIV (11)
 
 #define SWAPPABLE_RAM_SIZE (SRAM_BLOCK_SIZE)
 #define SWAP_BLOCKS (SWAPPABLE_RAM_SIZE / SWAP_PAGE_SIZE)
 
+// recently used page -> slot translations kept in front of the slot table, a power of two
+#ifndef SWAP_TLB_SIZE
+#define SWAP_TLB_SIZE 8
+#endif
+
 #undef printf_
 #define printf_(...)
 
+// CLOCK (second chance) replacement that prefers clean, unreferenced pages; 0 keeps the plain FIFO
+#ifndef SWAP_CLOCK
+#define SWAP_CLOCK 1
+#endif
+#ifndef SWAP_CLOCK_CLEAN_SCAN
+#define SWAP_CLOCK_CLEAN_SCAN 4
+#endif
+
+// pages moved per pagefile transfer at most: read-ahead on sequential faults, write-back of
+// neighbouring dirty pages; 1 turns either off
+#ifndef SWAP_READAHEAD
+#define SWAP_READAHEAD 4
+#endif
+#ifndef SWAP_WRITE_CLUSTER
+#define SWAP_WRITE_CLUSTER 4
+#endif
+
+// compressed tier, SWAP_ZPOOL_PAGES is in swap.h
+#ifndef SWAP_ZPOOL_ENTRIES
+#define SWAP_ZPOOL_ENTRIES 128
+#endif
+#define SWAP_ZPOOL_UNIT 32
+#define SWAP_ZPOOL_UNITS (SWAP_ZPOOL_PAGES * SWAP_PAGE_SIZE / SWAP_ZPOOL_UNIT)
+
+// slots 1..SWAP_SLOT_END-1 page; the pool follows, the last slot is scratch space for the pool
+#define SWAP_SLOT_END (SWAP_SLOT_COUNT(SWAP_BLOCKS, SWAP_ZPOOL_PAGES) + 1)
+
 #define PAGE_CHANGE_FLAG 0x8000
-#define PAGE_ID_MASK 0x7FFF
+#define PAGE_ACCESS_FLAG 0x4000
+#define PAGE_ID_MASK 0x3FFF
+_Static_assert(SWAP_VIRTUAL_PAGES <= PAGE_ID_MASK + 1, "virtual pages must fit the page descriptor");
 
+#if PICO_ON_DEVICE
 uint16_t __scratch_y("swap_pages") ALIGN(4, SWAP_PAGES[SWAP_BLOCKS]) = {0};
+#else
+uint16_t ALIGN(4, SWAP_PAGES[SWAP_BLOCKS]) = {0};
+#endif
 #define SWAP_PAGES_CACHE SRAM
 
+// Inverse of SWAP_PAGES: the slot holding each virtual page, 0 when it is not resident. Slot 0
+// belongs to page 0 for good, so it never shows up here.
+_Static_assert(SWAP_BLOCKS <= 256, "swap slots must fit the uint8_t slot table");
+static uint8_t swap_slot[SWAP_VIRTUAL_PAGES] = {0};
+
+// direct-mapped by the low page bits; all-zero entries are valid, page 0 lives in slot 0
+static struct {
+    uint16_t page;
+    uint8_t slot;
+} swap_tlb[SWAP_TLB_SIZE] = {0};
+
 static INLINE uint32_t get_swap_page_for(uint32_t address);
 
+#if !PICO_ON_DEVICE
+static FILE *swap_trace_file = NULL;
+static uint16_t swap_trace_buffer[32768];
+static uint32_t swap_trace_length = 0;
+static uint16_t swap_trace_last = 0xFFFF;
+
+static void swap_trace_flush(void) {
+    if (swap_trace_length) {
+        fwrite(swap_trace_buffer, sizeof(uint16_t), swap_trace_length, swap_trace_file);
+        swap_trace_length = 0;
+    }
+}
+
+// A written unit that is all zeros once its run ends. Nothing pages in between the last access of
+// a run and the next trace call, so the unit is still resident.
+static uint16_t swap_trace_zero(const uint16_t record) {
+    if (!(record & SWAP_TRACE_WRITE)) return 0;
+    const uint32_t unit = record & SWAP_TRACE_UNIT;
+    const uint32_t lba_page = unit >> (SHIFT_AS_DIV - SWAP_TRACE_SHIFT);
+    if (lba_page && !swap_slot[lba_page]) return 0;
+    const uint32_t *words = (const uint32_t *) (SWAP_PAGES_CACHE + swap_slot[lba_page] * SWAP_PAGE_SIZE +
+                                                ((unit << SWAP_TRACE_SHIFT) & RAM_IN_PAGE_ADDR_MASK));
+    for (uint32_t i = 0; i < (1 << SWAP_TRACE_SHIFT) / 4; i++) {
+        if (words[i]) return 0;
+    }
+    return SWAP_TRACE_ZERO;
+}
+
+// one record per run of accesses to the same unit, a write anywhere in the run marks it
+static void swap_trace(const uint32_t address, const uint16_t write) {
+    const uint16_t unit = (address & (SWAP_VIRTUAL_PAGES * SWAP_PAGE_SIZE - 1)) >> SWAP_TRACE_SHIFT;
+    if (unit == (swap_trace_last & ~SWAP_TRACE_WRITE)) {
+        swap_trace_last |= write;
+        return;
+    }
+    if (swap_trace_last != 0xFFFF) {
+        swap_trace_buffer[swap_trace_length++] = swap_trace_last | swap_trace_zero(swap_trace_last);
+        if (swap_trace_length == sizeof(swap_trace_buffer) / sizeof(uint16_t)) swap_trace_flush();
+    }
+    swap_trace_last = unit | write;
+}
+
+void swap_trace_close(void) {
+    if (!swap_trace_file) return;
+    if (swap_trace_last != 0xFFFF) {
+        swap_trace_buffer[swap_trace_length++] = swap_trace_last | swap_trace_zero(swap_trace_last);
+    }
+    swap_trace_flush();
+    fclose(swap_trace_file);
+    swap_trace_file = NULL;
+}
+
+bool swap_trace_open(const char *path) {
+    const uint32_t version = SWAP_TRACE_VERSION;
+    swap_trace_file = fopen(path, "wb");
+    if (!swap_trace_file) return false;
+    fwrite(SWAP_TRACE_MAGIC, 1, 8, swap_trace_file);
+    fwrite(&version, sizeof(version), 1, swap_trace_file);
+    atexit(swap_trace_close);
+    return true;
+}
+
+#define SWAP_TRACE(address, write) if (swap_trace_file) swap_trace(address, write)
+#else
+#define SWAP_TRACE(address, write)
+#endif
+
 uint8_t swap_read(uint32_t address) {
+    SWAP_TRACE(address, 0);
     const register uint32_t swap_page = get_swap_page_for(address);
     const register uint32_t address_in_page = address & RAM_IN_PAGE_ADDR_MASK;
     return SWAP_PAGES_CACHE[(swap_page * SWAP_PAGE_SIZE) + address_in_page];
@@ -41,19 +161,34 @@ static INLINE uint32_t read32arr(const uint8_t *arr, uint32_t addr32) {
     return (uint32_t)arr[addr32] | ((uint32_t)arr[addr32 + 1] << 8) | ((uint32_t)arr[addr32 + 2] << 16) | ((uint32_t)arr[addr32 + 3] << 24);
 }
 
+uint8_t *swap_page_ptr(uint32_t address) {
+    SWAP_TRACE(address, 0);
+    return SWAP_PAGES_CACHE + get_swap_page_for(address) * SWAP_PAGE_SIZE;
+}
+
+uint8_t *swap_page_write_ptr(uint32_t address) {
+    SWAP_TRACE(address, SWAP_TRACE_WRITE);
+    const register uint32_t ram_page = get_swap_page_for(address);
+    SWAP_PAGES[ram_page] |= PAGE_CHANGE_FLAG;
+    return SWAP_PAGES_CACHE + ram_page * SWAP_PAGE_SIZE;
+}
+
 uint16_t swap_read16(uint32_t addr32) {
+    SWAP_TRACE(addr32, 0);
     const register uint32_t ram_page = get_swap_page_for(addr32);
     const register uint32_t addr_in_page = addr32 & RAM_IN_PAGE_ADDR_MASK;
     return read16arr(SWAP_PAGES_CACHE, ram_page * SWAP_PAGE_SIZE + addr_in_page);
 }
 
 uint32_t swap_read32(uint32_t addr32) {
+    SWAP_TRACE(addr32, 0);
     const register uint32_t ram_page = get_swap_page_for(addr32);
     const register uint32_t addr_in_page = addr32 & RAM_IN_PAGE_ADDR_MASK;
     return read32arr(SWAP_PAGES_CACHE, ram_page * SWAP_PAGE_SIZE + addr_in_page);
 }
 
 void swap_write(uint32_t addr32, uint8_t value) {
+    SWAP_TRACE(addr32, SWAP_TRACE_WRITE);
     register uint32_t ram_page = get_swap_page_for(addr32);
     register uint32_t addr_in_page = addr32 & RAM_IN_PAGE_ADDR_MASK;
     SWAP_PAGES_CACHE[ram_page * SWAP_PAGE_SIZE + addr_in_page] = value;
@@ -65,6 +200,7 @@ void swap_write(uint32_t addr32, uint8_t value) {
 }
 
 void swap_write16(uint32_t addr32, uint16_t value) {
+    SWAP_TRACE(addr32, SWAP_TRACE_WRITE);
     register uint32_t ram_page = get_swap_page_for(addr32);
     register uint32_t addr_in_page = addr32 & RAM_IN_PAGE_ADDR_MASK;
     register uint8_t *addr_in_ram = SWAP_PAGES_CACHE + ram_page * SWAP_PAGE_SIZE + addr_in_page;
@@ -78,6 +214,7 @@ void swap_write16(uint32_t addr32, uint16_t value) {
 }
 
 void swap_write32(uint32_t addr32, uint32_t value) {
+    SWAP_TRACE(addr32, SWAP_TRACE_WRITE);
     register uint32_t ram_page = get_swap_page_for(addr32);
     register uint32_t addr_in_page = addr32 & RAM_IN_PAGE_ADDR_MASK;
     register uint8_t *addr_in_ram = SWAP_PAGES_CACHE + ram_page * SWAP_PAGE_SIZE + addr_in_page;
@@ -93,56 +230,386 @@ void swap_write32(uint32_t addr32, uint32_t value) {
 }
 
 
-static uint16_t oldest_ram_page = 1, last_ram_page = 0;
-static uint32_t last_lba_page = 0;
+struct swap_stats_s swap_stats = {0};
 
-uint32_t get_swap_page_for(uint32_t address) {
-    register uint32_t lba_page = address >> SHIFT_AS_DIV;
-    if (!lba_page) return lba_page;
-    if (last_lba_page == lba_page) return last_ram_page;
+// Pages written to the pagefile since boot. Anything else in the file is left over from an earlier
+// session, so those pages come back as zeros without touching the card.
+static uint32_t swap_written[SWAP_VIRTUAL_PAGES / 32] = {0};
 
-    last_lba_page = lba_page;
-    for (uint32_t page = 1; page < SWAP_BLOCKS; ++page) {
-        if ((SWAP_PAGES[page] & PAGE_ID_MASK) == lba_page) {
-            last_ram_page = page;
-            return page;
-        }
+static INLINE void swap_tlb_drop(const uint32_t lba_page) {
+    if (swap_tlb[lba_page & (SWAP_TLB_SIZE - 1)].page == lba_page) {
+        swap_tlb[lba_page & (SWAP_TLB_SIZE - 1)].page = 0;
+        swap_tlb[lba_page & (SWAP_TLB_SIZE - 1)].slot = 0;
     }
+}
+
+#if SWAP_CLOCK
+static uint32_t clock_hand = 1;
+
+static INLINE void swap_hand_past(const uint16_t ram_page) {
+    clock_hand = ram_page + 1 >= SWAP_SLOT_END ? 1 : ram_page + 1;
+}
+
+// The reference bit is set when a translation enters the TLB, so clearing it drops the
+// translation too
+static int swap_clock_pass(const uint32_t ram_page) {
+    const uint16_t desc = SWAP_PAGES[ram_page];
+    if (desc & PAGE_ACCESS_FLAG) {
+        SWAP_PAGES[ram_page] = desc & ~PAGE_ACCESS_FLAG;
+        swap_tlb_drop(desc & PAGE_ID_MASK);
+        return SWAP_SLOT_REFERENCED;
+    }
+    return desc & PAGE_CHANGE_FLAG ? SWAP_SLOT_DIRTY : SWAP_SLOT_CLEAN;
+}
+
+// CLOCK over the same slots as FIFO, see swap_clock_victim()
+static uint16_t swap_victim(void) {
+    return swap_clock_victim(&clock_hand, SWAP_SLOT_END, SWAP_CLOCK_CLEAN_SCAN, swap_clock_pass);
+}
 
+// slots a read-ahead may take over: not referenced since the hand last passed
+#define SWAP_READAHEAD_BUSY PAGE_ACCESS_FLAG
+#else
+static uint16_t oldest_ram_page = 1;
+
+static uint16_t swap_victim(void) {
     uint16_t ram_page = oldest_ram_page++;
-    if (oldest_ram_page >= SWAP_BLOCKS - 1) oldest_ram_page = 1;
+    if (oldest_ram_page >= SWAP_SLOT_END) oldest_ram_page = 1;
+    return ram_page;
+}
+
+static INLINE void swap_hand_past(const uint16_t ram_page) {
+    oldest_ram_page = ram_page + 1 >= SWAP_SLOT_END ? 1 : ram_page + 1;
+}
+
+// the slots after the victim are the next ones out anyway
+#define SWAP_READAHEAD_BUSY 0
+#endif
+
+static INLINE bool swap_page_written(const uint32_t lba_page) {
+    return swap_written[lba_page >> 5] & (1u << (lba_page & 31));
+}
 
+// Writes the slot back in one transfer together with the dirty pages that follow it both in the
+// pagefile and in the slots, up to SWAP_WRITE_CLUSTER pages. Those stay resident, now clean.
+static void swap_write_back(const uint16_t ram_page) {
+    const uint32_t lba_page = SWAP_PAGES[ram_page] & PAGE_ID_MASK;
+    uint32_t count = 1;
+    while (count < SWAP_WRITE_CLUSTER && ram_page + count < SWAP_SLOT_END &&
+           (SWAP_PAGES[ram_page + count] & (PAGE_CHANGE_FLAG | PAGE_ID_MASK)) == (PAGE_CHANGE_FLAG | (lba_page + count))) {
+        count++;
+    }
+    swap_file_flush_block(SWAP_PAGES_CACHE + ram_page * SWAP_PAGE_SIZE, lba_page * SWAP_PAGE_SIZE, count * SWAP_PAGE_SIZE);
+    for (uint32_t i = 0; i < count; i++) {
+        SWAP_PAGES[ram_page + i] &= ~PAGE_CHANGE_FLAG;
+        swap_written[(lba_page + i) >> 5] |= 1u << ((lba_page + i) & 31);
+    }
+    swap_stats.writes++;
+    swap_stats.writebacks += count;
+    swap_stats.bytes_written += count * SWAP_PAGE_SIZE;
+}
+
+static INLINE bool swap_page_zero(const uint8_t *page) {
+    const uint32_t *words = (const uint32_t *) page;
+    for (uint32_t i = 0; i < SWAP_PAGE_SIZE / 4; i++) {
+        if (words[i]) return false;
+    }
+    return true;
+}
+
+#if SWAP_ZPOOL_PAGES
+// Run-length code for bytes and 16-bit words, as in text screens and fill patterns. A control
+// byte n < 0x80 is followed by n + 1 literal bytes, 0x80..0xBF by one byte repeated n - 0x7D
+// times (3..66), 0xC0..0xFF by one word repeated n - 0xBE times (2..65). With dst NULL only the
+// packed size is worked out.
+static INLINE uint32_t zpool_byte_run(const uint8_t *src, const uint32_t at) {
+    uint32_t run = 1;
+    while (at + run < SWAP_PAGE_SIZE && run < 66 && src[at + run] == src[at]) run++;
+    return run;
+}
+
+static INLINE uint32_t zpool_word_run(const uint8_t *src, const uint32_t at) {
+    uint32_t run = 1;
+    while (at + run * 2 + 1 < SWAP_PAGE_SIZE && run < 65 &&
+           src[at + run * 2] == src[at] && src[at + run * 2 + 1] == src[at + 1]) run++;
+    return run;
+}
+
+static uint32_t zpool_pack(const uint8_t *src, uint8_t *dst) {
+    uint32_t in = 0, out = 0;
+    while (in < SWAP_PAGE_SIZE) {
+        const uint32_t bytes = zpool_byte_run(src, in);
+        const uint32_t words = in + 1 < SWAP_PAGE_SIZE ? zpool_word_run(src, in) : 1;
+        if (bytes >= 3 && bytes >= words * 2) {
+            if (dst) {
+                dst[out] = 0x7D + bytes;
+                dst[out + 1] = src[in];
+            }
+            out += 2;
+            in += bytes;
+            continue;
+        }
+        if (words >= 2) {
+            if (dst) {
+                dst[out] = 0xBE + words;
+                dst[out + 1] = src[in];
+                dst[out + 2] = src[in + 1];
+            }
+            out += 3;
+            in += words * 2;
+            continue;
+        }
+        uint32_t literal = 1;
+        while (in + literal < SWAP_PAGE_SIZE && literal < 128 &&
+               zpool_byte_run(src, in + literal) < 3 &&
+               (in + literal + 3 >= SWAP_PAGE_SIZE || zpool_word_run(src, in + literal) < 2)) {
+            literal++;
+        }
+        if (dst) {
+            dst[out] = literal - 1;
+            memcpy(dst + out + 1, src + in, literal);
+        }
+        out += literal + 1;
+        in += literal;
+    }
+    return out;
+}
+
+static void zpool_unpack(const uint8_t *src, uint8_t *dst) {
+    uint32_t out = 0;
+    while (out < SWAP_PAGE_SIZE) {
+        const uint8_t control = *src++;
+        if (control >= 0xC0) {
+            for (uint32_t i = 0; i < control - 0xBEu; i++, out += 2) {
+                dst[out] = src[0];
+                dst[out + 1] = src[1];
+            }
+            src += 2;
+        } else if (control >= 0x80) {
+            memset(dst + out, *src++, control - 0x7D);
+            out += control - 0x7D;
+        } else {
+            memcpy(dst + out, src, control + 1);
+            src += control + 1;
+            out += control + 1;
+        }
+    }
+}
+
+#define ZPOOL ((uint8_t *) SWAP_PAGES_CACHE + SWAP_SLOT_END * SWAP_PAGE_SIZE)
+#define ZPOOL_SCRATCH (SWAP_PAGES_CACHE + (SWAP_BLOCKS - 1) * SWAP_PAGE_SIZE)
+
+static struct {
+    uint16_t page;  // 0 for a free entry
+    uint16_t unit;
+    uint16_t units;
+    uint32_t age;
+} zpool[SWAP_ZPOOL_ENTRIES];
+static uint32_t zpool_used[(SWAP_ZPOOL_UNITS + 31) / 32];
+static uint32_t zpool_count = 0, zpool_clock = 0;
+// Room is only made by spilling while the pool pays off: loads earn credit, spills use it up, and
+// every 32nd refusal spills anyway so a stale pool still turns over.
+static int32_t zpool_credit = 8;
+static uint32_t zpool_refused = 0;
+
+static void zpool_mark(const uint32_t unit, const uint32_t units, const bool used) {
+    for (uint32_t i = unit; i < unit + units; i++) {
+        if (used) zpool_used[i >> 5] |= 1u << (i & 31);
+        else zpool_used[i >> 5] &= ~(1u << (i & 31));
+    }
+}
+
+static int zpool_find(const uint32_t lba_page) {
+    for (int i = 0; zpool_count && i < SWAP_ZPOOL_ENTRIES; i++) {
+        if (zpool[i].page == lba_page) return i;
+    }
+    return -1;
+}
+
+static void zpool_free(const int entry) {
+    zpool_mark(zpool[entry].unit, zpool[entry].units, false);
+    swap_stats.zpool_bytes -= zpool[entry].units * SWAP_ZPOOL_UNIT;
+    zpool[entry].page = 0;
+    zpool_count--;
+}
+
+// first fit; -1 when no free run is long enough
+static int zpool_alloc(const uint32_t units) {
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < SWAP_ZPOOL_UNITS; i++) {
+        run = zpool_used[i >> 5] & (1u << (i & 31)) ? 0 : run + 1;
+        if (run == units) return i + 1 - units;
+    }
+    return -1;
+}
+
+// the oldest entry goes on to the pagefile
+static void zpool_spill(void) {
+    int oldest = -1;
+    for (int i = 0; i < SWAP_ZPOOL_ENTRIES; i++) {
+        if (zpool[i].page && (oldest < 0 || zpool[i].age < zpool[oldest].age)) oldest = i;
+    }
+    const uint32_t lba_page = zpool[oldest].page;
+    zpool_unpack(ZPOOL + zpool[oldest].unit * SWAP_ZPOOL_UNIT, ZPOOL_SCRATCH);
+    swap_file_flush_block(ZPOOL_SCRATCH, lba_page * SWAP_PAGE_SIZE, SWAP_PAGE_SIZE);
+    swap_written[lba_page >> 5] |= 1u << (lba_page & 31);
+    swap_stats.writes++;
+    swap_stats.bytes_written += SWAP_PAGE_SIZE;
+    swap_stats.zpool_spills++;
+    zpool_free(oldest);
+}
+
+// keeps a page that packs to half its size or less, making room by spilling old entries if it may
+static bool zpool_store(const uint32_t lba_page, const uint8_t *page) {
+    const uint32_t units = (zpool_pack(page, NULL) + SWAP_ZPOOL_UNIT - 1) / SWAP_ZPOOL_UNIT;
+    if (units * SWAP_ZPOOL_UNIT > SWAP_PAGE_SIZE / 2) return false;
+    int unit = zpool_count < SWAP_ZPOOL_ENTRIES ? zpool_alloc(units) : -1;
+    if (unit < 0 && zpool_credit <= 0 && ++zpool_refused % 32) return false;
+    while (unit < 0) {
+        zpool_spill();
+        if (zpool_credit > 0) zpool_credit--;
+        unit = zpool_count < SWAP_ZPOOL_ENTRIES ? zpool_alloc(units) : -1;
+    }
+    int entry = 0;
+    while (zpool[entry].page) entry++;
+    zpool_pack(page, ZPOOL + unit * SWAP_ZPOOL_UNIT);
+    zpool_mark(unit, units, true);
+    zpool[entry].page = lba_page;
+    zpool[entry].unit = unit;
+    zpool[entry].units = units;
+    zpool[entry].age = zpool_clock++;
+    zpool_count++;
+    swap_stats.zpool_stores++;
+    swap_stats.zpool_bytes += units * SWAP_ZPOOL_UNIT;
+    return true;
+}
+#endif
+
+// A dirty page that is all zeros or fits the pool skips the card. The written bit then goes, as
+// the pagefile no longer holds the latest copy.
+static void swap_slot_evict(const uint16_t ram_page) {
+    const uint32_t old_page = SWAP_PAGES[ram_page] & PAGE_ID_MASK;
+    if (SWAP_PAGES[ram_page] & PAGE_CHANGE_FLAG) {
+        const uint8_t *cache = SWAP_PAGES_CACHE + ram_page * SWAP_PAGE_SIZE;
+        if (swap_page_zero(cache)) {
+            swap_written[old_page >> 5] &= ~(1u << (old_page & 31));
+            swap_stats.zero_pages++;
+#if SWAP_ZPOOL_PAGES
+        } else if (zpool_store(old_page, cache)) {
+            swap_written[old_page >> 5] &= ~(1u << (old_page & 31));
+#endif
+        } else {
+            swap_write_back(ram_page);
+        }
+        SWAP_PAGES[ram_page] &= ~PAGE_CHANGE_FLAG;
+    }
+    if (old_page) {
+        swap_slot[old_page] = 0;
+        swap_tlb_drop(old_page);
+    }
+}
+
+static uint32_t swap_last_fault = 0;
+
+// Evicts a slot in favour of lba_page. A fault on the page right after the previous one reads up to
+// SWAP_READAHEAD - 1 following pages in the same transfer, into the slots after the victim as
+// long as the policy would give those up soon anyway; the hand then moves past them.
+static uint32_t swap_page_in(const uint32_t lba_page) {
+    fetch_window_flush();
+    const uint16_t ram_page = swap_victim();
+
+#if PICO_ON_DEVICE
     if (get_core_num()) {
         printf("warn: [core #1] attempt to use swap\n");
     }
-    if (!(SWAP_PAGES[ram_page] & PAGE_CHANGE_FLAG)) {
-        swap_file_read_block(SWAP_PAGES_CACHE + (ram_page * SWAP_PAGE_SIZE), lba_page * SWAP_PAGE_SIZE, SWAP_PAGE_SIZE);
+#endif
+    swap_slot_evict(ram_page);
+    uint8_t *cache = SWAP_PAGES_CACHE + ram_page * SWAP_PAGE_SIZE;
+    uint32_t count = 1;
+    bool dirty = false;
+#if SWAP_ZPOOL_PAGES
+    const int entry = zpool_find(lba_page);
+    if (entry >= 0) {
+        // the pool holds the only up to date copy, so the page comes back dirty
+        zpool_unpack(ZPOOL + zpool[entry].unit * SWAP_ZPOOL_UNIT, cache);
+        zpool_free(entry);
+        if (zpool_credit < 64) zpool_credit += 2;
+        swap_stats.zpool_loads++;
+        dirty = true;
+    } else
+#endif
+    if (swap_page_written(lba_page)) {
+        if (lba_page == swap_last_fault + 1) {
+            while (count < SWAP_READAHEAD && ram_page + count < SWAP_SLOT_END &&
+                   lba_page + count < SWAP_VIRTUAL_PAGES && !(SWAP_PAGES[ram_page + count] & SWAP_READAHEAD_BUSY) &&
+                   !swap_slot[lba_page + count] && swap_page_written(lba_page + count)) {
+                swap_slot_evict(ram_page + count);
+                count++;
+            }
+        }
+        swap_file_read_block(cache, lba_page * SWAP_PAGE_SIZE, count * SWAP_PAGE_SIZE);
+        swap_stats.reads++;
+        swap_stats.readahead += count - 1;
+        swap_stats.bytes_read += count * SWAP_PAGE_SIZE;
     } else {
-        swap_file_flush_block(SWAP_PAGES_CACHE + (ram_page * SWAP_PAGE_SIZE), (SWAP_PAGES[ram_page] & PAGE_ID_MASK) * SWAP_PAGE_SIZE, SWAP_PAGE_SIZE);
-        swap_file_read_block(SWAP_PAGES_CACHE + (ram_page * SWAP_PAGE_SIZE), lba_page * SWAP_PAGE_SIZE, SWAP_PAGE_SIZE);
+        memset(cache, 0, SWAP_PAGE_SIZE);
+        swap_stats.zero_fills++;
+    }
+    swap_stats.misses++;
+
+    for (uint32_t i = 0; i < count; i++) {
+        SWAP_PAGES[ram_page + i] = lba_page + i;
+        swap_slot[lba_page + i] = ram_page + i;
     }
+    if (dirty) {
+        SWAP_PAGES[ram_page] |= PAGE_CHANGE_FLAG;
+    }
+    if (count > 1) {
+        swap_hand_past(ram_page + count - 1);
+    }
+    swap_last_fault = lba_page + count - 1;
+    return ram_page;
+}
 
-    SWAP_PAGES[ram_page] = lba_page;
-    last_ram_page = ram_page;
+uint32_t get_swap_page_for(uint32_t address) {
+    register uint32_t lba_page = (address >> SHIFT_AS_DIV) & (SWAP_VIRTUAL_PAGES - 1);
+    swap_stats.lookups++;
+    if (!lba_page) return lba_page;
+    register uint32_t tlb = lba_page & (SWAP_TLB_SIZE - 1);
+    if (swap_tlb[tlb].page == lba_page) return swap_tlb[tlb].slot;
+
+    uint32_t ram_page = swap_slot[lba_page];
+    if (!ram_page) {
+        ram_page = swap_page_in(lba_page);
+    }
+    SWAP_PAGES[ram_page] |= PAGE_ACCESS_FLAG;
+    swap_tlb[tlb].page = lba_page;
+    swap_tlb[tlb].slot = ram_page;
     return ram_page;
 }
 
+#if PICO_ON_DEVICE
 static const char *path = "\\XT\\pagefile.sys";
 static FIL swap_file;
+// fast seek map; a contiguous pagefile needs only a couple of entries
+static DWORD swap_file_map[16];
 
+// The pagefile is kept across boots and allocated as one contiguous extent the first time, so
+// nothing is written at boot. Stale contents are never read back, see swap_written.
 bool init_swap() {
-    f_unlink(path);
-    FRESULT result = f_open(&swap_file, path, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
-    if (result == FR_OK) {
-        UINT bytes_written;
-        for (size_t i = 0; i < (TOTAL_VIRTUAL_MEMORY_KBS << 10); i += SWAP_PAGE_SIZE) {
-            result = f_write(&swap_file, SWAP_PAGES_CACHE, SWAP_PAGE_SIZE, &bytes_written);
-            if(i)printf_("%d         \r", (TOTAL_VIRTUAL_MEMORY_KBS << 10) / i);
-            if (result != FR_OK) return /*printf("Error initializing pagefile\n"),*/ false;
+    const FSIZE_t size = (FSIZE_t) TOTAL_VIRTUAL_MEMORY_KBS << 10;
+    if (f_open(&swap_file, path, FA_READ | FA_WRITE | FA_OPEN_ALWAYS) != FR_OK) return false;
+    if (f_size(&swap_file) != size) {
+        if (f_truncate(&swap_file) != FR_OK) return false;
+        if (f_expand(&swap_file, size, 1) != FR_OK) {
+            // no contiguous free space: let FatFs chain clusters, still without writing data
+            if (f_lseek(&swap_file, size) != FR_OK || f_tell(&swap_file) != size) return false;
         }
-    } else return /*printf("Error creating pagefile\n"),*/ false;
-    f_close(&swap_file);
-    return f_open(&swap_file, path, FA_READ | FA_WRITE) == FR_OK;
+    }
+    swap_file_map[0] = sizeof(swap_file_map) / sizeof(swap_file_map[0]);
+    swap_file.cltbl = swap_file_map;
+    if (f_lseek(&swap_file, CREATE_LINKMAP) != FR_OK) swap_file.cltbl = NULL;
+    return true;
 }
 
 static FRESULT swap_file_seek(uint32_t offset) {
@@ -171,5 +638,24 @@ void swap_file_flush_block(const uint8_t *src, uint32_t offset, uint32_t size) {
     }
     gpio_put(PICO_DEFAULT_LED_PIN, false);
 }
+#else
+// host pagefile: an anonymous temporary file, growing as pages get written
+static FILE *swap_file;
 
+bool init_swap() {
+    swap_file = tmpfile();
+    return swap_file != NULL;
+}
+
+void swap_file_read_block(uint8_t *dst, uint32_t offset, uint32_t size) {
+    if (fseek(swap_file, offset, SEEK_SET) != 0 || fread(dst, 1, size, swap_file) != size) {
+        printf("Read error\n");
+    }
+}
+
+void swap_file_flush_block(const uint8_t *src, uint32_t offset, uint32_t size) {
+    if (fseek(swap_file, offset, SEEK_SET) != 0 || fwrite(src, 1, size, swap_file) != size) {
+        printf("Write error\n");
+    }
+}
 #endif
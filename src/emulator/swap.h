@@ -1,4 +1,23 @@
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SWAP_PAGE_SIZE (2048)
+
+// Compressed tier between the slots and the pagefile: SWAP_ZPOOL_PAGES slots at the top of the
+// cache hold evicted dirty pages packed with a run-length code, 0 turns it off. All-zero pages
+// are dropped without any storage either way.
+#ifndef SWAP_ZPOOL_PAGES
+#define SWAP_ZPOOL_PAGES 8
+#endif
+
+// Slots a cache of `blocks` pages has for paging, 1..count: slot 0 holds page 0 for good, and
+// the pool plus one scratch slot for it take the top. tools/swapsim sizes its default from this.
+#define SWAP_SLOT_COUNT(blocks, pool_pages) ((blocks) - 2 - (pool_pages))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 bool init_swap();
 uint8_t swap_read(uint32_t address);
@@ -7,6 +26,66 @@ uint32_t swap_read32(uint32_t addr32);
 void swap_write(uint32_t addr32, uint8_t value);
 void swap_write16(uint32_t addr32, uint16_t value);
 void swap_write32(uint32_t addr32, uint32_t value);
+// host memory of the resident swap page holding address, valid until the next page-in
+uint8_t *swap_page_ptr(uint32_t address);
+// the same for writing the page as a block, marks it changed
+uint8_t *swap_page_write_ptr(uint32_t address);
 void swap_file_read_block(uint8_t * dst, uint32_t file_offset, uint32_t size);
 void swap_file_flush_block(const uint8_t* src, uint32_t file_offset, uint32_t sz);
 
+extern struct swap_stats_s {
+    uint64_t lookups;       // hits are lookups - misses
+    uint64_t misses;        // page-ins
+    uint64_t zero_fills;    // page-ins of never written pages, served without a read
+    uint64_t readahead;     // pages read ahead of a sequential fault
+    uint64_t writebacks;    // dirty pages written back, with their clustered neighbours
+    uint64_t zero_pages;    // dirty all-zero pages dropped instead of written back
+    uint64_t zpool_stores, zpool_loads, zpool_spills; // compressed tier: pages packed, faulted back, moved on to the card
+    uint64_t zpool_bytes;   // currently held by the compressed tier
+    uint64_t reads, writes; // pagefile transfers
+    uint64_t bytes_read, bytes_written; // pagefile traffic
+} swap_stats;
+
+// Access trace for tools/swapsim (host only): SWAP_TRACE_MAGIC, a uint32_t version, then
+// little-endian uint16_t records, one per run of accesses to the same 1 << SWAP_TRACE_SHIFT
+// bytes of the swap address space. SWAP_TRACE_WRITE marks a run that wrote, SWAP_TRACE_ZERO a
+// written run that left those bytes all zeros.
+#define SWAP_TRACE_MAGIC "P286SWTR"
+#define SWAP_TRACE_VERSION 2
+#define SWAP_TRACE_SHIFT 9
+#define SWAP_TRACE_WRITE 0x8000
+#define SWAP_TRACE_ZERO 0x4000
+#define SWAP_TRACE_UNIT 0x3FFF
+
+bool swap_trace_open(const char *path);
+void swap_trace_close(void);
+
+// What the CLOCK hand finds at a slot; the pass callback also clears the reference bit
+enum { SWAP_SLOT_REFERENCED, SWAP_SLOT_CLEAN, SWAP_SLOT_DIRTY };
+
+// The CLOCK victim walk over slots 1..end-1, shared by swap.c and tools/swapsim. The hand clears
+// reference bits as it passes and stops at a page that stayed unreferenced for a whole turn.
+// A clean one is taken right away. For a dirty one the hand looks clean_scan slots further for
+// a clean one first, which saves a write-back, and otherwise comes back to stop after the dirty one.
+static inline uint32_t swap_clock_victim(uint32_t *hand, const uint32_t end, const uint32_t clean_scan,
+                                         int (*pass)(uint32_t slot)) {
+    uint32_t dirty = 0, scanned = 0;
+    for (;;) {
+        const uint32_t slot = *hand;
+        if (++*hand >= end) *hand = 1;
+        const int state = pass(slot);
+        if (state == SWAP_SLOT_CLEAN) {
+            return slot;
+        }
+        if (state == SWAP_SLOT_DIRTY && !dirty) {
+            dirty = slot;
+        }
+        if (dirty && scanned++ >= clean_scan) {
+            *hand = dirty + 1 >= end ? 1 : dirty + 1;
+            return dirty;
+        }
+    }
+}
+#ifdef __cplusplus
+}
+#endif
@@ -187,8 +187,38 @@ void cga_portout(uint16_t portnum, uint16_t value) {
 }
 
 uint16_t cga_portin(uint16_t portnum) {
+#if !PICO_ON_DEVICE
+     // host front ends draw whole frames from a scheduler event, so the status follows emulated
+     // time: 525 lines at 60 Hz, the last 45 in vertical retrace, the last fifth of each line blanked
+     const uint64_t frame = SCHED_CPU_HZ / 60;
+     const uint64_t position = sched_now % frame * 525;
+     port3DA = position / frame >= 480 ? 9 : position % frame >= frame * 4 / 5;
+#endif
      // port3DA ^= 1;
      // if (!(port3DA & 1)) port3DA ^= 8;
      // return port3DA;
      return hercules_mode ? 0xFF : port3DA;
 }
+
+#if !PICO_ON_DEVICE
+void cga_snapshot(void) {
+    uint8_t regs[] = {
+        cga_intensity, cga_colorset, cga_foreground_color, cga_blinking, cga_blinking_lock, cga_hires,
+        hercules_mode, hercules_enable, port3DA, color_burst
+    };
+    snapshot_blob(SNAPSHOT_TAG('C', 'G', 'A', ' '), regs, sizeof(regs));
+    snapshot_blob(SNAPSHOT_TAG('C', 'G', 'A', 'C'), cga_composite_palette, sizeof(cga_composite_palette));
+    if (snapshot_loading) {
+        cga_intensity = regs[0];
+        cga_colorset = regs[1];
+        cga_foreground_color = regs[2];
+        cga_blinking = regs[3];
+        cga_blinking_lock = regs[4];
+        cga_hires = regs[5];
+        hercules_mode = regs[6];
+        hercules_enable = regs[7];
+        port3DA = regs[8];
+        color_burst = regs[9];
+    }
+}
+#endif
@@ -151,6 +151,9 @@ void tga_draw_char(uint8_t ch, int x, int y, uint8_t color) {
         VIDEORAM[plane_offset++] = (((font_row >> 2) & 1) * color << 4) | ((font_row >> 3) & 1) * color;
         VIDEORAM[plane_offset++] = (((font_row >> 4) & 1) * color << 4) | ((font_row >> 5) & 1) * color;
         VIDEORAM[plane_offset]   = (((font_row >> 6) & 1) * color << 4) | ((font_row >> 7) & 1) * color;
+        video_dirty_mark(plane_offset - 3);
+        video_dirty_mark(plane_offset);
+        for (int word = 3; word >= 0; word--) vga_chunky_update(plane_offset - word);
 
         if (row == 3) base_offset += 160;
     }
@@ -158,9 +161,19 @@ void tga_draw_char(uint8_t ch, int x, int y, uint8_t color) {
 
 void tga_draw_pixel(int x, int y, uint8_t color) {
     uint32_t * pixel = &VIDEORAM[tga_offset + (x >> 1) + ((y >> 2) << 13)];
+    video_dirty_mark(tga_offset + (x >> 1) + ((y >> 2) << 13));
     if (x & 1) {
         *pixel = (*pixel & 0xF0) | (color & 0x0F);
     } else {
         *pixel = (*pixel & 0x0F) | (color << 4);
     }
-}
\ No newline at end of file
+    vga_chunky_update(tga_offset + (x >> 1) + ((y >> 2) << 13));
+}
+
+#if !PICO_ON_DEVICE
+void tga_snapshot(void) {
+    snapshot_blob(SNAPSHOT_TAG('T', 'G', 'A', ' '), &tga_offset, sizeof(tga_offset));
+    snapshot_blob(SNAPSHOT_TAG('T', 'G', 'A', 'P'), tga_palette, sizeof(tga_palette));
+    snapshot_blob(SNAPSHOT_TAG('T', 'G', 'A', 'M'), tga_palette_map, sizeof(tga_palette_map));
+}
+#endif
@@ -133,6 +133,7 @@ typedef struct {
 
 static vga_cache_t vga;
 
+static void vga_select_writer(void);
 
 // Call whenever sequencer reg 2 or memory_mode changed
 static inline void vga_update_seq_cache(void) {
@@ -159,6 +160,7 @@ static inline void vga_update_gc_cache(void) {
     vga.read_mode = ((vga.graphics_controller[5] & 0x08u) ? 1 : 0);
     // bit mask: reg 8
     vga.bit_mask32 = expand_to_u32(vga.graphics_controller[8]);
+    vga_select_writer();
 }
 
 // ---------------------- Read path ----------------------
@@ -309,137 +311,174 @@ void vga_mem_write_loop(uint32_t address, const uint8_t cpu_data) {
     VIDEORAM[address] = (~vga.map_mask32 & previous_data) | (vga.map_mask32 & new_data);
 }
 #endif
-// Core write implementation (CPU writes a byte to VGA memory)
-void __not_in_flash() vga_mem_write(const uint32_t address, const uint8_t cpu_data) {
+// Core write implementation: the planes one CPU byte leaves at an offset holding previous.
+// Every write handler below inlines it with constant write mode, ALU function, set/reset use
+// and full bit mask, so each keeps only the steps its register state needs.
+static inline __attribute__((always_inline))
+uint32_t vga_write_planes(const uint8_t cpu_data, const uint32_t previous, const int mode, const int op,
+                          const int set_reset, const int full_mask) {
     uint32_t new_data;
 
-    const uint32_t map_mask32 = vga.map_mask32;
-    const uint32_t enable_set_reset32 = vga.enable_set_reset32;
-    const uint32_t set_reset32 = vga.set_reset32;
-    uint32_t *videoram_data = &VIDEORAM[address & 0xFFFF]; // current data pointer
-
-    switch (vga.write_mode) {
-        case 0: {
+    switch (mode) {
+        case 0:
             // Mode 0: Normal write with set/reset + ALU
-            new_data = masked_merge_xor(expand_to_u32(ror8(cpu_data, vga.data_rotate_counter)), set_reset32, enable_set_reset32);
+            new_data = expand_to_u32(ror8(cpu_data, vga.data_rotate_counter));
+            if (set_reset) new_data = masked_merge_xor(new_data, vga.set_reset32, vga.enable_set_reset32);
             break;
-        }
-        case 2: {
+        case 1:
+            // Mode 1: Write latch directly to enabled planes
+            return masked_merge_xor(previous, vga_latch32, vga.map_mask32);
+        case 2:
             // Mode 2: Color expands to all planes
-            if (vga.chain4) {
-                // In 256 color modes we write full byte to all masked planes
-                new_data = expand_to_u32(cpu_data);
-            } else {
-                // In 16 color modes we use it as mask
-                new_data = expand_nibble_to_planes(cpu_data);
-            }
-
+            // In 256 color modes we write full byte to all masked planes, in 16 color modes we use it as mask
+            new_data = vga.chain4 ? expand_to_u32(cpu_data) : expand_nibble_to_planes(cpu_data);
             break;
-        }
-
-        case 1: // Mode 1: Write latch directly to enabled planes
-            *videoram_data = masked_merge_xor(*videoram_data, vga_latch32, map_mask32);
-            return;
-
-        case 3: {
+        default:
             // Mode 3: Transparent set/reset
-            new_data = expand_to_u32(ror8(cpu_data, vga.data_rotate_counter)) & set_reset32 | vga_latch32 & ~set_reset32;
-            *videoram_data = masked_merge_xor(*videoram_data, new_data, map_mask32);
-            return;
-        }
+            new_data = (expand_to_u32(ror8(cpu_data, vga.data_rotate_counter)) & vga.set_reset32) |
+                       (vga_latch32 & ~vga.set_reset32);
+            return masked_merge_xor(previous, new_data, vga.map_mask32);
     }
 
     // --- ALU (applies to modes 0, 2) ---
-    //
-    if (vga.logical_operation == 1) {
+    if (op == 1) {
         new_data &= vga_latch32;
-    } else if (vga.logical_operation == 2) {
+    } else if (op == 2) {
         new_data |= vga_latch32;
-    } else if (vga.logical_operation == 3) {
+    } else if (op == 3) {
         new_data ^= vga_latch32;
     }
 
-    new_data = masked_merge_xor(vga_latch32, new_data, vga.bit_mask32);
+    if (!full_mask) new_data = masked_merge_xor(vga_latch32, new_data, vga.bit_mask32);
 
-    *videoram_data = masked_merge_xor(*videoram_data, new_data, map_mask32);
+    return masked_merge_xor(previous, new_data, vga.map_mask32);
 }
 
-// 16-bit fast path: write two consecutive addresses (address, address+1) with one setup
-void __not_in_flash() vga_mem_write16(const uint32_t address, const uint16_t cpu_data_x2) {
-    const uint32_t map_mask32 = vga.map_mask32;
-    const uint32_t enable_set_reset32 = vga.enable_set_reset32;
-    const uint32_t set_reset32 = vga.set_reset32;
-    const uint32_t bit_mask32 = vga.bit_mask32;
-    const uint32_t latch32 = vga_latch32;
-    const uint8_t rotate = vga.data_rotate_counter;
-    const uint8_t logic = vga.logical_operation;
-    const uint8_t wmode = vga.write_mode;
-
-    uint32_t *p0 = &VIDEORAM[address & 0xFFFFu];
-    uint32_t *p1 = p0 + 1;
-
-    if (wmode == 1) {
-        // Mode 1: latch -> enabled planes
-        const uint32_t lat = latch32;
-        *p0 = masked_merge_xor(*p0, lat, map_mask32);
-        *p1 = masked_merge_xor(*p1, lat, map_mask32);
-        return;
+// A byte and a word (address, address + 1) handler per register combination
+#define VGA_WRITE_HANDLERS(name, mode, op, set_reset, full_mask) \
+    static void __not_in_flash() name(const uint32_t address, const uint8_t cpu_data) { \
+        uint32_t *const planes = &VIDEORAM[address & 0xFFFF]; \
+        video_dirty_mark(address); \
+        *planes = vga_write_planes(cpu_data, *planes, mode, op, set_reset, full_mask); \
+        vga_chunky_update(address); \
+    } \
+    static void __not_in_flash() name##_16(const uint32_t address, const uint16_t cpu_data_x2) { \
+        uint32_t *const p0 = &VIDEORAM[address & 0xFFFF]; \
+        uint32_t *const p1 = &VIDEORAM[(address + 1) & 0xFFFF]; \
+        video_dirty_mark(address); \
+        video_dirty_mark(address + 1); \
+        const uint32_t planes0 = vga_write_planes((uint8_t) cpu_data_x2, *p0, mode, op, set_reset, full_mask); \
+        const uint32_t planes1 = vga_write_planes((uint8_t) (cpu_data_x2 >> 8), *p1, mode, op, set_reset, full_mask); \
+        *p0 = planes0; \
+        *p1 = planes1; \
+        vga_chunky_update(address); \
+        vga_chunky_update(address + 1); \
     }
 
-    if (wmode == 3) {
-        // Mode 3: transparent set/reset
-        const uint32_t rot0 = expand_to_u32(ror8((uint8_t) (cpu_data_x2 & 0xFF), rotate));
-        const uint32_t rot1 = expand_to_u32(ror8((uint8_t) (cpu_data_x2 >> 8), rotate));
-        const uint32_t base = latch32 & ~set_reset32;
+#define VGA_WRITE_MODE0(op) \
+    VGA_WRITE_HANDLERS(vga_write_0_##op, 0, op, 0, 0) \
+    VGA_WRITE_HANDLERS(vga_write_0_##op##_full, 0, op, 0, 1) \
+    VGA_WRITE_HANDLERS(vga_write_0_##op##_sr, 0, op, 1, 0) \
+    VGA_WRITE_HANDLERS(vga_write_0_##op##_sr_full, 0, op, 1, 1)
+#define VGA_WRITE_MODE2(op) \
+    VGA_WRITE_HANDLERS(vga_write_2_##op, 2, op, 0, 0) \
+    VGA_WRITE_HANDLERS(vga_write_2_##op##_full, 2, op, 0, 1)
+
+VGA_WRITE_MODE0(0)
+VGA_WRITE_MODE0(1)
+VGA_WRITE_MODE0(2)
+VGA_WRITE_MODE0(3)
+VGA_WRITE_MODE2(0)
+VGA_WRITE_MODE2(1)
+VGA_WRITE_MODE2(2)
+VGA_WRITE_MODE2(3)
+VGA_WRITE_HANDLERS(vga_write_1, 1, 0, 0, 0)
+VGA_WRITE_HANDLERS(vga_write_3, 3, 0, 0, 0)
 
-        const uint32_t new0 = (rot0 & set_reset32) | base;
-        const uint32_t new1 = (rot1 & set_reset32) | base;
+typedef struct {
+    void (*write)(uint32_t address, uint8_t cpu_data);
+    void (*write16)(uint32_t address, uint16_t cpu_data_x2);
+} vga_writer_t;
+
+#define VGA_WRITER(name) { name, name##_16 }
+
+// [ALU function][set/reset enabled][bit mask 0xFF]
+static const vga_writer_t vga_writers_mode0[4][2][2] = {
+#define VGA_WRITERS_MODE0(op) \
+    { { VGA_WRITER(vga_write_0_##op), VGA_WRITER(vga_write_0_##op##_full) }, \
+      { VGA_WRITER(vga_write_0_##op##_sr), VGA_WRITER(vga_write_0_##op##_sr_full) } }
+    VGA_WRITERS_MODE0(0), VGA_WRITERS_MODE0(1), VGA_WRITERS_MODE0(2), VGA_WRITERS_MODE0(3),
+};
 
-        *p0 = masked_merge_xor(*p0, new0, map_mask32);
-        *p1 = masked_merge_xor(*p1, new1, map_mask32);
-        return;
-    }
+// [ALU function][bit mask 0xFF]
+static const vga_writer_t vga_writers_mode2[4][2] = {
+#define VGA_WRITERS_MODE2(op) { VGA_WRITER(vga_write_2_##op), VGA_WRITER(vga_write_2_##op##_full) }
+    VGA_WRITERS_MODE2(0), VGA_WRITERS_MODE2(1), VGA_WRITERS_MODE2(2), VGA_WRITERS_MODE2(3),
+};
 
-    // Modes 0 and 2
-    uint32_t new0, new1;
-    if (wmode == 0) {
-        // Mode 0: rotate + set/reset + ALU
-        const uint32_t rot0 = expand_to_u32(ror8((uint8_t) (cpu_data_x2 & 0xFFu), rotate));
-        const uint32_t rot1 = expand_to_u32(ror8((uint8_t) (cpu_data_x2 >> 8), rotate));
-        new0 = masked_merge_xor(rot0, set_reset32, enable_set_reset32);
-        new1 = masked_merge_xor(rot1, set_reset32, enable_set_reset32);
-    } else {
-        // Mode 2: color expand
-        if (vga.chain4) {
-            // In 256 color modes we write full byte to all masked planes
-            new0 = expand_to_u32((uint8_t) (cpu_data_x2 & 0xFFu));
-            new1 = expand_to_u32((uint8_t) (cpu_data_x2 >> 8));
-        } else {
-            // In 16 color modes we use it as mask
-            new0 = expand_nibble_to_planes((uint8_t) (cpu_data_x2 & 0xFFu));
-            new1 = expand_nibble_to_planes((uint8_t) (cpu_data_x2 >> 8));
-        }
+static const vga_writer_t vga_writer_mode1 = VGA_WRITER(vga_write_1);
+static const vga_writer_t vga_writer_mode3 = VGA_WRITER(vga_write_3);
+
+static vga_writer_t vga_writer = VGA_WRITER(vga_write_0_0_full);
+
+// Map mask and chain4 are read at write time, so only the graphics controller picks a writer
+static void vga_select_writer(void) {
+    const int full_mask = vga.bit_mask32 == 0xFFFFFFFFu;
+    switch (vga.write_mode) {
+        case 0:
+            vga_writer = vga_writers_mode0[vga.logical_operation][vga.enable_set_reset32 != 0][full_mask];
+            break;
+        case 1:
+            vga_writer = vga_writer_mode1;
+            break;
+        case 2:
+            vga_writer = vga_writers_mode2[vga.logical_operation][full_mask];
+            break;
+        default:
+            vga_writer = vga_writer_mode3;
+            break;
     }
+}
+
+// CPU writes a byte to VGA memory
+void __not_in_flash() vga_mem_write(const uint32_t address, const uint8_t cpu_data) {
+    vga_writer.write(address, cpu_data);
+}
+
+// 16-bit fast path: write two consecutive addresses (address, address+1) with one setup
+void __not_in_flash() vga_mem_write16(const uint32_t address, const uint16_t cpu_data_x2) {
+    vga_writer.write16(address, cpu_data_x2);
+}
 
-    // ALU apply (modes 0,2)
-    if (logic == 1) {
-        new0 &= latch32;
-        new1 &= latch32;
-    } else if (logic == 2) {
-        new0 |= latch32;
-        new1 |= latch32;
-    } else if (logic == 3) {
-        new0 ^= latch32;
-        new1 ^= latch32;
+#if VIDEO_DIRTY
+uint32_t video_dirty[VIDEORAM_SIZE >> VIDEO_DIRTY_SHIFT >> 5];
+
+bool video_dirty_test(const uint32_t index, const uint32_t count) {
+    if (!count) return false;
+    const uint32_t first = (index & (VIDEORAM_SIZE - 1)) >> VIDEO_DIRTY_SHIFT;
+    const uint32_t last = ((index + count - 1) & (VIDEORAM_SIZE - 1)) >> VIDEO_DIRTY_SHIFT;
+    for (uint32_t block = first;; block = (block + 1) & ((VIDEORAM_SIZE >> VIDEO_DIRTY_SHIFT) - 1)) {
+        if (video_dirty[block >> 5] >> (block & 31) & 1) return true;
+        if (block == last) return false;
     }
+}
+
+void video_dirty_set(void) {
+    memset(video_dirty, 0xFF, sizeof(video_dirty));
+}
+
+void video_dirty_clear(void) {
+    memset(video_dirty, 0, sizeof(video_dirty));
+}
+#endif
 
-    // Bit mask blend, then final map-mask merge into VRAM
-    new0 = masked_merge_xor(latch32, new0, bit_mask32);
-    new1 = masked_merge_xor(latch32, new1, bit_mask32);
+#if VGA_CHUNKY
+uint64_t vga_chunky[VIDEORAM_SIZE];
 
-    *p0 = masked_merge_xor(*p0, new0, map_mask32);
-    *p1 = masked_merge_xor(*p1, new1, map_mask32);
+void vga_chunky_rebuild(void) {
+    for (uint32_t index = 0; index < VIDEORAM_SIZE; index++) vga_chunky_update(index);
 }
+#endif
 
 // ---------------------- Initialization ----------------------
 void vga_init(void) {
@@ -577,3 +616,23 @@ uint16_t vga_portin(uint16_t portnum) {
             return 0xff;
     }
 }
+
+#if !PICO_ON_DEVICE
+void vga_snapshot(void) {
+    uint8_t regs[] = { sequencer_register, graphics_control_register, color_index, read_color_index, vga_register, vga_planar_mode };
+    snapshot_blob(SNAPSHOT_TAG('V', 'G', 'A', ' '), regs, sizeof(regs));
+    snapshot_blob(SNAPSHOT_TAG('V', 'G', 'A', 'C'), &vga, sizeof(vga));
+    snapshot_blob(SNAPSHOT_TAG('V', 'G', 'A', 'L'), &vga_latch32, sizeof(vga_latch32));
+    snapshot_blob(SNAPSHOT_TAG('V', 'G', 'A', 'O'), &vga_plane_offset, sizeof(vga_plane_offset));
+    snapshot_blob(SNAPSHOT_TAG('V', 'G', 'A', 'P'), vga_palette, sizeof(vga_palette));
+    if (snapshot_loading) {
+        sequencer_register = regs[0];
+        graphics_control_register = regs[1];
+        color_index = regs[2];
+        read_color_index = regs[3];
+        vga_register = regs[4];
+        vga_planar_mode = regs[5];
+        vga_select_writer();
+    }
+}
+#endif
@@ -50,181 +50,226 @@ typedef struct __attribute__((packed, aligned)) {
     uint32_t destination_offset;
 } move_data_t;
 
-typedef struct umb {
-    uint16_t segment;
-    uint16_t size; // paragraphs
-    int allocated_paragraphs; // -1 for a chain
-} umb_t;
-
-static umb_t umb_blocks[] = {
-    // 0xD0000–0xDFFFF (64 KB)
-    {0xD000, 0x0080, 0}, {0xD080, 0x0080, 0}, {0xD100, 0x0080, 0}, {0xD180, 0x0080, 0},
-    {0xD200, 0x0080, 0}, {0xD280, 0x0080, 0}, {0xD300, 0x0080, 0}, {0xD380, 0x0080, 0},
-    {0xD400, 0x0080, 0}, {0xD480, 0x0080, 0}, {0xD500, 0x0080, 0}, {0xD580, 0x0080, 0},
-    {0xD600, 0x0080, 0}, {0xD680, 0x0080, 0}, {0xD700, 0x0080, 0}, {0xD780, 0x0080, 0},
-    {0xD800, 0x0080, 0}, {0xD880, 0x0080, 0}, {0xD900, 0x0080, 0}, {0xD980, 0x0080, 0},
-    {0xDA00, 0x0080, 0}, {0xDA80, 0x0080, 0}, {0xDB00, 0x0080, 0}, {0xDB80, 0x0080, 0},
-    {0xDC00, 0x0080, 0}, {0xDC80, 0x0080, 0}, {0xDD00, 0x0080, 0}, {0xDD80, 0x0080, 0},
-    {0xDE00, 0x0080, 0}, {0xDE80, 0x0080, 0}, {0xDF00, 0x0080, 0}, {0xDF80, 0x0080, 0},
-
-    // 0xE0000–0xEFFFF (64 KB)
-    {0xE000, 0x0080, 0}, {0xE080, 0x0080, 0}, {0xE100, 0x0080, 0}, {0xE180, 0x0080, 0},
-    {0xE200, 0x0080, 0}, {0xE280, 0x0080, 0}, {0xE300, 0x0080, 0}, {0xE380, 0x0080, 0},
-    {0xE400, 0x0080, 0}, {0xE480, 0x0080, 0}, {0xE500, 0x0080, 0}, {0xE580, 0x0080, 0},
-    {0xE600, 0x0080, 0}, {0xE680, 0x0080, 0}, {0xE700, 0x0080, 0}, {0xE780, 0x0080, 0},
-    {0xE800, 0x0080, 0}, {0xE880, 0x0080, 0}, {0xE900, 0x0080, 0}, {0xE980, 0x0080, 0},
-    {0xEA00, 0x0080, 0}, {0xEA80, 0x0080, 0}, {0xEB00, 0x0080, 0}, {0xEB80, 0x0080, 0},
-    {0xEC00, 0x0080, 0}, {0xEC80, 0x0080, 0}, {0xED00, 0x0080, 0}, {0xED80, 0x0080, 0},
-    {0xEE00, 0x0080, 0}, {0xEE80, 0x0080, 0}, {0xEF00, 0x0080, 0}, {0xEF80, 0x0080, 0},
-
-    // 0xF0000–0xF7FFF (32 KB)
-    {0xF000, 0x0080, 0}, {0xF080, 0x0080, 0}, {0xF100, 0x0080, 0}, {0xF180, 0x0080, 0},
-    {0xF200, 0x0080, 0}, {0xF280, 0x0080, 0}, {0xF300, 0x0080, 0}, {0xF380, 0x0080, 0},
-    {0xF400, 0x0080, 0}, {0xF480, 0x0080, 0}, {0xF500, 0x0080, 0}, {0xF580, 0x0080, 0},
-    {0xF600, 0x0080, 0}, {0xF680, 0x0080, 0}, {0xF700, 0x0080, 0}, {0xF780, 0x0080, 0},
-
-    // 0xF8000–0xFBFFF (16 KB)
-    {0xF800, 0x0080, 0}, {0xF880, 0x0080, 0}, {0xF900, 0x0080, 0}, {0xF980, 0x0080, 0},
-    {0xFA00, 0x0080, 0}, {0xFA80, 0x0080, 0}, {0xFB00, 0x0080, 0}, {0xFB80, 0x0080, 0},
-};
-#define UMB_BLOCKS_COUNT (sizeof(umb_blocks) / sizeof(umb_t))
-
-static int umb_blocks_allocated = 0;
-
-uint32_t xms_available = XMS_MEMORY_SIZE;
-uint8_t xms_handles = 0;
+// Free space of the XMS area and of the UMBs, a bit per KB (set while free) under a tree over
+// the bitmap words. Each node keeps the free run at either end of its part of the map and the
+// longest one inside it, so a first fit is found walking down from the root and the largest
+// free block is read off the root.
+typedef struct {
+    uint16_t head, tail, longest; // KB
+} xms_run_t;
 
-int a20_enabled = 0;
+typedef struct {
+    uint32_t *map;
+    xms_run_t *tree; // node 1 is the root, node words + i sums up map[i]
+    uint16_t words;  // a power of two, the bits past units stay clear
+    uint16_t units;
+} xms_pool_t;
 
-uint8_t __attribute__((aligned (4), section(".psram"))) XMS[XMS_MEMORY_SIZE] = {0};
+#define XMS_UNITS (XMS_MEMORY_SIZE >> 10)
+#define UMB_UNITS ((UMB_END - UMB_START) >> 10)
+#define UMB_WORDS 8 // UMB_UNITS / 32 rounded up to a power of two
 
-void init_umb() {
-    for (int i = 0; i < UMB_BLOCKS_COUNT; ++i) {
-        umb_blocks[i].allocated_paragraphs = 0;
+static uint32_t xms_map[XMS_UNITS / 32], umb_map[UMB_WORDS];
+static xms_run_t xms_tree[XMS_UNITS / 16], umb_tree[UMB_WORDS * 2];
+static xms_pool_t xms_pool = { xms_map, xms_tree, XMS_UNITS / 32, XMS_UNITS };
+static xms_pool_t umb_pool = { umb_map, umb_tree, UMB_WORDS, UMB_UNITS };
+
+static void pool_update(const xms_pool_t *pool, const uint32_t first, const uint32_t last) {
+    for (uint32_t i = first; i <= last; i++) {
+        const uint32_t bits = pool->map[i];
+        xms_run_t *leaf = &pool->tree[pool->words + i];
+        leaf->head = bits == ~0u ? 32 : __builtin_ctz(~bits);
+        leaf->tail = bits == ~0u ? 32 : __builtin_clz(~bits);
+        leaf->longest = 0;
+        for (uint32_t run = bits; run; run &= run >> 1) leaf->longest++;
+    }
+    uint16_t span = 32; // units under each child
+    for (uint32_t low = (pool->words + first) >> 1, high = (pool->words + last) >> 1; low; low >>= 1, high >>= 1, span <<= 1) {
+        for (uint32_t node = low; node <= high; node++) {
+            const xms_run_t *left = &pool->tree[node * 2], *right = &pool->tree[node * 2 + 1];
+            xms_run_t *run = &pool->tree[node];
+            run->head = left->head == span ? span + right->head : left->head;
+            run->tail = right->tail == span ? span + left->tail : right->tail;
+            run->longest = left->tail + right->head;
+            if (run->longest < left->longest) run->longest = left->longest;
+            if (run->longest < right->longest) run->longest = right->longest;
+        }
     }
 }
 
-const umb_t *get_largest_free_umb_block(uint16_t *psz) {
-    const umb_t *best = NULL;
-    int best_length = 0;
-    int i = 0;
-    while (i < UMB_BLOCKS_COUNT) {
-        if (0 == umb_blocks[i].allocated_paragraphs) {
-            int j = i;
-            int length = 0;
-            while (j < UMB_BLOCKS_COUNT && umb_blocks[j].allocated_paragraphs == 0) {
-                if (j > i) {
-                    const uint16_t expected_segment = umb_blocks[j - 1].segment + umb_blocks[j - 1].size;
-                    if (umb_blocks[j].segment != expected_segment)
-                        break;
-                }
-                length += umb_blocks[j].size;
-                j++;
-            }
-            if (length > best_length) {
-                best = &umb_blocks[i];
-                best_length = length;
-            }
-            i = j;
-        } else {
-            i++;
-        }
+static void pool_mark(const xms_pool_t *pool, const uint32_t start, const uint32_t count, const bool free) {
+    if (!count) return;
+    for (uint32_t unit = start; unit < start + count;) {
+        const uint32_t bit = unit & 31, n = start + count - unit < 32 - bit ? start + count - unit : 32 - bit;
+        const uint32_t mask = (n == 32 ? ~0u : (1u << n) - 1) << bit;
+        if (free) pool->map[unit >> 5] |= mask;
+        else pool->map[unit >> 5] &= ~mask;
+        unit += n;
     }
-    *psz = best_length;
-    return best;
+    pool_update(pool, start >> 5, (start + count - 1) >> 5);
 }
 
-umb_t *get_free_umb_block(const uint16_t size) {
-    umb_t *best = NULL;
-    int best_size = 0;
-    int i = 0;
-    while (i < UMB_BLOCKS_COUNT) {
-        if (umb_blocks[i].allocated_paragraphs != 0) {
-            i++;
-            continue;
-        }
-        uint16_t total_size = 0;
-        int j = i;
-        while (j < UMB_BLOCKS_COUNT && umb_blocks[j].allocated_paragraphs == 0) {
-            if (j > i) {
-                const uint16_t expected_segment = umb_blocks[j - 1].segment + umb_blocks[j - 1].size;
-                if (umb_blocks[j].segment != expected_segment)
-                    break;
-            }
-            total_size += umb_blocks[j].size;
-            j++;
-        }
-        if (total_size >= size) {
-            if (best == NULL || total_size < best_size) {
-                best = &umb_blocks[i];
-                best_size = total_size;
-            }
+static bool pool_is_free(const xms_pool_t *pool, const uint32_t start, const uint32_t count) {
+    if (start + count > pool->units) return false;
+    for (uint32_t unit = start; unit < start + count;) {
+        const uint32_t bit = unit & 31, n = start + count - unit < 32 - bit ? start + count - unit : 32 - bit;
+        const uint32_t mask = (n == 32 ? ~0u : (1u << n) - 1) << bit;
+        if ((pool->map[unit >> 5] & mask) != mask) return false;
+        unit += n;
+    }
+    return true;
+}
+
+// lowest start of count free units, -1 if there is no such run
+static int32_t pool_find(const xms_pool_t *pool, const uint32_t count) {
+    if (pool->tree[1].longest < count) return -1;
+    uint32_t node = 1, base = 0, span = pool->words * 32;
+    while (node < pool->words) {
+        const xms_run_t *left = &pool->tree[node * 2], *right = &pool->tree[node * 2 + 1];
+        span >>= 1;
+        if (left->longest >= count) {
+            node = node * 2;
+        } else if (left->tail + right->head >= count) {
+            return (int32_t) (base + span - left->tail);
+        } else {
+            node = node * 2 + 1;
+            base += span;
         }
-        i = j; // skip tested block
     }
-    return best;
+    const uint32_t bits = pool->map[node - pool->words];
+    uint32_t starts = bits;
+    for (uint32_t i = 1; i < count; i++) starts &= bits >> i;
+    return (int32_t) (base + __builtin_ctz(starts));
 }
-#if PICO_ON_DEVICE
+
+static void pool_reset(const xms_pool_t *pool) {
+    memset(pool->map, 0, pool->words * sizeof(uint32_t));
+    pool_mark(pool, 0, pool->units, true);
+}
+
+typedef struct {
+    uint16_t start, size; // KB
+    uint8_t used, locks;
+} xms_block_t;
+
+static xms_block_t xms_blocks[XMS_HANDLES]; // handle - 1
+static uint8_t umb_sizes[UMB_UNITS]; // KB, at the first KB of each UMB handed out
+
+struct xms_stats_s xms_stats = {0};
+
+uint8_t xms_handles = 0;
+
+int a20_enabled = 0;
+
+uint8_t __attribute__((aligned (4), section(".psram"))) XMS[XMS_MEMORY_SIZE] = {0};
+
+static void xms_account(void) {
+    xms_stats.free = 0;
+    for (uint32_t i = 0; i < xms_pool.words; i++) xms_stats.free += __builtin_popcount(xms_map[i]);
+    xms_stats.largest = xms_tree[1].longest;
+    xms_stats.umb_free = 0;
+    for (uint32_t i = 0; i < umb_pool.words; i++) xms_stats.umb_free += __builtin_popcount(umb_map[i]);
+    xms_stats.umb_largest = umb_tree[1].longest;
+}
+
+void init_xms() {
+    pool_reset(&xms_pool);
+    pool_reset(&umb_pool);
+    memset(xms_blocks, 0, sizeof(xms_blocks));
+    memset(umb_sizes, 0, sizeof(umb_sizes));
+    xms_handles = 0;
+    xms_account();
+}
+
+static xms_block_t *xms_block(const uint16_t handle) {
+    return handle && handle <= XMS_HANDLES && xms_blocks[handle - 1].used ? &xms_blocks[handle - 1] : NULL;
+}
+
 #include "swap.h"
+#if PICO_ON_DEVICE
 #include "psram_spi.h"
 extern uint32_t butter_psram_size;
 #endif
-static INLINE void xms_move_to(const register uint32_t destination, register uint32_t source, register uint32_t length) {
+// extended memory side of a move, as an offset in the XMS area
+static uint32_t xms_locate(const mem_side_t *side, const uint32_t pos, const bool write, mem_block_t *block) {
     if (butter_psram_size) {
-        register uint16_t *dest_ptr = (uint16_t *) &XMS[destination];
-        length /= 2;
-        while (length--) {
-            *dest_ptr++ = readw86(source);
-            source += 2;
-        }
-    } else {
-        uint32_t dest = XMS_PSRAM_OFFSET + destination;
-        length /= 2;
-        if (PSRAM_AVAILABLE) {
-            while (length--) {
-                write16psram(dest, readw86(source));
-                dest += 2;
-                source += 2;
-            }
-        } else {
-            while (length--) {
-                swap_write16(dest, readw86(source));
-                dest += 2;
-                source += 2;
-            }
-        }
+        block->kind = MEM_BLOCK_HOST;
+        block->host = &XMS[pos];
+        return XMS_MEMORY_SIZE;
+    }
+    block->address = XMS_PSRAM_OFFSET + pos;
+    if (PSRAM_AVAILABLE) {
+        block->kind = MEM_BLOCK_PSRAM;
+        return XMS_MEMORY_SIZE;
     }
+    block->kind = MEM_BLOCK_SWAP;
+    return SWAP_PAGE_SIZE;
 }
 
-static INLINE void xms_move_from(const uint32_t source, register uint32_t destination, register uint32_t length) {
-    if (butter_psram_size) {
-        const register uint16_t *source_ptr = (uint16_t *) &XMS[source];
-        length /= 2;
-        while (length--) {
-            writew86(destination, *source_ptr++);
-            destination += 2;
-        }
+#define to_physical_offset(offset) (((uint16_t)(((offset) >> 16) & 0xFFFF) << 4) + (uint16_t)((offset) & 0xFFFF))
+
+// handle 0 takes a real mode seg:off, anything else an offset in the block
+static uint8_t xms_side(mem_side_t *side, const uint16_t handle, const uint32_t offset, const uint32_t length) {
+    if (!handle) {
+        memory_side(side, to_physical_offset(offset));
+        return side->start + length > MEM_MAP_END;
+    }
+    const xms_block_t *block = xms_block(handle);
+    if (!block) return 1;
+    if (offset > (uint32_t) block->size << 10 || length > ((uint32_t) block->size << 10) - offset) return 2;
+    side->start = ((uint32_t) block->start << 10) + offset;
+    side->handle = handle;
+    side->locate = xms_locate;
+    side->written = NULL;
+    return 0;
+}
+
+static uint8_t xms_move(const move_data_t *move_data) {
+    mem_side_t source, destination;
+    if (move_data->length > XMS_MEMORY_SIZE) return 0xA7;
+    switch (xms_side(&source, move_data->source_handle, move_data->source_offset, move_data->length)) {
+        case 1: return 0xA3;
+        case 2: return 0xA4;
+    }
+    switch (xms_side(&destination, move_data->destination_handle, move_data->destination_offset, move_data->length)) {
+        case 1: return 0xA5;
+        case 2: return 0xA6;
+    }
+    // overlapping moves within the same memory copy downwards when they go up
+    const bool backward = !move_data->source_handle == !move_data->destination_handle &&
+                          destination.start > source.start && destination.start < source.start + move_data->length;
+    memory_move(&source, &destination, move_data->length, false, backward);
+    return 0;
+}
+
+// grows in place when the KBs past the block are free, else moves it to the first run that fits
+static uint8_t xms_resize(xms_block_t *block, const uint16_t size) {
+    if (block->locks) return 0xAB;
+    if (size <= block->size) {
+        pool_mark(&xms_pool, block->start + size, block->size - size, true);
+    } else if (pool_is_free(&xms_pool, block->start + block->size, size - block->size)) {
+        pool_mark(&xms_pool, block->start + block->size, size - block->size, false);
+        xms_stats.grown_in_place++;
     } else {
-        uint32_t s = source + XMS_PSRAM_OFFSET;
-        length /= 2;
-        if (PSRAM_AVAILABLE) {
-            while (length--) {
-                writew86(destination, read16psram(s));
-                destination += 2;
-                s += 2;
-            }
-        } else {
-            while (length--) {
-                writew86(destination, swap_read16(s));
-                destination += 2;
-                s += 2;
-            }
+        pool_mark(&xms_pool, block->start, block->size, true);
+        const int32_t start = pool_find(&xms_pool, size);
+        if (start < 0) {
+            pool_mark(&xms_pool, block->start, block->size, false);
+            xms_stats.failures++;
+            return 0xA0;
         }
+        pool_mark(&xms_pool, start, size, false);
+        mem_side_t source = { (uint32_t) block->start << 10, 0, xms_locate, NULL };
+        mem_side_t destination = { (uint32_t) start << 10, 0, xms_locate, NULL };
+        memory_move(&source, &destination, (uint32_t) block->size << 10, false, start > block->start);
+        block->start = start;
+        xms_stats.moved++;
     }
+    block->size = size;
+    xms_account();
+    return 0;
 }
 
-#define to_physical_offset(offset) (((uint16_t)(((offset) >> 16) & 0xFFFF) << 4) + (uint16_t)((offset) & 0xFFFF))
-
 uint8_t __not_in_flash() xms_handler() {
     switch (CPU_AH) {
         case XMS_VERSION: {
@@ -252,6 +297,7 @@ uint8_t __not_in_flash() xms_handler() {
             CPU_AX = 1; // Success
             CPU_BL = 0;
             a20_enabled = 1;
+            memory_map_a20();
             break;
         }
         case GLOBAL_DISABLE_A20:
@@ -260,6 +306,7 @@ uint8_t __not_in_flash() xms_handler() {
             CPU_AX = 1; // Success
             CPU_BL = 0;
             a20_enabled = 0;
+            memory_map_a20();
             break;
         }
         case QUERY_A20: {
@@ -271,34 +318,47 @@ uint8_t __not_in_flash() xms_handler() {
         case QUERY_EMB: {
             // 08h
             debug_log("[XMS] Query free\r\n");
-            CPU_AX = XMS_MEMORY_SIZE >> 10;
-            CPU_DX = XMS_HANDLES - xms_handles;
-            CPU_BL = 0;
+            CPU_AX = xms_stats.largest;
+            CPU_DX = xms_stats.free;
+            CPU_BL = xms_stats.free ? 0 : 0xA0;
             break;
         }
         case ALLOCATE_EMB: {
             // Allocate Extended Memory Block (Function 09h):
             debug_log("[XMS] Allocate %dKb\n", CPU_DX);
-            if (xms_handles + 1 < XMS_HANDLES) {
-                CPU_DX = ++xms_handles;
-                CPU_AX = 1;
-                CPU_BL = 0;
+            uint16_t handle = 0;
+            while (handle < XMS_HANDLES && xms_blocks[handle].used) handle++;
+            const int32_t start = CPU_DX ? pool_find(&xms_pool, CPU_DX) : 0;
+            if (handle == XMS_HANDLES || start < 0) {
+                xms_stats.failures++;
+                CPU_AX = 0;
+                CPU_BL = handle == XMS_HANDLES ? 0xA1 : 0xA0;
                 break;
             }
-            CPU_AX = 0;
-            CPU_BL = 0xA2;
+            pool_mark(&xms_pool, start, CPU_DX, false);
+            xms_blocks[handle] = (xms_block_t) { start, CPU_DX, 1, 0 };
+            xms_handles++;
+            xms_stats.allocations++;
+            xms_account();
+            CPU_DX = handle + 1;
+            CPU_AX = 1;
+            CPU_BL = 0;
             break;
         }
         case RELEASE_EMB: {
             debug_log("[XMS] Free handle %d\n", CPU_DX);
-            if (xms_handles) {
-                xms_handles--;
-                CPU_AX = 1;
-                CPU_BL = 0;
+            xms_block_t *block = xms_block(CPU_DX);
+            if (!block || block->locks) {
+                CPU_AX = 0;
+                CPU_BL = block ? 0xAB : 0xA2;
                 break;
             }
-            CPU_AX = 0;
-            CPU_BL = 0xA2;
+            pool_mark(&xms_pool, block->start, block->size, true);
+            block->used = 0;
+            xms_handles--;
+            xms_account();
+            CPU_AX = 1;
+            CPU_BL = 0;
             break;
         }
 
@@ -313,15 +373,8 @@ uint8_t __not_in_flash() xms_handler() {
                 struct_offset++;
             }
 
-            // TODO: Add mem<>mem and xms<>xms
-            if (!move_data.source_handle) {
-                move_data.source_offset = to_physical_offset(move_data.source_offset);
-                xms_move_to(move_data.destination_offset, move_data.source_offset, move_data.length);
-            } else if (!move_data.destination_handle) {
-                move_data.destination_offset = to_physical_offset(move_data.destination_offset);
-                xms_move_from(move_data.source_offset, move_data.destination_offset, move_data.length);
-            }
-
+            // odd lengths are copied whole rather than refused with A7h
+            const uint8_t status = xms_move(&move_data);
             debug_log(
                 "[XMS] Move EMB 0x%06X\r\n\t length 0x%08X \r\n\t src_handle 0x%04X \r\n\t src_offset 0x%08X \r\n\t dest_handle 0x%04X \r\n\t dest_offset 0x%08X \r\n",
                 struct_offset,
@@ -331,73 +384,89 @@ uint8_t __not_in_flash() xms_handler() {
                 move_data.destination_handle,
                 move_data.destination_offset
             );
+            CPU_AX = !status;
+            CPU_BL = status;
+            break;
+        }
+        case LOCK_EMB: {
+            // 0Ch, the address is where the block would sit above the HMA; only the moves reach it
+            xms_block_t *block = xms_block(CPU_DX);
+            if (!block || block->locks == 0xFF) {
+                CPU_AX = 0;
+                CPU_BL = block ? 0xAC : 0xA2;
+                break;
+            }
+            block->locks++;
+            const uint32_t address = 0x110000 + ((uint32_t) block->start << 10);
+            CPU_DX = address >> 16;
+            CPU_BX = address & 0xFFFF;
+            CPU_AX = 1;
+            break;
+        }
+        case UNLOCK_EMB: {
+            xms_block_t *block = xms_block(CPU_DX);
+            if (!block || !block->locks) {
+                CPU_AX = 0;
+                CPU_BL = block ? 0xAA : 0xA2;
+                break;
+            }
+            block->locks--;
             CPU_AX = 1;
             CPU_BL = 0;
             break;
         }
+        case EMB_HANDLE_INFO: {
+            const xms_block_t *block = xms_block(CPU_DX);
+            if (!block) {
+                CPU_AX = 0;
+                CPU_BL = 0xA2;
+                break;
+            }
+            CPU_BH = block->locks;
+            CPU_BL = XMS_HANDLES - xms_handles;
+            CPU_DX = block->size;
+            CPU_AX = 1;
+            break;
+        }
+        case REALLOCATE_EMB: {
+            // 0Fh, BX = new size in KB
+            xms_block_t *block = xms_block(CPU_DX);
+            const uint8_t status = block ? xms_resize(block, CPU_BX) : 0xA2;
+            CPU_AX = !status;
+            CPU_BL = status;
+            break;
+        }
         case REQUEST_UMB: {
-            // Request Upper Memory Block (Function 10h):
-            if (CPU_DX == 0xFFFF) {
-                // Query largest available block
-                if (umb_blocks_allocated < UMB_BLOCKS_COUNT) {
-                    uint16_t sz = 0;
-                    const umb_t *umb_block = get_largest_free_umb_block(&sz);
-                    if (umb_block != NULL) {
-                        CPU_AX = 1;
-                        CPU_BX = umb_block->segment;
-                        CPU_DX = sz;
-                        CPU_BL = 0;
-                        break;
-                    }
-                }
-            } else {
-                const uint16_t requested_size = CPU_DX;
-                umb_t *umb_block = get_free_umb_block(requested_size);
-                if (umb_block != NULL) {
-                    int unmarked_size = requested_size;
-                    CPU_BX = umb_block->segment;
-                    CPU_AX = 0x0001;
-                    umb_t *ub = umb_block;
-                    int total_allocated = 0;
-                    while (unmarked_size > 0) {
-                        total_allocated += umb_block->size;
-                        umb_block->allocated_paragraphs = -1;
-                        umb_blocks_allocated++;
-                        unmarked_size -= umb_block->size;
-                        umb_block++;
-                    }
-                    ub->allocated_paragraphs = total_allocated;
-                    CPU_DX = total_allocated;
-                    break;
-                }
+            // Request Upper Memory Block (Function 10h): DX paragraphs, handed out by the KB
+            const uint32_t size = ((uint32_t) CPU_DX + 63) >> 6;
+            const int32_t start = size ? pool_find(&umb_pool, size) : -1;
+            if (start < 0) {
+                CPU_AX = 0;
+                CPU_BL = umb_tree[1].longest ? 0xB0 : 0xB1;
+                CPU_DX = umb_tree[1].longest << 6;
+                break;
             }
-
-            uint16_t sz = 0;
-            get_largest_free_umb_block(&sz);
-            CPU_AX = 0x0000;
-            CPU_DX = sz;
-            CPU_BL = umb_blocks_allocated >= UMB_BLOCKS_COUNT ? 0xB1 : 0xB0;
+            pool_mark(&umb_pool, start, size, false);
+            umb_sizes[start] = size;
+            xms_account();
+            CPU_AX = 1;
+            CPU_BX = (UMB_START >> 4) + (start << 6);
+            CPU_DX = size << 6;
             break;
         }
         case RELEASE_UMB: {
             // Release Upper Memory Block (Function 11h)
-            // Stub: Release Upper Memory Block
-            for (int i = 0; i < UMB_BLOCKS_COUNT; ++i)
-                if (umb_blocks[i].segment == CPU_BX && umb_blocks[i].allocated_paragraphs > 0) {
-                    int par = umb_blocks[i].allocated_paragraphs;
-                    while (par > 0 && i < UMB_BLOCKS_COUNT) {
-                        umb_blocks[i].allocated_paragraphs = 0;
-                        par -= umb_blocks[i++].size;
-                        umb_blocks_allocated--;
-                    }
-                    CPU_AX = 0x0001; // Success
-                    CPU_BL = 0;
-                    return 0xCB; // Early return to avoid fall-through
-                }
-
-            CPU_AX = 0x0000; // Failure
-            CPU_DX = 0x0000;
-            CPU_BL = 0xB2; // Error code
+            const uint32_t unit = (uint16_t) (CPU_BX - (UMB_START >> 4)) >> 6;
+            if (CPU_BX < UMB_START >> 4 || CPU_BX & 63 || unit >= UMB_UNITS || !umb_sizes[unit]) {
+                CPU_AX = 0;
+                CPU_BL = 0xB2;
+                break;
+            }
+            pool_mark(&umb_pool, unit, umb_sizes[unit], true);
+            umb_sizes[unit] = 0;
+            xms_account();
+            CPU_AX = 1;
+            CPU_BL = 0;
             break;
         }
         default: {
@@ -413,3 +482,18 @@ uint8_t __not_in_flash() xms_handler() {
     }
     return 0xCB; // RETF opcode
 }
+
+#if !PICO_ON_DEVICE
+void xms_snapshot(void) {
+    snapshot_blob(SNAPSHOT_TAG('X', 'M', 'S', ' '), XMS, sizeof(XMS));
+    snapshot_blob(SNAPSHOT_TAG('X', 'M', 'S', 'M'), xms_map, sizeof(xms_map));
+    snapshot_blob(SNAPSHOT_TAG('X', 'M', 'S', 'T'), xms_tree, sizeof(xms_tree));
+    snapshot_blob(SNAPSHOT_TAG('X', 'M', 'S', 'H'), xms_blocks, sizeof(xms_blocks));
+    snapshot_blob(SNAPSHOT_TAG('X', 'M', 'S', 'N'), &xms_handles, sizeof(xms_handles));
+    snapshot_blob(SNAPSHOT_TAG('U', 'M', 'B', 'M'), umb_map, sizeof(umb_map));
+    snapshot_blob(SNAPSHOT_TAG('U', 'M', 'B', 'T'), umb_tree, sizeof(umb_tree));
+    snapshot_blob(SNAPSHOT_TAG('U', 'M', 'B', 'S'), umb_sizes, sizeof(umb_sizes));
+    snapshot_blob(SNAPSHOT_TAG('X', 'M', 'S', 'S'), &xms_stats, sizeof(xms_stats));
+    snapshot_blob(SNAPSHOT_TAG('A', '2', '0', ' '), &a20_enabled, sizeof(a20_enabled));
+}
+#endif
@@ -6,16 +6,31 @@
 #include <cstdio>
 #include "MiniFB.h"
 #include "emulator/emulator.h"
+#include "emulator/swap.h"
 #include "emulator/includes/font8x16.h"
 #include "emulator/includes/font8x8.h"
 #include "emu8950.h"
 #include "linux-audio.h"
 
+// EGA/VGA 16 colour rows go through vector kernels (SSE2, AVX2 when the CPU has it, NEON on
+// arm64); -DPLANAR_SIMD=0 keeps the scalar reference they must match
+#ifndef PLANAR_SIMD
+#define PLANAR_SIMD 1
+#endif
+#if PLANAR_SIMD && defined(__SSE2__)
+#include <immintrin.h>
+#define PLANAR_X86 1
+#elif PLANAR_SIMD && defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PLANAR_NEON 1
+#endif
+
 static uint32_t ALIGN(4, SCREEN[640 * 480]);
 uint8_t ALIGN(4, DEBUG_VRAM[80 * 10]) = {0};
 
 int cursor_blink_state = 0;
 uint8_t log_debug = 0;
+static int debug_changed = 1; // DEBUG_VRAM rows need a redraw
 
 extern OPL *emu8950_opl;
 
@@ -35,6 +50,7 @@ extern "C" void _putchar(char character) {
         memset(DEBUG_VRAM + 80 * 9, 0, 80);
     }
     uint8_t *vidramptr = DEBUG_VRAM + y * 80 + x;
+    debug_changed = 1;
 
     if ((unsigned) character >= 32) {
         if (character >= 96) character -= 32;
@@ -55,6 +71,305 @@ extern "C" void _putchar(char character) {
     }
 }
 
+// Frames are drawn incrementally: a row is rasterized again only when the video memory it
+// shows was written, when the cursor or blinking text on it changed, or when anything that
+// affects every pixel (mode, start address, palettes) did. The rows drawn go out as damage.
+typedef struct {
+    int videomode;
+    uint32_t vram_offset, tga_offset;
+    uint8_t cga_intensity, cga_colorset, cga_foreground_color, cga_blinking, vga_planar_mode;
+    uint8_t tga_palette_map[16];
+    uint32_t tga_palette[16], cga_composite_palette[3][16], vga_palette[256];
+} video_state_t;
+
+typedef struct {
+    uint8_t x, y, start, end, shown;
+} cursor_state_t;
+
+static int frame_full;               // every row this frame
+static int debug_redraw;             // the DEBUG_VRAM rows this frame
+static int blink_flipped;            // blinking attributes change phase this frame
+static uint64_t text_rows_forced;    // text rows under the old and new cursor
+static mfb_rect_t damage[480];
+static int damage_count;
+static uint64_t rendered_rows;
+
+static inline int vram_changed(const void *from, const uint32_t bytes) {
+    if (frame_full) return 1;
+    const uint32_t offset = (uint32_t) ((const uint8_t *) from - (const uint8_t *) VIDEORAM);
+    return video_dirty_test(offset >> 2, ((offset & 3) + bytes + 3) >> 2);
+}
+
+// one text row: count character / attribute word pairs from cells
+static inline int text_changed(const uint32_t *cells, const int count, const int row) {
+    if (vram_changed(cells, count * 8) || text_rows_forced >> (row & 63) & 1) return 1;
+    if (blink_flipped && cga_blinking) {
+        for (int i = 0; i < count; i++) if (cells[i * 2 + 1] & 0x80) return 1;
+    }
+    return 0;
+}
+
+// Text cells are drawn from 8 pixel spans of one glyph row already resolved through cga_palette,
+// keyed by the row bits and the foreground / background pair the attribute and blink phase give.
+// cga_palette never changes, so a span is built on first use and kept.
+static uint32_t glyph_spans[256 * 256][8];
+static uint64_t glyph_spans_built[256 * 256 / 64];
+
+static inline const uint32_t *glyph_span(const uint8_t bits, const uint8_t color) {
+    const uint32_t key = color << 8 | bits;
+    uint32_t *span = glyph_spans[key];
+    if (!(glyph_spans_built[key >> 6] >> (key & 63) & 1)) {
+        for (int bit = 0; bit < 8; bit++) span[bit] = cga_palette[bits >> bit & 1 ? color & 0x0f : color >> 4];
+        glyph_spans_built[key >> 6] |= 1ull << (key & 63);
+    }
+    return span;
+}
+
+static inline uint32_t *draw_span(uint32_t *pixels, const uint32_t *span) {
+    memcpy(pixels, span, 8 * sizeof(uint32_t));
+    return pixels + 8;
+}
+
+// 40 column modes show every span pixel twice
+static inline uint32_t *draw_span_doubled(uint32_t *pixels, const uint32_t *span) {
+    for (int bit = 0; bit < 8; bit++) pixels[bit * 2] = pixels[bit * 2 + 1] = span[bit];
+    return pixels + 16;
+}
+
+// The 16 colour planar modes keep 8 pixels in each VIDEORAM word, one byte per plane
+// (P3P2P1P0, leftmost pixel in bit 7). A row is transposed into one palette index byte per
+// pixel first, then the indices are looked up in vga_palette[0..15].
+static void planar_indices_scalar(uint8_t *index, const uint32_t *vram, const int words) {
+    for (int i = 0; i < words; i++) {
+        const uint32_t planes = vram[i];
+        for (int bit = 7; bit >= 0; --bit) {
+            *index++ = (planes >> bit & 1) | (planes >> (bit + 8) & 1) << 1 |
+                       (planes >> (bit + 16) & 1) << 2 | (planes >> (bit + 24) & 1) << 3;
+        }
+    }
+}
+
+static void planar_palette_scalar(uint32_t *pixels, const uint8_t *index, const int count, const int doubled) {
+    for (int i = 0; i < count; i++) {
+        const uint32_t color = vga_palette[index[i]];
+        *pixels++ = color;
+        if (doubled) *pixels++ = color;
+    }
+}
+
+#if PLANAR_X86
+// Each 128 bit lane spreads the plane bytes of two words over 8 bytes apiece, one per pixel,
+// and tests that pixel's bit in every plane
+static void planar_indices_sse2(uint8_t *index, const uint32_t *vram, const int words) {
+    const __m128i bits = _mm_set1_epi64x(0x0102040810204080ll);
+    int i = 0;
+    for (; i + 2 <= words; i += 2, index += 16) {
+        const __m128i v = _mm_loadl_epi64((const __m128i *) (vram + i));
+        const __m128i u = _mm_unpacklo_epi8(v, v);
+        const __m128i lo = _mm_unpacklo_epi16(u, u), hi = _mm_unpackhi_epi16(u, u);
+        const __m128i p01a = _mm_unpacklo_epi32(lo, lo), p01b = _mm_unpacklo_epi32(hi, hi);
+        const __m128i p23a = _mm_unpackhi_epi32(lo, lo), p23b = _mm_unpackhi_epi32(hi, hi);
+        const __m128i p0 = _mm_unpacklo_epi64(p01a, p01b), p1 = _mm_unpackhi_epi64(p01a, p01b);
+        const __m128i p2 = _mm_unpacklo_epi64(p23a, p23b), p3 = _mm_unpackhi_epi64(p23a, p23b);
+        const __m128i i0 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(p0, bits), bits), _mm_set1_epi8(1));
+        const __m128i i1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(p1, bits), bits), _mm_set1_epi8(2));
+        const __m128i i2 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(p2, bits), bits), _mm_set1_epi8(4));
+        const __m128i i3 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(p3, bits), bits), _mm_set1_epi8(8));
+        _mm_storeu_si128((__m128i *) index, _mm_or_si128(_mm_or_si128(i0, i1), _mm_or_si128(i2, i3)));
+    }
+    planar_indices_scalar(index, vram + i, words - i);
+}
+
+__attribute__((target("avx2")))
+static void planar_indices_avx2(uint8_t *index, const uint32_t *vram, const int words) {
+    const __m256i bits = _mm256_set1_epi64x(0x0102040810204080ll);
+    int i = 0;
+    for (; i + 4 <= words; i += 4, index += 32) {
+        const __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *) (vram + i))),
+                                                  _mm_loadl_epi64((const __m128i *) (vram + i + 2)), 1);
+        const __m256i u = _mm256_unpacklo_epi8(v, v);
+        const __m256i lo = _mm256_unpacklo_epi16(u, u), hi = _mm256_unpackhi_epi16(u, u);
+        const __m256i p01a = _mm256_unpacklo_epi32(lo, lo), p01b = _mm256_unpacklo_epi32(hi, hi);
+        const __m256i p23a = _mm256_unpackhi_epi32(lo, lo), p23b = _mm256_unpackhi_epi32(hi, hi);
+        const __m256i p0 = _mm256_unpacklo_epi64(p01a, p01b), p1 = _mm256_unpackhi_epi64(p01a, p01b);
+        const __m256i p2 = _mm256_unpacklo_epi64(p23a, p23b), p3 = _mm256_unpackhi_epi64(p23a, p23b);
+        const __m256i i0 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(p0, bits), bits), _mm256_set1_epi8(1));
+        const __m256i i1 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(p1, bits), bits), _mm256_set1_epi8(2));
+        const __m256i i2 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(p2, bits), bits), _mm256_set1_epi8(4));
+        const __m256i i3 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(p3, bits), bits), _mm256_set1_epi8(8));
+        _mm256_storeu_si256((__m256i *) index, _mm256_or_si256(_mm256_or_si256(i0, i1), _mm256_or_si256(i2, i3)));
+    }
+    planar_indices_scalar(index, vram + i, words - i);
+}
+
+// vpshufb looks 32 indices up in each byte of the 16 palette colours at once; the bytes are
+// then interleaved back into pixels, which leaves pixels 0-3 and 16-19 in one register and so on
+__attribute__((target("avx2")))
+static void planar_palette_avx2(uint32_t *pixels, const uint8_t *index, const int count, const int doubled) {
+    ALIGN(16, uint8_t bytes[4][16]);
+    for (int color = 0; color < 16; color++) {
+        for (int byte = 0; byte < 4; byte++) bytes[byte][color] = vga_palette[color] >> byte * 8;
+    }
+    const __m256i b0 = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *) bytes[0]));
+    const __m256i b1 = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *) bytes[1]));
+    const __m256i b2 = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *) bytes[2]));
+    const __m256i b3 = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *) bytes[3]));
+    const int step = doubled ? 16 : 32;
+    int i = 0;
+    for (; i + step <= count; i += step, pixels += 32) {
+        __m256i v;
+        if (doubled) {
+            const __m128i x = _mm_loadu_si128((const __m128i *) (index + i));
+            v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(x, x)), _mm_unpackhi_epi8(x, x), 1);
+        } else {
+            v = _mm256_loadu_si256((const __m256i *) (index + i));
+        }
+        const __m256i c0 = _mm256_shuffle_epi8(b0, v), c1 = _mm256_shuffle_epi8(b1, v);
+        const __m256i c2 = _mm256_shuffle_epi8(b2, v), c3 = _mm256_shuffle_epi8(b3, v);
+        const __m256i lo01 = _mm256_unpacklo_epi8(c0, c1), hi01 = _mm256_unpackhi_epi8(c0, c1);
+        const __m256i lo23 = _mm256_unpacklo_epi8(c2, c3), hi23 = _mm256_unpackhi_epi8(c2, c3);
+        const __m256i r0 = _mm256_unpacklo_epi16(lo01, lo23), r1 = _mm256_unpackhi_epi16(lo01, lo23);
+        const __m256i r2 = _mm256_unpacklo_epi16(hi01, hi23), r3 = _mm256_unpackhi_epi16(hi01, hi23);
+        _mm256_storeu_si256((__m256i *) pixels, _mm256_permute2x128_si256(r0, r1, 0x20));
+        _mm256_storeu_si256((__m256i *) (pixels + 8), _mm256_permute2x128_si256(r2, r3, 0x20));
+        _mm256_storeu_si256((__m256i *) (pixels + 16), _mm256_permute2x128_si256(r0, r1, 0x31));
+        _mm256_storeu_si256((__m256i *) (pixels + 24), _mm256_permute2x128_si256(r2, r3, 0x31));
+    }
+    planar_palette_scalar(pixels, index + i, count - i, doubled);
+}
+#endif
+
+#if PLANAR_NEON
+static void planar_indices_neon(uint8_t *index, const uint32_t *vram, const int words) {
+    static const uint8_t bit_masks[16] = { 0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1, 0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1 };
+    const uint8x16_t bits = vld1q_u8(bit_masks);
+    int i = 0;
+    for (; i + 2 <= words; i += 2, index += 16) {
+        const uint8_t *planes = (const uint8_t *) (vram + i);
+        uint8x16_t out = vdupq_n_u8(0);
+        for (int plane = 0; plane < 4; plane++) {
+            const uint8x16_t spread = vcombine_u8(vdup_n_u8(planes[plane]), vdup_n_u8(planes[4 + plane]));
+            out = vorrq_u8(out, vandq_u8(vtstq_u8(spread, bits), vdupq_n_u8(1 << plane)));
+        }
+        vst1q_u8(index, out);
+    }
+    planar_indices_scalar(index, vram + i, words - i);
+}
+
+// vst4q_u8 interleaves the four looked up colour bytes straight into 16 pixels
+static void planar_palette_neon(uint32_t *pixels, const uint8_t *index, const int count, const int doubled) {
+    uint8_t bytes[4][16];
+    for (int color = 0; color < 16; color++) {
+        for (int byte = 0; byte < 4; byte++) bytes[byte][color] = vga_palette[color] >> byte * 8;
+    }
+    const uint8x16_t b0 = vld1q_u8(bytes[0]), b1 = vld1q_u8(bytes[1]), b2 = vld1q_u8(bytes[2]), b3 = vld1q_u8(bytes[3]);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const uint8x16_t x = vld1q_u8(index + i);
+        uint8x16_t v[2] = { x, x };
+        int parts = 1;
+        if (doubled) {
+            v[0] = vzip1q_u8(x, x);
+            v[1] = vzip2q_u8(x, x);
+            parts = 2;
+        }
+        for (int part = 0; part < parts; part++, pixels += 16) {
+            uint8x16x4_t colors;
+            colors.val[0] = vqtbl1q_u8(b0, v[part]);
+            colors.val[1] = vqtbl1q_u8(b1, v[part]);
+            colors.val[2] = vqtbl1q_u8(b2, v[part]);
+            colors.val[3] = vqtbl1q_u8(b3, v[part]);
+            vst4q_u8((uint8_t *) pixels, colors);
+        }
+    }
+    planar_palette_scalar(pixels, index + i, count - i, doubled);
+}
+#endif
+
+static inline void planar_indices(uint8_t *index, const uint32_t *vram, const int words) {
+#if PLANAR_X86
+    static const int avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) planar_indices_avx2(index, vram, words);
+    else planar_indices_sse2(index, vram, words);
+#elif PLANAR_NEON
+    planar_indices_neon(index, vram, words);
+#else
+    planar_indices_scalar(index, vram, words);
+#endif
+}
+
+static inline void planar_palette(uint32_t *pixels, const uint8_t *index, const int count, const int doubled) {
+#if PLANAR_X86
+    static const int avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) planar_palette_avx2(pixels, index, count, doubled);
+    else planar_palette_scalar(pixels, index, count, doubled);
+#elif PLANAR_NEON
+    planar_palette_neon(pixels, index, count, doubled);
+#else
+    planar_palette_scalar(pixels, index, count, doubled);
+#endif
+}
+
+// words VIDEORAM words make words * 8 pixels, each drawn twice when doubled
+static inline uint32_t *planar_row(uint32_t *pixels, const uint32_t *vram, const int words, const int doubled) {
+#if VGA_CHUNKY
+    // the write handlers have transposed these already
+    const uint8_t *indices = (const uint8_t *) &vga_chunky[vram - VIDEORAM];
+#else
+    static uint8_t indices[640];
+    planar_indices(indices, vram, words);
+#endif
+    planar_palette(pixels, indices, words * 8, doubled);
+    return pixels + words * 8 * (doubled + 1);
+}
+
+static void renderer_begin() {
+    static video_state_t drawn, now;
+    static cursor_state_t cursor_drawn;
+    static int blink_drawn, first = 1;
+    now.videomode = videomode;
+    now.vram_offset = vram_offset;
+    now.tga_offset = tga_offset;
+    now.cga_intensity = cga_intensity;
+    now.cga_colorset = cga_colorset;
+    now.cga_foreground_color = cga_foreground_color;
+    now.cga_blinking = cga_blinking;
+    now.vga_planar_mode = vga_planar_mode;
+    memcpy(now.tga_palette_map, tga_palette_map, sizeof(now.tga_palette_map));
+    memcpy(now.tga_palette, tga_palette, sizeof(now.tga_palette));
+    memcpy(now.cga_composite_palette, cga_composite_palette, sizeof(now.cga_composite_palette));
+    memcpy(now.vga_palette, vga_palette, sizeof(now.vga_palette));
+    frame_full = first || memcmp(&now, &drawn, sizeof(now)) != 0;
+    drawn = now;
+    first = 0;
+    // output printed while drawing shows up next frame
+    debug_redraw = debug_changed || frame_full;
+    debug_changed = 0;
+
+    const cursor_state_t cursor = { CURSOR_X, CURSOR_Y, cursor_start, cursor_end, (uint8_t) cursor_blink_state };
+    text_rows_forced = 0;
+    if (memcmp(&cursor, &cursor_drawn, sizeof(cursor))) {
+        text_rows_forced = 1ull << (cursor.y & 63) | 1ull << (cursor_drawn.y & 63);
+        cursor_drawn = cursor;
+    }
+    blink_flipped = cursor_blink_state != blink_drawn;
+    blink_drawn = cursor_blink_state;
+}
+
+static void renderer_end(const uint8_t *rows) {
+    video_dirty_clear();
+    damage_count = 0;
+    for (int y = 0; y < 480; y++) {
+        if (!rows[y]) continue;
+        rendered_rows++;
+        if (damage_count && damage[damage_count - 1].y + damage[damage_count - 1].height == y) {
+            damage[damage_count - 1].height++;
+        } else {
+            damage[damage_count++] = (mfb_rect_t) { 0, y, 640, 1 };
+        }
+    }
+}
+
 static inline void renderer() {
     static uint8_t v = 0;
     static int render_count = 0;
@@ -81,6 +396,8 @@ static inline void renderer() {
         debug_once = 0;
     }
     
+    static uint8_t rows[480];
+    renderer_begin();
     for (int y = 0; y < 480; y++) {
         if (y >= 399)
             port3DA = 8;
@@ -91,6 +408,7 @@ static inline void renderer() {
             port3DA |= 1;
 
         uint32_t *pixels = SCREEN + y * 640;
+        uint32_t *const row_start = pixels;
 
         if (y < 400)
             switch (videomode) {
@@ -101,6 +419,7 @@ static inline void renderer() {
                     // Calculate screen position
                     // Use uint32_t pointer to match VRAM layout (1 word per address)
                     uint32_t *text_buffer_line = VIDEORAM + 0x8000 + ((vram_offset & 0xffff) << 1) + y_div_16 * 80;
+                    if (!text_changed(text_buffer_line, 40, y_div_16)) break;
 
                     for (int column = 0; column < 40; column++) {
                         uint32_t char_word = *text_buffer_line++;
@@ -116,20 +435,16 @@ static inline void renderer() {
                                                 y_div_16 == CURSOR_Y && column == CURSOR_X &&
                                                 glyph_line >= cursor_start && glyph_line <= cursor_end;
 
-                        for (uint8_t bit = 0; bit < 8; bit++) {
-                            uint8_t pixel_color;
-                            if (cursor_active) {
-                                pixel_color = color & 0x0F; // Cursor foreground color
-                            } else if (cga_blinking && color >> 7 & 1) {
-                                pixel_color = cursor_blink_state ? color >> 4 & 0x7 : color & 0x7; // Blinking background color
-                            } else {
-                                pixel_color = glyph_pixels >> bit & 1 ? color & 0x0f : color >> 4;
-                                // Foreground or background color
-                            }
-
-                            // Write the pixel twice (horizontal scaling)
-                            *pixels++ = *pixels++ = cga_palette[pixel_color];
+                        const uint32_t *span;
+                        if (cursor_active) {
+                            span = glyph_span(0xff, color); // Cursor foreground color
+                        } else if (cga_blinking && color >> 7 & 1) {
+                            // Blinking cells are solid background or foreground
+                            span = glyph_span(0, (cursor_blink_state ? color >> 4 & 0x7 : color & 0x7) << 4);
+                        } else {
+                            span = glyph_span(glyph_pixels, color);
                         }
+                        pixels = draw_span_doubled(pixels, span);
                     }
 
 
@@ -143,6 +458,7 @@ static inline void renderer() {
                     // Calculate screen position
                     // Use uint32_t pointer to match VRAM layout (1 word per address)
                     uint32_t *text_row = VIDEORAM + 0x8000 + ((vram_offset & 0xffff) << 1) + y_div_16 * 160;
+                    if (!text_changed(text_row, 80, y_div_16)) break;
                     
                     for (uint8_t column = 0; column < 80; column++) {
                         // Access vidram and font data once per character
@@ -162,30 +478,23 @@ static inline void renderer() {
                                          glyph_line <= cursor_start << 1)
                                      : glyph_line >= cursor_start << 1 && glyph_line <= cursor_end << 1);
 
-                        // Unrolled bit loop: Write 8 pixels with scaling (2x horizontally)
-                        for (int bit = 0; bit < 8; bit++) {
-                            uint8_t pixel_color;
-                            if (cursor_active) {
-                                pixel_color = color & 0x0F; // Cursor foreground color
-                            } else if (cga_blinking && color >> 7 & 1) {
-                                if (cursor_blink_state) {
-                                    pixel_color = color >> 4 & 0x7; // Blinking background color
-                                } else {
-                                    pixel_color = glyph_row >> bit & 1 ? color & 0x0f : (color >> 4 & 0x7);
-                                }
-                            } else {
-                                // Foreground or background color
-                                pixel_color = glyph_row >> bit & 1 ? color & 0x0f : color >> 4;
-                            }
-
-                            *pixels++ = cga_palette[pixel_color];
+                        const uint32_t *span;
+                        if (cursor_active) {
+                            span = glyph_span(0xff, color); // Cursor foreground color
+                        } else if (cga_blinking && color >> 7 & 1) {
+                            // Blinking background color, the glyph shows in one phase only
+                            span = cursor_blink_state ? glyph_span(0, color & 0x70) : glyph_span(glyph_row, color & 0x7f);
+                        } else {
+                            span = glyph_span(glyph_row, color);
                         }
+                        pixels = draw_span(pixels, span);
                     }
                     break;
                 }
                 case 0x04:
                 case 0x05: {
                     uint8_t *cga_row = vidramptr + ((y / 2 >> 1) * 80 + (y / 2 & 1) * 8192); // Precompute CGA row pointer
+                    if (!vram_changed(cga_row, 80)) break;
                     uint8_t *current_cga_palette = (uint8_t *) cga_gfxpal[cga_colorset][cga_intensity];
 
                     // Each byte containing 4 pixels
@@ -212,6 +521,7 @@ static inline void renderer() {
                 case 0x06: {
                     // Use uint32_t pointer and word offsets
                     uint32_t *cga_row = VIDEORAM + 0x8000 + ((vram_offset & 0xffff) << 1) + (y / 2 >> 1) * 80 + (y / 2 & 1) * 8192;
+                    if (!vram_changed(cga_row, 80 * 4)) break;
 
                     // Each byte containing 8 pixels
                     for (int x = 640 / 8; x--;) {
@@ -236,6 +546,7 @@ static inline void renderer() {
                     if (y >= 348) break;
                 case 0x7: {
                     uint8_t *cga_row = vram_offset + (uint8_t*)VIDEORAM + (y & 3) * 8192 + y / 4 * cols;
+                    if (!vram_changed(cga_row, 80)) break;
                     // Each byte containing 8 pixels
                     for (int x = 640 / 8; x--;) {
                         uint8_t cga_byte = *cga_row++;
@@ -271,6 +582,7 @@ static inline void renderer() {
 
                     // Use uint32_t pointer and correct tga_offset
                     uint32_t *cga_row = VIDEORAM + tga_offset + (y / 2 >> 1) * 80 + (y / 2 & 1) * 8192; 
+                    if (!vram_changed(cga_row, 80 * 4)) break;
 
                     // Each byte containing 8 pixels
                     for (int x = 640 / 8; x--;) {    
@@ -292,6 +604,7 @@ static inline void renderer() {
                 case 0x09: /* tandy 320x200 16 color */ {
                     // Use uint32_t pointer
                     uint32_t *tga_row = VIDEORAM + tga_offset + (y / 2 & 3) * 8192 + y / 8 * 160;
+                    if (!vram_changed(tga_row, 160 * 4)) break;
 
                     // Each byte containing 4 pixels
                     for (int x = 320 / 2; x--;) {
@@ -312,6 +625,7 @@ static inline void renderer() {
                     // If A0000 is used for this mode, fine. If not, it might need 0x8000.
                     // Let's stick to simple type fix for now to match the pattern.
                     uint32_t *tga_row = VIDEORAM + y / 2 * 320; 
+                    if (!vram_changed(tga_row, 320 * 4)) break;
 
                     // Each byte contains 2 pixels
                     for (int x = 640 / 2; x--;) {
@@ -326,67 +640,27 @@ static inline void renderer() {
                 case 0x0D: /* EGA 320x200 16-color */ {
                     if (y >= 400) break;
                     uint32_t* vram_ptr = &VIDEORAM[(y / 2) * (320 / 8)];
-                    for (int i = 0; i < (320 / 8); ++i) {
-                        uint32_t eight_pixels = vram_ptr[i];
-                        uint8_t plane0 =  eight_pixels        & 0xFF;
-                        uint8_t plane1 = (eight_pixels >> 8)  & 0xFF;
-                        uint8_t plane2 = (eight_pixels >> 16) & 0xFF;
-                        uint8_t plane3 = (eight_pixels >> 24) & 0xFF;
-
-                        for (int bit = 7; bit >= 0; --bit) {
-                            uint8_t color_index = ((plane0 >> bit) & 1)
-                                                | (((plane1 >> bit) & 1) << 1)
-                                                | (((plane2 >> bit) & 1) << 2)
-                                                | (((plane3 >> bit) & 1) << 3);
-                            uint32_t color = vga_palette[color_index];
-                            *pixels++ = color;
-                            *pixels++ = color;
-                        }
-                    }
+                    if (!vram_changed(vram_ptr, 320 / 8 * 4)) break;
+                    pixels = planar_row(pixels, vram_ptr, 320 / 8, 1);
                     break;
                 }
                 case 0x0E: /* EGA 640x200 16-color */ {
                     if (y >= 400) break;
                     uint32_t* vram_ptr = &VIDEORAM[(y / 2) * (640 / 8)];
-                    for (int i = 0; i < (640 / 8); ++i) {
-                        uint32_t eight_pixels = vram_ptr[i];
-                        uint8_t plane0 =  eight_pixels        & 0xFF;
-                        uint8_t plane1 = (eight_pixels >> 8)  & 0xFF;
-                        uint8_t plane2 = (eight_pixels >> 16) & 0xFF;
-                        uint8_t plane3 = (eight_pixels >> 24) & 0xFF;
-
-                        for (int bit = 7; bit >= 0; --bit) {
-                            uint8_t color_index = ((plane0 >> bit) & 1)
-                                                | (((plane1 >> bit) & 1) << 1)
-                                                | (((plane2 >> bit) & 1) << 2)
-                                                | (((plane3 >> bit) & 1) << 3);
-                            *pixels++ = vga_palette[color_index];
-                        }
-                    }
+                    if (!vram_changed(vram_ptr, 640 / 8 * 4)) break;
+                    pixels = planar_row(pixels, vram_ptr, 640 / 8, 0);
                     break;
                 }
                 case 0x10: /* EGA 640x350 16-color */ {
                     if (y >= 350) break;
                     uint32_t* vram_ptr = &VIDEORAM[y * (640 / 8)];
-                    for (int i = 0; i < (640 / 8); ++i) {
-                        uint32_t eight_pixels = vram_ptr[i];
-                        uint8_t plane0 =  eight_pixels        & 0xFF;
-                        uint8_t plane1 = (eight_pixels >> 8)  & 0xFF;
-                        uint8_t plane2 = (eight_pixels >> 16) & 0xFF;
-                        uint8_t plane3 = (eight_pixels >> 24) & 0xFF;
-
-                        for (int bit = 7; bit >= 0; --bit) {
-                            uint8_t color_index = ((plane0 >> bit) & 1)
-                                                | (((plane1 >> bit) & 1) << 1)
-                                                | (((plane2 >> bit) & 1) << 2)
-                                                | (((plane3 >> bit) & 1) << 3);
-                            *pixels++ = vga_palette[color_index];
-                        }
-                    }
+                    if (!vram_changed(vram_ptr, 640 / 8 * 4)) break;
+                    pixels = planar_row(pixels, vram_ptr, 640 / 8, 0);
                     break;
                 }
                 case 0x11: /* VGA 640x480 2-color */ {
                     uint8_t *cga_row = (uint8_t*)VIDEORAM + y * 80;
+                    if (!vram_changed(cga_row, 80)) break;
                     // Each byte containing 8 pixels
                     for (int x = 640 / 8; x--;) {
                         uint8_t cga_byte = *cga_row++;
@@ -406,25 +680,15 @@ static inline void renderer() {
                 case 0x12: /* VGA 640x480 16-color */ {
                     if (y >= 480) break;
                     uint32_t* vram_ptr = &VIDEORAM[y * (640 / 8)];
-                    for (int i = 0; i < (640 / 8); ++i) {
-                        uint32_t eight_pixels = vram_ptr[i];
-                        uint8_t plane0 =  eight_pixels        & 0xFF;
-                        uint8_t plane1 = (eight_pixels >> 8)  & 0xFF;
-                        uint8_t plane2 = (eight_pixels >> 16) & 0xFF;
-                        uint8_t plane3 = (eight_pixels >> 24) & 0xFF;
-
-                        for (int bit = 7; bit >= 0; --bit) {
-                            uint8_t color_index = ((plane0 >> bit) & 1)
-                                                | (((plane1 >> bit) & 1) << 1)
-                                                | (((plane2 >> bit) & 1) << 2)
-                                                | (((plane3 >> bit) & 1) << 3);
-                            *pixels++ = vga_palette[color_index];
-                        }
-                    }
+                    if (!vram_changed(vram_ptr, 640 / 8 * 4)) break;
+                    pixels = planar_row(pixels, vram_ptr, 640 / 8, 0);
                     break;
                 }
                 case 0x13: {
                     if (vga_planar_mode) {
+                        const uint32_t *plane = VIDEORAM + vram_offset + (y >> 1) * 80;
+                        if (!vram_changed(plane, 80 * 4) && !vram_changed(plane + vga_plane_size, 80 * 4) &&
+                            !vram_changed(plane + vga_plane_size * 2, 80 * 4) && !vram_changed(plane + vga_plane_size * 3, 80 * 4)) break;
                         for (int x = 0; x < 320; x++) {
                             uint32_t ptr = x + (y >> 1) * 320;
                             ptr = (ptr >> 2) + (x & 3) * vga_plane_size;
@@ -435,6 +699,7 @@ static inline void renderer() {
                     } else {
                         // Standard chain-4 mode
                         uint32_t *vga_row = VIDEORAM + (y >> 1) * 320;
+                        if (!vram_changed(vga_row, 320 * 4)) break;
                         for (int x = 0; x < 320; x++) {
                             uint32_t val = *vga_row++;
                             uint32_t color = vga_palette[val & 0xFF];
@@ -452,6 +717,7 @@ static inline void renderer() {
                     // Calculate screen position
                     // Use uint32_t pointer
                     uint32_t *cga_row = VIDEORAM + 0x8000 + ((vram_offset & 0xffff) << 1) + y_div_4 * 160;
+                    if (!vram_changed(cga_row, cols * 8)) break;
                     
                     for (uint8_t column = 0; column < cols; column++) {
                         // Access vidram and font data once per character
@@ -462,10 +728,7 @@ static inline void renderer() {
                         uint8_t glyph_row = font_8x8[(char_val & 0xFF) * 8 + odd_even]; // Glyph row from font
                         uint8_t color = attr_val & 0xFF;
 
-#pragma GCC unroll(8)
-                        for (uint8_t bit = 0; bit < 8; bit++) {
-                            *pixels++ = cga_palette[glyph_row >> bit & 1 ? color & 0x0f : color >> 4];
-                        }
+                        pixels = draw_span(pixels, glyph_span(glyph_row, color));
                     }
                     break;
                 }
@@ -474,6 +737,7 @@ static inline void renderer() {
                     // Calculate screen position
                     // Use uint32_t pointer
                     uint32_t *cga_row = VIDEORAM + 0x8000 + ((vram_offset & 0xffff) << 1) + y_div_2 * 80 + (y_div_2 & 1 * 8192);
+                    if (!vram_changed(cga_row, 40 * 8)) break;
 
                     for (int column = 0; column < 40; column++) {
                         // Access vidram and font data once per character
@@ -485,10 +749,7 @@ static inline void renderer() {
                         uint8_t glyph_row = font_8x8[(char_val & 0xFF) * 8]; // Glyph row from font
                         uint8_t color = attr_val & 0xFF;
 
-#pragma GCC unroll(8)
-                        for (int bit = 0; bit < 8; bit++) {
-                            *pixels++ = *pixels++ = cga_palette[glyph_row >> bit & 1 ? color & 0x0f : color >> 4];
-                        }
+                        pixels = draw_span_doubled(pixels, glyph_span(glyph_row, color));
                     }
                     break;
                 }
@@ -498,6 +759,7 @@ static inline void renderer() {
                     // Calculate screen position
                     // Use uint32_t pointer
                     uint32_t *cga_row = VIDEORAM + 0x8000 + ((vram_offset & 0xffff) << 1) + y_div_2 * 80 + (y_div_2 & 1 * 8192);
+                    if (!vram_changed(cga_row, 40 * 8)) break;
                     
                     for (int column = 0; column < 40; column++) {
                         // Access vidram and font data once per character
@@ -509,10 +771,7 @@ static inline void renderer() {
                         uint8_t glyph_row = font_8x8[(char_val & 0xFF) * 8 + (y_div_2 % 8)]; // Glyph row from font
                         uint8_t color = attr_val & 0xFF;
 
-#pragma GCC unroll(8)
-                        for (int bit = 0; bit < 8; bit++) {
-                            *pixels++ = *pixels++ = cga_palette[glyph_row >> bit & 1 ? color & 0x0f : color >> 4];
-                        }
+                        pixels = draw_span_doubled(pixels, glyph_span(glyph_row, color));
                     }
                     break;
                 }
@@ -520,7 +779,7 @@ static inline void renderer() {
                     printf("Unsupported videomode %x\n", videomode);
                     break;
             }
-        else {
+        else if (debug_redraw) {
             uint8_t ydebug = y - 400;
             uint8_t y_div_8 = ydebug / 8;
             uint8_t glyph_line = ydebug % 8;
@@ -532,17 +791,15 @@ static inline void renderer() {
                 const uint8_t character = *text_buffer_line++;
                 const uint8_t color = colors[character >> 6];
                 uint8_t glyph_pixels = font_8x8[(32 + (character & 63)) * 8 + glyph_line];
-                // Read from fast palette lookup table for 2-bit color combinations
-                // Unrolled bit loop: Write 8 pixels with scaling (2x horizontally)
-                for (int bit = 0; bit < 8; bit++) {
-                    *pixels++ = cga_palette[glyph_pixels >> bit & 1 ? color & 0x0f : color >> 4];
-                }
+                pixels = draw_span(pixels, glyph_span(glyph_pixels, color));
             }
         }
+        rows[y] = pixels != row_start;
     }
+    renderer_end(rows);
 }
 
-extern "C" void HandleInput(unsigned int keycode, int isKeyDown) {
+static unsigned char keycode_to_scancode(unsigned int keycode) {
     // Convert X11 keycode to PC scancode
     unsigned char scancode = 0;
 
@@ -706,6 +963,11 @@ extern "C" void HandleInput(unsigned int keycode, int isKeyDown) {
         default: scancode = 0;
             break;
     }
+    return scancode;
+}
+
+extern "C" void HandleInput(unsigned int keycode, int isKeyDown) {
+    unsigned char scancode = keycode_to_scancode(keycode);
 
     if (!isKeyDown && scancode != 0) {
         scancode |= 0x80;
@@ -767,85 +1029,416 @@ void *sound_thread(void *arg) {
     return NULL;
 }
 
-void *ticks_thread(void *arg) {
-    struct timespec start, current;
-    clock_gettime(CLOCK_MONOTONIC, &start);
+extern "C" uint64_t sb_samplerate;
 
-    uint64_t elapsed_system_timer = 0;
-    uint64_t elapsed_blink_tics = 0;
-    uint64_t elapsed_frame_tics = 0;
-    uint64_t last_dss_tick = 0;
-    uint64_t last_sb_tick = 0;
-    uint64_t last_sound_tick = 0;
+static int16_t last_dss_sample = 0;
+static int16_t last_sb_sample = 0;
+static volatile int frame_ready = 0;
 
-    int16_t last_dss_sample = 0;
-    int16_t last_sb_sample = 0;
+// Device timing runs off the emulated-cycle scheduler, the host only paces exec86 to wall time
 
-    const uint64_t hostfreq = 1000000000; // nanoseconds
+static void dss_event() {
+    // Disney Sound Source frequency ~7KHz
+    last_dss_sample = dss_sample();
+}
 
-    while (running) {
-        clock_gettime(CLOCK_MONOTONIC, &current);
+static void sb_event() {
+    static uint64_t rate = 0;
+    last_sb_sample = blaster_sample();
+    if (rate != sb_samplerate) {
+        rate = sb_samplerate;
+        sched_every(SCHED_SB, SCHED_HZ(rate), sb_event);
+    }
+}
 
-        uint64_t elapsedTime = (current.tv_sec - start.tv_sec) * hostfreq + (current.tv_nsec - start.tv_nsec);
+static void audio_event() {
+    get_sound_sample(last_dss_sample + last_sb_sample, &audio_buffer[sample_index]);
+    sample_index += 2;
 
-        // Timer interrupt (~18.2 Hz)
-        if (elapsedTime - elapsed_system_timer >= hostfreq / timer_period) {
-            doirq(0);
-            elapsed_system_timer = elapsedTime;
-        }
+    if (sample_index >= AUDIO_BUFFER_LENGTH * 2) {
+        pthread_mutex_lock(&update_mutex);
+        update_ready = 1;
+        pthread_cond_signal(&update_cond);
+        pthread_mutex_unlock(&update_mutex);
+        sample_index = 0;
+    }
+}
 
-        // Disney Sound Source frequency ~7KHz
-        if (elapsedTime - last_dss_tick >= hostfreq / 7000) {
-            last_dss_sample = dss_sample();
-            last_dss_tick = elapsedTime;
-        }
+static void blink_event() {
+    cursor_blink_state ^= 1;
+}
 
-        // Sound Blaster
-        if (elapsedTime - last_sb_tick >= hostfreq / 22050) {
-            last_sb_sample = blaster_sample();
-            last_sb_tick = elapsedTime;
-        }
+static void frame_event() {
+    renderer();
+    frame_ready = 1;
+}
 
-        // Audio samples
-        if (elapsedTime - last_sound_tick >= hostfreq / SOUND_FREQUENCY) {
-            get_sound_sample(last_dss_sample + last_sb_sample, &audio_buffer[sample_index]);
-            sample_index += 2;
-            
-
-            if (sample_index >= AUDIO_BUFFER_LENGTH * 2) {
-                pthread_mutex_lock(&update_mutex);
-                update_ready = 1;
-                pthread_cond_signal(&update_cond);
-                pthread_mutex_unlock(&update_mutex);
-                sample_index = 0;
+static uint64_t host_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Sleep while emulated time is ahead of wall time. When the host falls more than
+// 100 ms behind, emulated time simply runs slower instead of bursting to catch up.
+static void pace_to_host() {
+    static uint64_t host_start, sched_start;
+    const uint64_t host = host_ns();
+    if (!host_start) {
+        host_start = host;
+        sched_start = sched_now;
+        return;
+    }
+    const uint64_t emulated = (sched_now - sched_start) * 1000000000ull / SCHED_CPU_HZ;
+    const uint64_t elapsed = host - host_start;
+    if (emulated > elapsed) {
+        const uint64_t ahead = emulated - elapsed;
+        struct timespec ts = { (time_t) (ahead / 1000000000ull), (long) (ahead % 1000000000ull) };
+        nanosleep(&ts, NULL);
+    } else if (elapsed - emulated > 100000000ull) {
+        host_start = host;
+        sched_start = sched_now;
+    }
+}
+
+// Headless runner: no window and no audio device, exec86 runs as fast as the host allows until
+// a stop condition hits, then a JSON report is written. Keys come from a script, one command
+// per line:
+//   wait MS      let MS milliseconds of emulated time pass
+//   until TEXT   wait until TEXT shows up in text mode video memory
+//   type TEXT    type TEXT, \n is Enter, \t is Tab
+//   key CODE     press and release a raw scancode, e.g. key 0x01 for Esc
+// Instructions are the steps exec86 ran minus idle skips and the second step of string elements,
+// so a REP string instruction counts once per element whether it ran in bulk or not. The report
+// goes to stdout or --report FILE; everything else the emulator prints goes to stderr.
+#define HEADLESS_KEY_GAP (SCHED_CPU_HZ / 100) // scancodes are fed to the guest 10 ms apart
+
+static struct {
+    uint64_t max_instructions;
+    uint64_t max_cycles;
+    const char *text;
+    const char *report;
+    FILE *script;
+    int render; // rasterize every frame as the window would, to measure the renderer
+} headless;
+
+static uint8_t key_queue[1024];
+static uint32_t key_head = 0, key_tail = 0;
+static uint64_t key_next = 0, script_resume = 0;
+static char script_until[256];
+static uint32_t headless_frames = 0;
+static int text_check = 0;
+
+static int text_on_screen(const char *text) {
+    if (videomode > 3) {
+        return 0;
+    }
+    // same layout as the text mode renderer: one 32-bit word per character or attribute byte
+    char screen[80 * 25 + 1];
+    const uint32_t base = 0x8000 + ((vram_offset & 0xffff) << 1);
+    for (int i = 0; i < 80 * 25; i++) {
+        const uint8_t c = VIDEORAM[(base + i * 2) & (VIDEORAM_SIZE - 1)] & 0xff;
+        screen[i] = c ? c : ' ';
+    }
+    screen[80 * 25] = 0;
+    return strstr(screen, text) != NULL;
+}
+
+static void queue_key(const uint8_t scancode) {
+    if (key_tail - key_head < sizeof(key_queue)) {
+        key_queue[key_tail++ % sizeof(key_queue)] = scancode;
+    }
+}
+
+static void queue_char(char c) {
+    static const char shifted[] = "~!@#$%^&*()_+{}|:\"<>?";
+    static const char unshifted[] = "`1234567890-=[]\\;',./";
+    int shift = c >= 'A' && c <= 'Z';
+    const char *s = c ? strchr(shifted, c) : NULL;
+    if (s) {
+        c = unshifted[s - shifted];
+        shift = 1;
+    } else if (c >= 'a' && c <= 'z') {
+        c -= 32;
+    } else if (c == '\n') {
+        c = 13;
+    }
+    const uint8_t scancode = keycode_to_scancode((uint8_t) c);
+    if (!scancode) {
+        return;
+    }
+    if (shift) queue_key(0x2A);
+    queue_key(scancode);
+    queue_key(scancode | 0x80);
+    if (shift) queue_key(0xAA);
+}
+
+// runs script lines until one of them has to wait for the guest
+static void script_step() {
+    char line[256];
+    while (headless.script && key_head == key_tail && sched_now >= script_resume && !script_until[0]) {
+        if (!fgets(line, sizeof(line), headless.script)) {
+            fclose(headless.script);
+            headless.script = NULL;
+            return;
+        }
+        line[strcspn(line, "\r\n")] = 0;
+        char *arg = strchr(line, ' ');
+        arg = arg ? arg + 1 : line + strlen(line);
+        if (!strncmp(line, "wait ", 5)) {
+            script_resume = sched_now + strtoull(arg, NULL, 0) * (SCHED_CPU_HZ / 1000);
+        } else if (!strncmp(line, "until ", 6)) {
+            strncpy(script_until, arg, sizeof(script_until) - 1);
+        } else if (!strncmp(line, "type ", 5)) {
+            for (; *arg; arg++) {
+                if (arg[0] == '\\' && arg[1] == 'n') {
+                    queue_char('\n');
+                    arg++;
+                } else if (arg[0] == '\\' && arg[1] == 't') {
+                    queue_char('\t');
+                    arg++;
+                } else {
+                    queue_char(*arg);
+                }
             }
+        } else if (!strncmp(line, "key ", 4)) {
+            const uint8_t scancode = strtoul(arg, NULL, 0) & 0x7f;
+            queue_key(scancode);
+            queue_key(scancode | 0x80);
+        } else if (line[0] && line[0] != '#') {
+            printf("Headless: unknown script line '%s'\n", line);
+        }
+    }
+}
+
+static void headless_frame_event() {
+    headless_frames++;
+    if (headless.render) renderer();
+    text_check = 1;
+}
+
+static void json_counts(FILE *out, const char *name, const uint32_t *counts, const int n) {
+    fprintf(out, "  \"%s\": [", name);
+    for (int i = 0; i < n; i++) {
+        fprintf(out, "%s%u", i ? ", " : "", counts[i]);
+    }
+    fprintf(out, "],\n");
+}
+
+// --swap runs guest memory through the pager (swap.c) like a Pico without PSRAM does
+static uint8_t memory_backend = MEM_BACKEND_OB;
 
-            last_sound_tick = elapsedTime;
+static int headless_main(const char *restore_path, const char *save_path) {
+    // keep stdout for the report and send BIOS, disk and renderer messages to stderr
+    fflush(stdout);
+    FILE *const report_out = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    memory_init(memory_backend);
+    emu8950_opl = OPL_new(3579552, SOUND_FREQUENCY);
+    blaster_reset();
+    sn76489_reset();
+    reset86();
+
+    init8253();
+    sched_every(SCHED_DSS, SCHED_HZ(7000), dss_event);
+    sched_every(SCHED_SB, SCHED_HZ(sb_samplerate), sb_event);
+    sched_every(SCHED_BLINK, SCHED_HZ(3), blink_event);
+    sched_every(SCHED_FRAME, SCHED_HZ(60), headless_frame_event);
+    if (restore_path && !snapshot_load(restore_path)) {
+        printf("Snapshot %s not restored, booting\n", restore_path);
+    }
+
+    const uint64_t start_cycles = sched_now, start_idle = cpu_idle_cycles, start_extra = cpu_extra_steps;
+    const uint64_t start_ns = host_ns();
+    const char *stop = "signal";
+    while (running) {
+        const uint64_t cycles = sched_now - start_cycles;
+        const uint64_t instructions = cycles - (cpu_idle_cycles - start_idle) - (cpu_extra_steps - start_extra);
+        if (headless.max_instructions && instructions >= headless.max_instructions) {
+            stop = "instructions";
+            break;
+        }
+        if (headless.max_cycles && cycles >= headless.max_cycles) {
+            stop = "time";
+            break;
+        }
+        if (port_watch_hit) {
+            stop = "port";
+            break;
+        }
+        if (text_check) {
+            text_check = 0;
+            if (headless.text && text_on_screen(headless.text)) {
+                stop = "text";
+                break;
+            }
+            if (script_until[0] && text_on_screen(script_until)) {
+                script_until[0] = 0;
+            }
         }
 
-        // Cursor blink
-        if (elapsedTime - elapsed_blink_tics >= 333333333) {
-            // ~3Hz
-            cursor_blink_state ^= 1;
-            elapsed_blink_tics = elapsedTime;
+        script_step();
+        if (key_head != key_tail && sched_now >= key_next) {
+            port60 = key_queue[key_head++ % sizeof(key_queue)];
+            port64 |= 2;
+            doirq(1);
+            key_next = sched_now + HEADLESS_KEY_GAP;
         }
 
-        // Frame rendering (60 FPS)
-        if (elapsedTime - elapsed_frame_tics >= 16666666) {
-            // ~60Hz
-            renderer();
-            elapsed_frame_tics = elapsedTime;
+        uint64_t slice = SCHED_CPU_HZ / 1000;
+        if (headless.max_instructions && headless.max_instructions - instructions < slice) {
+            slice = headless.max_instructions - instructions;
         }
+        if (headless.max_cycles && headless.max_cycles - cycles < slice) {
+            slice = headless.max_cycles - cycles;
+        }
+        exec86(slice);
+    }
 
-        // No sleep - let the timing be controlled by clock precision
+    const double wall = (host_ns() - start_ns) / 1e9;
+    if (save_path && !snapshot_save(save_path)) {
+        printf("Failed to save snapshot to %s\n", save_path);
     }
-    return NULL;
+    const uint64_t cycles = sched_now - start_cycles;
+    const uint64_t instructions = cycles - (cpu_idle_cycles - start_idle) - (cpu_extra_steps - start_extra);
+    FILE *out = headless.report ? fopen(headless.report, "w") : report_out;
+    if (!out) {
+        printf("Headless: cannot write report %s\n", headless.report);
+        out = report_out;
+    }
+    fflush(stdout);
+    fprintf(out, "{\n");
+    fprintf(out, "  \"stop\": \"%s\",\n", stop);
+    fprintf(out, "  \"instructions\": %llu,\n", (unsigned long long) instructions);
+    fprintf(out, "  \"idle_cycles\": %llu,\n", (unsigned long long) (cpu_idle_cycles - start_idle));
+    fprintf(out, "  \"emulated_seconds\": %.6f,\n", (double) cycles / SCHED_CPU_HZ);
+    fprintf(out, "  \"wall_seconds\": %.6f,\n", wall);
+    fprintf(out, "  \"emulated_mips\": %.3f,\n", wall > 0 ? instructions / wall / 1e6 : 0.0);
+    fprintf(out, "  \"frames\": %u,\n", headless_frames);
+    if (headless.render) {
+        fprintf(out, "  \"rendered_rows\": %llu,\n", (unsigned long long) rendered_rows);
+    }
+    json_counts(out, "irqs", i8259_delivered, 8);
+#if DECODE_CACHE_BITS
+    fprintf(out, "  \"decode_cache\": { \"hits\": %llu, \"misses\": %llu, \"uncached\": %llu },\n",
+            (unsigned long long) decode_cache_hits, (unsigned long long) decode_cache_misses,
+            (unsigned long long) decode_cache_uncached);
+#endif
+    if (port_watch >= 0) {
+        fprintf(out, "  \"port_value\": %u,\n", port_watch_hit ? port_watch_value : 0);
+    }
+    if (mem_backend == MEM_BACKEND_SW) {
+        fprintf(out, "  \"swap\": { \"hits\": %llu, \"misses\": %llu, \"zero_fills\": %llu, \"readahead\": %llu, \"writebacks\": %llu, "
+                "\"zero_pages\": %llu, \"zpool_stores\": %llu, \"zpool_loads\": %llu, \"zpool_spills\": %llu, \"zpool_bytes\": %llu, "
+                "\"reads\": %llu, \"writes\": %llu, \"bytes_read\": %llu, \"bytes_written\": %llu },\n",
+                (unsigned long long) (swap_stats.lookups - swap_stats.misses), (unsigned long long) swap_stats.misses,
+                (unsigned long long) swap_stats.zero_fills, (unsigned long long) swap_stats.readahead,
+                (unsigned long long) swap_stats.writebacks, (unsigned long long) swap_stats.zero_pages,
+                (unsigned long long) swap_stats.zpool_stores, (unsigned long long) swap_stats.zpool_loads,
+                (unsigned long long) swap_stats.zpool_spills, (unsigned long long) swap_stats.zpool_bytes,
+                (unsigned long long) swap_stats.reads, (unsigned long long) swap_stats.writes,
+                (unsigned long long) swap_stats.bytes_read, (unsigned long long) swap_stats.bytes_written);
+    }
+    fprintf(out, "  \"xms\": { \"free_kb\": %u, \"largest_kb\": %u, \"umb_free_kb\": %u, \"umb_largest_kb\": %u, "
+            "\"allocations\": %u, \"failures\": %u, \"grown_in_place\": %u, \"moved\": %u },\n",
+            xms_stats.free, xms_stats.largest, xms_stats.umb_free, xms_stats.umb_largest,
+            xms_stats.allocations, xms_stats.failures, xms_stats.grown_in_place, xms_stats.moved);
+    static const char *drive_names[4] = { "fd0", "fd1", "hd0", "hd1" };
+    fprintf(out, "  \"disks\": {\n");
+    for (int i = 0; i < 4; i++) {
+        fprintf(out, "    \"%s\": { \"reads\": %u, \"writes\": %u, \"sectors_read\": %llu, \"sectors_written\": %llu }%s\n",
+                drive_names[i], disk_io[i].reads, disk_io[i].writes,
+                (unsigned long long) disk_io[i].sectors_read, (unsigned long long) disk_io[i].sectors_written,
+                i < 3 ? "," : "");
+    }
+    fprintf(out, "  }\n}\n");
+    if (out != report_out) {
+        fclose(out);
+    }
+    fclose(report_out);
+    // a run that was waiting for the guest but ran out of time or instructions failed
+    const int waited = headless.text || port_watch >= 0;
+    return waited && (!strcmp(stop, "time") || !strcmp(stop, "instructions")) ? 1 : 0;
 }
 
-int main() {
+int main(int argc, char **argv) {
+    // --restore FILE resumes from a snapshot, --save FILE writes one on exit, --fd0/--fd1/--hd0/--hd1
+    // pick disk images, --swap pages guest memory, --swap-trace FILE also records the pager's accesses
+    // for tools/swapsim; --headless runs without window or audio, see headless_main for the rest
+    const char *restore_path = NULL, *save_path = NULL;
+    int headless_mode = 0;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i], *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(arg, "--headless")) {
+            headless_mode = 1;
+            continue;
+        }
+        if (!strcmp(arg, "--render")) {
+            headless.render = 1;
+            continue;
+        }
+        if (!strcmp(arg, "--swap")) {
+            if (memory_backend != MEM_BACKEND_SW && !init_swap()) {
+                printf("Cannot create the pagefile\n");
+                return -1;
+            }
+            memory_backend = MEM_BACKEND_SW;
+            continue;
+        }
+        if (!value) {
+            printf("Missing value for %s\n", arg);
+            return -1;
+        }
+        i++;
+        if (!strcmp(arg, "--restore")) {
+            restore_path = value;
+        } else if (!strcmp(arg, "--save")) {
+            save_path = value;
+        } else if (!strcmp(arg, "--swap-trace")) {
+            // implies --swap, the trace records what the pager sees
+            if ((memory_backend != MEM_BACKEND_SW && !init_swap()) || !swap_trace_open(value)) {
+                printf("Cannot set up the pagefile or the trace %s\n", value);
+                return -1;
+            }
+            memory_backend = MEM_BACKEND_SW;
+        } else if (!strcmp(arg, "--fd0")) {
+            disk_images[0] = value;
+        } else if (!strcmp(arg, "--fd1")) {
+            disk_images[1] = value;
+        } else if (!strcmp(arg, "--hd0")) {
+            disk_images[2] = value;
+        } else if (!strcmp(arg, "--hd1")) {
+            disk_images[3] = value;
+        } else if (!strcmp(arg, "--keys")) {
+            headless.script = fopen(value, "r");
+            if (!headless.script) {
+                printf("Cannot open key script %s\n", value);
+                return -1;
+            }
+        } else if (!strcmp(arg, "--max-instructions")) {
+            headless.max_instructions = strtoull(value, NULL, 0);
+        } else if (!strcmp(arg, "--max-time")) {
+            headless.max_cycles = (uint64_t) (atof(value) * SCHED_CPU_HZ);
+        } else if (!strcmp(arg, "--stop-port")) {
+            port_watch = (int32_t) (strtoul(value, NULL, 0) & 0xffff);
+        } else if (!strcmp(arg, "--stop-text")) {
+            headless.text = value;
+        } else if (!strcmp(arg, "--report")) {
+            headless.report = value;
+        } else {
+            printf("Unknown option %s\n", arg);
+            return -1;
+        }
+    }
+
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
+    if (headless_mode) {
+        return headless_main(restore_path, save_path);
+    }
+
     printf("Opening window...\n");
     fflush(stdout);
     
@@ -858,12 +1451,7 @@ int main() {
     fflush(stdout);
 
     // Initialize memory access functions (required before reset86!)
-    write86 = write86_ob;
-    writew86 = writew86_ob;
-    writedw86 = writedw86_ob;
-    read86 = read86_ob;
-    readw86 = readw86_ob;
-    readdw86 = readdw86_ob;
+    memory_init(memory_backend);
 
     // Test: fill screen with blue to verify rendering works
     for (int i = 0; i < 640 * 480; i++) {
@@ -897,39 +1485,56 @@ int main() {
         printf("Audio: Failed to initialize, continuing without audio\n");
     }
 
-    pthread_t sound_tid, ticks_tid;
+    init8253();
+    sched_every(SCHED_DSS, SCHED_HZ(7000), dss_event);
+    sched_every(SCHED_SB, SCHED_HZ(sb_samplerate), sb_event);
+    sched_every(SCHED_AUDIO, SCHED_HZ(SOUND_FREQUENCY), audio_event);
+    sched_every(SCHED_BLINK, SCHED_HZ(3), blink_event);
+    sched_every(SCHED_FRAME, SCHED_HZ(60), frame_event);
+
+    if (restore_path) {
+        printf(snapshot_load(restore_path) ? "Restored %s\n" : "Snapshot %s not restored, booting\n", restore_path);
+    }
+
+    pthread_t sound_tid;
     pthread_create(&sound_tid, NULL, sound_thread, NULL);
-    pthread_create(&ticks_tid, NULL, ticks_thread, NULL);
 
     printf("Starting main loop...\n");
     fflush(stdout);
     
     int frame_count = 0;
     while (running) {
-        exec86(32768);  // Reduced from 32768 to allow more frequent audio updates
-        
-        if (frame_count == 0) {
+        exec86(SCHED_CPU_HZ / 1000); // ~1 ms of emulated time per slice
+
+        // input is polled every slice, the window is only redrawn where a new frame changed it
+        const int present = frame_ready && damage_count;
+        frame_ready = 0;
+
+        if (present && frame_count == 0) {
             printf("First mfb_update call...\n");
             fflush(stdout);
         }
         
-        if (mfb_update(SCREEN, 0) < 0) {
+        if (mfb_update_rects(present ? SCREEN : NULL, damage, damage_count, 0) < 0) {
             printf("mfb_update failed, exiting\n");
             running = 0;
             break;
         }
         
-        frame_count++;
-        if (frame_count == 60) {
+        if (present && ++frame_count == 60) {
             printf("60 frames rendered\n");
             fflush(stdout);
         }
+
+        pace_to_host();
     }
 
     pthread_cancel(sound_tid);
-    pthread_cancel(ticks_tid);
     pthread_join(sound_tid, NULL);
-    pthread_join(ticks_tid, NULL);
+
+    if (save_path && !snapshot_save(save_path)) {
+        printf("Failed to save snapshot to %s\n", save_path);
+    }
 
     // Clean up audio
     linux_audio_close();
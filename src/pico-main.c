@@ -331,6 +331,7 @@ void __time_critical_func() second_core(void) {
         // Timer interrupt handling
         if (tick >= last_timer_tick + timer_period) {
             doirq(0);
+            __sev(); // wake core 0 if it waits in HLT or an idle keyboard poll
             last_timer_tick = tick;
         }
 
@@ -782,28 +783,13 @@ int main(void) {
     psram_init(gp);
     if (!butter_psram_size) {
         if (init_psram() ) {
-            write86 = write86_mp;
-            writew86 = writew86_mp;
-            writedw86 = writedw86_mp;
-            read86 = read86_mp;
-            readw86 = readw86_mp;
-            readdw86 = readdw86_mp;
+            memory_init(MEM_BACKEND_MP);
         } else {
             init_swap();
-            write86 = write86_sw;
-            writew86 = writew86_sw;
-            writedw86 = writedw86_sw;
-            read86 = read86_sw;
-            readw86 = readw86_sw;
-            readdw86 = readdw86_sw;
+            memory_init(MEM_BACKEND_SW);
         }
     } else {
-        write86 = write86_ob;
-        writew86 = writew86_ob;
-        writedw86 = writedw86_ob;
-        read86 = read86_ob;
-        readw86 = readw86_ob;
-        readdw86 = readdw86_ob;
+        memory_init(MEM_BACKEND_OB);
     }
 
     // Initialize semaphore and launch second core FIRST
@@ -846,7 +832,7 @@ int main(void) {
             printf("PSRAM max %d MHz [T%p]\n", psram_mhz, qmi_hw->m[1].timing);
         }
         printf("On-Board-PSRAM mode (GP%d)\n", gp);
-    } else if (write86 == write86_mp) {
+    } else if (mem_backend == MEM_BACKEND_MP) {
         printf("Murmulator-Board-PSRAM mode\n");
     } else {
         printf("Swap-RAM mode (8 MB)\n");
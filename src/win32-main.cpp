@@ -278,6 +278,10 @@ static INLINE void renderer() {
                     break;
                 }
                 case 0x0D: /* EGA 320x200 16-color */ {
+#if VGA_CHUNKY
+                    const uint8_t *indices = (const uint8_t *) &vga_chunky[(y / 2) * 40];
+                    for (int x = 0; x < 320; x++, pixels += 2) pixels[0] = pixels[1] = vga_palette[indices[x]];
+#else
                     const uint32_t *ega_row = &VIDEORAM[(y / 2) * 40];
                     for (int i = 0; i < 40; i++) {
                         uint32_t ega_planes = *ega_row++;
@@ -295,9 +299,14 @@ static INLINE void renderer() {
                         *pixels++ = *pixels++ = vga_palette[eight_pixels >> 4 & 0xF];
                         *pixels++ = *pixels++ = vga_palette[eight_pixels & 0xF];
                     }
+#endif
                     break;
                 }
                 case 0x0E: /* EGA 640x200 16-color */ {
+#if VGA_CHUNKY
+                    const uint8_t *indices = (const uint8_t *) &vga_chunky[(y / 2) * 80];
+                    for (int x = 0; x < 640; x++) *pixels++ = vga_palette[indices[x]];
+#else
                     const uint32_t *ega_row = &VIDEORAM[(y / 2) * 80];
                     for (int i = 0; i < 80; i++) {
                         uint32_t ega_planes = *ega_row++;
@@ -315,11 +324,16 @@ static INLINE void renderer() {
                         *pixels++ = vga_palette[eight_pixels >> 4 & 0xF];
                         *pixels++ = vga_palette[eight_pixels & 0xF];
                     }
+#endif
                     break;
                 }
                 case 0x10: /* EGA 640x350 16-color */
                     if (y >= 350) break;
                 case 0x12: /* VGA 640x480 16-color */ {
+#if VGA_CHUNKY
+                    const uint8_t *indices = (const uint8_t *) &vga_chunky[y * 80];
+                    for (int x = 0; x < 640; x++) *pixels++ = vga_palette[indices[x]];
+#else
                     const uint32_t *ega_row = &VIDEORAM[y * 80];
                     for (int i = 0; i < 80; i++) {
                         uint32_t ega_planes = *ega_row++;
@@ -337,6 +351,7 @@ static INLINE void renderer() {
                         *pixels++ = vga_palette[eight_pixels >> 4 & 0xF];
                         *pixels++ = vga_palette[eight_pixels & 0xF];
                     }
+#endif
                     break;
                 }
                 case 0x11: /* VGA 640x480 2-color */ {
@@ -517,79 +532,66 @@ DWORD WINAPI SoundThread(LPVOID lpParam) {
 
 extern uint16_t timeconst;
 
-DWORD WINAPI TicksThread(LPVOID lpParam) {
-    LARGE_INTEGER start, current, queryperf;
-
-
-    QueryPerformanceFrequency(&queryperf);
-    uint32_t hostfreq = (uint32_t) queryperf.QuadPart;
-
-    QueryPerformanceCounter(&start); // Get the starting time
-
-    uint32_t elapsed_system_timer = 0;
-    uint32_t elapsed_blink_tics = 0;
-    uint32_t elapsed_frame_tics = 0;
-    uint32_t last_dss_tick = 0;
-    uint32_t last_sb_tick = 0;
-    uint32_t last_cms_tick = 0;
-    uint32_t last_sound_tick = 0;
-
-    int16_t last_dss_sample = 0;
-    int16_t last_sb_sample = 0;
-    int16_t last_cms_samples[2];
-
-
-    updateEvent = CreateEvent(NULL, 1, 1, NULL);
-    while (true) {
-        QueryPerformanceCounter(&current); // Get the current time
-
-        // Calculate elapsed time in ticks since the start
-        uint32_t elapsedTime = (uint32_t) (current.QuadPart - start.QuadPart);
-
-        if (elapsedTime - elapsed_system_timer >= hostfreq / timer_period) {
-            doirq(0);
-            elapsed_system_timer = elapsedTime; // Reset the tick counter for 1Hz
-        }
+static int16_t last_dss_sample = 0;
+static int16_t last_sb_sample = 0;
 
-        // Disney Sound Source frequency ~7KHz
-        if (elapsedTime - last_dss_tick >= hostfreq / 7000) {
-            last_dss_sample = dss_sample();
-            last_dss_tick = elapsedTime;
-        }
+// Device timing runs off the emulated-cycle scheduler, the host only paces exec86 to wall time
 
-        // Sound Blaster
-        if (elapsedTime - last_sb_tick >= hostfreq / sb_samplerate) {
+static void dss_event() {
+    // Disney Sound Source frequency ~7KHz
+    last_dss_sample = dss_sample();
+}
 
-            last_sb_sample = blaster_sample();
-            last_sb_tick = elapsedTime;
-        }
+static void sb_event() {
+    static uint64_t rate = 0;
+    last_sb_sample = blaster_sample();
+    if (rate != sb_samplerate) {
+        rate = sb_samplerate;
+        sched_every(SCHED_SB, SCHED_HZ(rate), sb_event);
+    }
+}
 
-        if (elapsedTime - last_sound_tick >= hostfreq / SOUND_FREQUENCY) {
-            get_sound_sample(last_dss_sample + last_sb_sample, &audio_buffer[sample_index]);
-            sample_index += 2;
+static void audio_event() {
+    get_sound_sample(last_dss_sample + last_sb_sample, &audio_buffer[sample_index]);
+    sample_index += 2;
 
-            if (sample_index >= AUDIO_BUFFER_LENGTH) {
-                SetEvent(updateEvent);
-                sample_index = 0;
-            }
+    if (sample_index >= AUDIO_BUFFER_LENGTH) {
+        SetEvent(updateEvent);
+        sample_index = 0;
+    }
+}
 
-            last_sound_tick = elapsedTime;
-        }
+static void blink_event() {
+    cursor_blink_state ^= 1;
+}
 
-        if (elapsedTime - elapsed_blink_tics >= 333'333'3) {
-            cursor_blink_state ^= 1;
-            elapsed_blink_tics = elapsedTime;
-        }
+static void frame_event() {
+    renderer();
+}
 
-        if (elapsedTime - elapsed_frame_tics >= 16'666) {
-            renderer();
-            elapsed_frame_tics = elapsedTime;
-        }
-        //        _sleep(1);
+// Sleep while emulated time is ahead of wall time. When the host falls more than
+// 100 ms behind, emulated time simply runs slower instead of bursting to catch up.
+static void pace_to_host() {
+    static LARGE_INTEGER hostfreq, host_start;
+    static uint64_t sched_start;
+    LARGE_INTEGER host;
+    QueryPerformanceCounter(&host);
+    if (!hostfreq.QuadPart) {
+        QueryPerformanceFrequency(&hostfreq);
+        host_start = host;
+        sched_start = sched_now;
+        return;
+    }
+    const uint64_t emulated = (sched_now - sched_start) * 1000 / SCHED_CPU_HZ;
+    const uint64_t elapsed = (uint64_t) (host.QuadPart - host_start.QuadPart) * 1000 / hostfreq.QuadPart;
+    if (emulated > elapsed) {
+        Sleep((DWORD) (emulated - elapsed));
+    } else if (elapsed - emulated > 100) {
+        host_start = host;
+        sched_start = sched_now;
     }
 }
 
-
 extern "C" void HandleMouse(int x, int y, uint8_t buttons) {
     static int prev_x = 0, prev_y = 0;
     sermouseevent(buttons, x - prev_x, y - prev_y);
@@ -1127,6 +1129,16 @@ extern "C" void _putchar(char character) {
 int main(int argc, char **argv) {
     int scale = 2;
 
+    // --restore FILE resumes from a snapshot, --save FILE writes one on exit
+    const char *restore_path = NULL, *save_path = NULL;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (!strcmp(argv[i], "--restore")) {
+            restore_path = argv[++i];
+        } else if (!strcmp(argv[i], "--save")) {
+            save_path = argv[++i];
+        }
+    }
+
     if (!mfb_open("PC", 640, 480, scale))
         return 1;
 
@@ -1200,12 +1212,7 @@ int main(int argc, char **argv) {
         }
         Sleep(10);
     }
-    write86 = write86_ob;
-    writew86 = writew86_ob;
-    writedw86 = writedw86_ob;
-    read86 = read86_ob;
-    readw86 = readw86_ob;
-    readdw86 = readdw86_ob;
+    memory_init(MEM_BACKEND_OB);
     //    adlib_init(SOUND_FREQUENCY);
     memset(SCREEN, 0, sizeof (SCREEN));
     emu8950_opl = OPL_new(3579552, SOUND_FREQUENCY);
@@ -1213,13 +1220,29 @@ int main(int argc, char **argv) {
     sn76489_reset();
     reset86();
 
+    init8253();
+    sched_every(SCHED_DSS, SCHED_HZ(7000), dss_event);
+    sched_every(SCHED_SB, SCHED_HZ(sb_samplerate), sb_event);
+    sched_every(SCHED_AUDIO, SCHED_HZ(SOUND_FREQUENCY), audio_event);
+    sched_every(SCHED_BLINK, SCHED_HZ(3), blink_event);
+    sched_every(SCHED_FRAME, SCHED_HZ(60), frame_event);
+
+    if (restore_path) {
+        printf(snapshot_load(restore_path) ? "Restored %s\n" : "Snapshot %s not restored, booting\n", restore_path);
+    }
+
+    updateEvent = CreateEvent(NULL, 1, 1, NULL);
     CreateThread(NULL, 0, SoundThread, NULL, 0, NULL);
-    CreateThread(NULL, 0, TicksThread, NULL, 0, NULL);
 
     while (true) {
-        exec86(32768);
-        if (mfb_update(SCREEN, 0) == -1)
+        exec86(SCHED_CPU_HZ / 1000); // ~1 ms of emulated time per slice
+        if (mfb_update(SCREEN, 0) == -1) {
+            if (save_path && !snapshot_save(save_path)) {
+                printf("Failed to save snapshot to %s\n", save_path);
+            }
             exit(1);
+        }
+        pace_to_host();
     }
     // Wait for the thread to finish
     //    WaitForSingleObject(hThread, INFINITE);
@@ -0,0 +1,276 @@
+// Replays a --swap-trace recording against the swap pager with other replacement policies, page
+// sizes and slot counts, so pager parameters can be picked from real workloads without hardware.
+//
+//   swapsim trace.bin [--policy fifo,clock,lru,opt] [--page 512,1024,2048,4096] [--cache BYTES]
+//                     [--slots N] [--clean-scan N] [--sd-cmd-us US] [--sd-read-kbs KBS] [--sd-write-kbs KBS]
+//
+// Every listed policy runs at every listed page size. Slots default to what swap.c gets out of a
+// --cache sized SRAM block, SWAP_SLOT_COUNT with the compressed pool's bytes held back. As in
+// swap.c, a miss on a page that was never written is a zero fill and a dirty page that is all
+// zeros is dropped, neither touches the card. The pool itself is not modelled, the trace carries
+// no compressibility, so pages it would keep count as write-backs and reads. The SD card is a
+// fixed per-command cost plus transfer time at the given rates; read-ahead and write clustering
+// are not modelled, every read and write-back counts as one transfer.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/emulator/swap.h"
+
+#define PAGE_DIRTY 1
+#define PAGE_REFERENCED 2
+
+static uint32_t slots;
+static uint32_t *slot_page;
+static uint8_t *slot_flags;
+static uint32_t *slot_stamp;
+static uint32_t *page_slot;  // 0 when not resident, slots are 1..slots as in swap.c
+static uint8_t *page_written; // has a copy on the card, swap_written in swap.c
+static uint8_t unit_zero[SWAP_TRACE_UNIT + 1]; // contents as of the last write record
+static uint32_t hand;
+static uint32_t clean_scan = 4;
+
+// per event: the index of the next reference to the same page, for opt
+static uint32_t *next_use;
+
+static uint32_t fifo_victim(void) {
+    const uint32_t slot = hand;
+    if (++hand > slots) hand = 1;
+    return slot;
+}
+
+static int clock_pass(const uint32_t slot) {
+    if (slot_flags[slot] & PAGE_REFERENCED) {
+        slot_flags[slot] &= ~PAGE_REFERENCED;
+        return SWAP_SLOT_REFERENCED;
+    }
+    return slot_flags[slot] & PAGE_DIRTY ? SWAP_SLOT_DIRTY : SWAP_SLOT_CLEAN;
+}
+
+// the walk swap.c uses
+static uint32_t clock_victim(void) {
+    return swap_clock_victim(&hand, slots + 1, clean_scan, clock_pass);
+}
+
+static void lru_touch(const uint32_t slot, const uint32_t event) {
+    slot_stamp[slot] = event;
+}
+
+static uint32_t lru_victim(void) {
+    uint32_t victim = 1;
+    for (uint32_t slot = 2; slot <= slots; slot++) {
+        if (slot_stamp[slot] < slot_stamp[victim]) victim = slot;
+    }
+    return victim;
+}
+
+static void opt_touch(const uint32_t slot, const uint32_t event) {
+    slot_stamp[slot] = next_use[event];
+}
+
+// Belady: the page needed furthest in the future, a lower bound for the others
+static uint32_t opt_victim(void) {
+    uint32_t victim = 1;
+    for (uint32_t slot = 2; slot <= slots; slot++) {
+        if (slot_stamp[slot] > slot_stamp[victim]) victim = slot;
+    }
+    return victim;
+}
+
+static const struct policy_s {
+    const char *name;
+    void (*touch)(uint32_t slot, uint32_t event); // NULL when the reference bit is enough
+    uint32_t (*victim)(void);
+} policies[] = {
+    { "fifo", NULL, fifo_victim },
+    { "clock", NULL, clock_victim },
+    { "lru", lru_touch, lru_victim },
+    { "opt", opt_touch, opt_victim },
+};
+
+static struct {
+    uint64_t misses, reads, zero_fills, writebacks, zero_pages;
+} result;
+
+static int page_zero(const uint32_t page, const uint32_t shift) {
+    for (uint32_t unit = page << shift; unit < (page + 1) << shift; unit++) {
+        if (!unit_zero[unit]) return 0;
+    }
+    return 1;
+}
+
+static void simulate(const struct policy_s *policy, const uint16_t *trace, const uint32_t events, const uint32_t shift) {
+    const uint32_t pages = ((SWAP_TRACE_UNIT + 1) >> shift);
+    memset(slot_page, 0, (slots + 1) * sizeof(uint32_t));
+    memset(slot_flags, 0, slots + 1);
+    memset(slot_stamp, 0, (slots + 1) * sizeof(uint32_t));
+    memset(page_slot, 0, pages * sizeof(uint32_t));
+    memset(page_written, 0, pages);
+    memset(unit_zero, 1, sizeof(unit_zero));
+    memset(&result, 0, sizeof(result));
+    hand = 1;
+    uint32_t used = 0;
+
+    for (uint32_t i = 0; i < events; i++) {
+        const uint32_t unit = trace[i] & SWAP_TRACE_UNIT;
+        const uint32_t page = unit >> shift;
+        if (trace[i] & SWAP_TRACE_WRITE) unit_zero[unit] = !!(trace[i] & SWAP_TRACE_ZERO);
+        if (!page) continue;  // page 0 owns slot 0 for good
+        uint32_t slot = page_slot[page];
+        if (!slot) {
+            slot = used < slots ? ++used : policy->victim();
+            const uint32_t old = slot_page[slot];
+            if (old) {
+                page_slot[old] = 0;
+                if (slot_flags[slot] & PAGE_DIRTY) {
+                    page_written[old] = !page_zero(old, shift);
+                    if (page_written[old]) result.writebacks++;
+                    else result.zero_pages++;
+                }
+            }
+            result.misses++;
+            if (page_written[page]) result.reads++;
+            else result.zero_fills++;
+            slot_page[slot] = page;
+            slot_flags[slot] = 0;
+            page_slot[page] = slot;
+        }
+        slot_flags[slot] |= trace[i] & SWAP_TRACE_WRITE ? PAGE_DIRTY | PAGE_REFERENCED : PAGE_REFERENCED;
+        if (policy->touch) policy->touch(slot, i);
+    }
+}
+
+static void find_next_use(const uint16_t *trace, const uint32_t events, const uint32_t shift) {
+    static uint32_t last[SWAP_TRACE_UNIT + 1];
+    for (uint32_t page = 0; page <= SWAP_TRACE_UNIT; page++) last[page] = UINT32_MAX;
+    for (uint32_t i = events; i-- > 0;) {
+        const uint32_t page = (trace[i] & SWAP_TRACE_UNIT) >> shift;
+        next_use[i] = last[page];
+        last[page] = i;
+    }
+}
+
+static int split(char *list, char **items, const int max) {
+    int count = 0;
+    for (char *item = strtok(list, ","); item && count < max; item = strtok(NULL, ",")) {
+        items[count++] = item;
+    }
+    return count;
+}
+
+int main(int argc, char **argv) {
+    char policy_list[64] = "fifo,clock,lru,opt", page_list[64] = "512,1024,2048,4096";
+    uint32_t cache = 0x29800, fixed_slots = 0;
+    double cmd_us = 250, read_kbs = 2000, write_kbs = 1000;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i], *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (arg[0] != '-') {
+            path = arg;
+            continue;
+        }
+        if (!value) {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return 1;
+        }
+        i++;
+        if (!strcmp(arg, "--policy")) {
+            snprintf(policy_list, sizeof(policy_list), "%s", value);
+        } else if (!strcmp(arg, "--page")) {
+            snprintf(page_list, sizeof(page_list), "%s", value);
+        } else if (!strcmp(arg, "--cache")) {
+            cache = strtoul(value, NULL, 0);
+        } else if (!strcmp(arg, "--slots")) {
+            fixed_slots = strtoul(value, NULL, 0);
+        } else if (!strcmp(arg, "--clean-scan")) {
+            clean_scan = strtoul(value, NULL, 0);
+        } else if (!strcmp(arg, "--sd-cmd-us")) {
+            cmd_us = atof(value);
+        } else if (!strcmp(arg, "--sd-read-kbs")) {
+            read_kbs = atof(value);
+        } else if (!strcmp(arg, "--sd-write-kbs")) {
+            write_kbs = atof(value);
+        } else {
+            fprintf(stderr, "Unknown option %s\n", arg);
+            return 1;
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: swapsim TRACE [--policy fifo,clock,lru,opt] [--page 512,...] [--cache BYTES] [--slots N]\n"
+                        "               [--clean-scan N] [--sd-cmd-us US] [--sd-read-kbs KBS] [--sd-write-kbs KBS]\n");
+        return 1;
+    }
+
+    FILE *file = fopen(path, "rb");
+    char magic[8];
+    uint32_t version;
+    if (!file || fread(magic, 1, 8, file) != 8 || memcmp(magic, SWAP_TRACE_MAGIC, 8) != 0 ||
+        fread(&version, sizeof(version), 1, file) != 1 || version != SWAP_TRACE_VERSION) {
+        fprintf(stderr, "%s is not a swap trace\n", path);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    const uint32_t events = (uint32_t) ((ftell(file) - 12) / sizeof(uint16_t));
+    fseek(file, 12, SEEK_SET);
+    uint16_t *trace = malloc((events + 1) * sizeof(uint16_t));
+    if (!trace || fread(trace, sizeof(uint16_t), events, file) != events) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return 1;
+    }
+    fclose(file);
+
+    char *policy_names[8], *page_sizes[8];
+    const int policy_count = split(policy_list, policy_names, 8);
+    const int page_count = split(page_list, page_sizes, 8);
+    page_slot = malloc((SWAP_TRACE_UNIT + 1) * sizeof(uint32_t));
+    page_written = malloc(SWAP_TRACE_UNIT + 1);
+
+    printf("%u references (runs of accesses to the same %u bytes)\n", events, 1u << SWAP_TRACE_SHIFT);
+    printf("%-6s %6s %6s %12s %8s %12s %12s %12s %12s %10s %10s %10s\n", "policy", "page", "slots", "misses",
+           "hit%", "zero fills", "zero pages", "reads", "writebacks", "read MB", "write MB", "SD s");
+    for (int p = 0; p < page_count; p++) {
+        const uint32_t page = strtoul(page_sizes[p], NULL, 0);
+        uint32_t shift = 0;
+        while ((1u << SWAP_TRACE_SHIFT << shift) < page) shift++;
+        if ((1u << SWAP_TRACE_SHIFT << shift) != page) {
+            fprintf(stderr, "Page size %u is not a power of two of at least %u\n", page, 1u << SWAP_TRACE_SHIFT);
+            return 1;
+        }
+        const uint32_t pool_pages = SWAP_ZPOOL_PAGES * SWAP_PAGE_SIZE / page;
+        slots = fixed_slots ? fixed_slots
+                : cache / page > 2 + pool_pages ? SWAP_SLOT_COUNT(cache / page, pool_pages) : 1;
+        slot_page = realloc(slot_page, (slots + 1) * sizeof(uint32_t));
+        slot_flags = realloc(slot_flags, slots + 1);
+        slot_stamp = realloc(slot_stamp, (slots + 1) * sizeof(uint32_t));
+
+        for (int n = 0; n < policy_count; n++) {
+            const struct policy_s *policy = NULL;
+            for (size_t k = 0; k < sizeof(policies) / sizeof(policies[0]); k++) {
+                if (!strcmp(policies[k].name, policy_names[n])) policy = &policies[k];
+            }
+            if (!policy) {
+                fprintf(stderr, "Unknown policy %s\n", policy_names[n]);
+                return 1;
+            }
+            if (policy->victim == opt_victim) {
+                next_use = realloc(next_use, (events + 1) * sizeof(uint32_t));
+                find_next_use(trace, events, shift);
+            }
+            simulate(policy, trace, events, shift);
+
+            const double read_mb = (double) result.reads * page / (1 << 20);
+            const double write_mb = (double) result.writebacks * page / (1 << 20);
+            const double sd_seconds = (result.reads + result.writebacks) * cmd_us / 1e6 +
+                                      read_mb * 1024 / read_kbs + write_mb * 1024 / write_kbs;
+            printf("%-6s %6u %6u %12llu %8.3f %12llu %12llu %12llu %12llu %10.1f %10.1f %10.2f\n",
+                   policy->name, page, slots, (unsigned long long) result.misses,
+                   events ? 100.0 * (events - result.misses) / events : 100.0,
+                   (unsigned long long) result.zero_fills, (unsigned long long) result.zero_pages,
+                   (unsigned long long) result.reads, (unsigned long long) result.writebacks,
+                   read_mb, write_mb, sd_seconds);
+        }
+    }
+    return 0;
+}